@@ -11,6 +11,14 @@ sudo chmod o+rw  /dev/msgslot_1
 # compile demo programs
 gcc -O3 -Wall -std=c11 message_sender.c -o message_sender
 gcc -O3 -Wall -std=c11 message_reader.c -o message_reader
+gcc -O3 -Wall -std=c11 -pthread message_bench.c -o message_bench
+gcc -O3 -Wall -std=c11 -pthread message_load.c -o message_load
+# the io_uring benchmark needs liburing
+if pkg-config --exists liburing 2>/dev/null || [ -f /usr/include/liburing.h ]; then
+    gcc -O3 -Wall -std=c11 message_uring_bench.c -o message_uring_bench -luring
+else
+    echo "-- liburing not found, skipping message_uring_bench --"
+fi
 
 echo "-- ALL BUILT --"
 
@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close */
+#include <sys/ioctl.h>  /* ioctl */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>       /* clock_gettime */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include "message_slot.h"
+#include "message_slot_ring.h"
+
+/*
+ * --- MESSAGE SLOT BENCHMARK ---
+ * Gets 2 arguments via command-line:
+ * (1) file-path of the dedicated message-slot device
+ * (2) benchmark to run:
+ *     ioctl - rate of MSG_SLOT_CHANNEL switches, for 10 up to 1M existing channels
+ *     copy  - write() / read() throughput on a single channel, for messages of 1 up to BUF_LEN bytes
+ *     latency - time from write() until a reader blocked in read() / epoll_wait() is woken up
+ *     ring  - producer / consumer throughput over a mapped ring (MSG_SLOT_SET_RING)
+ *     fanout - publishing one small update to many channels: ioctl() + write() per channel vs MSG_SLOT_WRITE_BATCH
+ * 'ioctl' uses fresh channel-ids per round, so run it on a freshly loaded module for clean numbers.
+ */
+
+#define SWITCHES_PER_ROUND 1000000
+#define MAX_CHANNELS 1000000
+#define MSGS_PER_SIZE 1000000
+#define COPY_BENCH_CHANNEL 0x7fffffff
+#define LATENCY_ROUNDS 10000
+// Lets the reader actually fall asleep before the writer writes
+#define LATENCY_WRITER_DELAY_US 100
+#define RING_MSGS 10000000
+#define RING_MSG_LEN 64
+#define FANOUT_CHANNELS 256
+#define FANOUT_ROUNDS 10000
+#define FANOUT_FIRST_CHANNEL 0x70000000
+
+//================== HELPERS ===========================
+static void error_handler(int err_cond, char* msg)
+{
+    if (err_cond)
+    {
+        perror(msg);
+        exit(1);
+    }
+}
+
+// Current monotonic time in nanoseconds
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift PRNG, cheap enough not to shadow the measured syscall
+static unsigned int next_rand(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts 'samples' and prints their summary (in microseconds)
+static void print_latencies(const char* title, double* samples, int count)
+{
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += samples[i];
+    }
+    qsort(samples, count, sizeof(*samples), compare_doubles);
+    printf("%-8s %10.2f %10.2f %10.2f %10.2f %10.2f\n", title, sum / count / 1e3,
+           samples[count / 2] / 1e3, samples[count * 99 / 100] / 1e3,
+           samples[count * 999 / 1000] / 1e3, samples[count - 1] / 1e3);
+}
+
+//================== BENCHMARKS ===========================
+/*
+ * For each channels-count N (10, 100, ..., 1M): creates N channels, then switches
+ * between them in a random order, and reports the cost of creation and switching.
+ */
+static void bench_ioctl(int fd)
+{
+    unsigned int first_id = 1;
+    unsigned int seed = 0x9e3779b9;
+    int ret_val;
+
+    printf("%10s %16s %16s %16s\n", "channels", "create ns/op", "switch ns/op", "switches/sec");
+    for (unsigned int count = 10; count <= MAX_CHANNELS; count *= 10)
+    {
+        double start = now_ns();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            ret_val = ioctl(fd, MSG_SLOT_CHANNEL, first_id + i);
+            error_handler(ret_val != SUCCESS, "Error creating channel");
+        }
+        double create_ns = (now_ns() - start) / count;
+
+        start = now_ns();
+        for (int i = 0; i < SWITCHES_PER_ROUND; i++)
+        {
+            ret_val = ioctl(fd, MSG_SLOT_CHANNEL, first_id + next_rand(&seed) % count);
+            error_handler(ret_val != SUCCESS, "Error changing channel");
+        }
+        double switch_ns = (now_ns() - start) / SWITCHES_PER_ROUND;
+
+        printf("%10u %16.1f %16.1f %16.0f\n", count, create_ns, switch_ns, 1e9 / switch_ns);
+        first_id += count;
+    }
+}
+
+/*
+ * For each message size (1, 2, 4, ..., BUF_LEN): writes and then reads the message repeatedly on
+ * one channel, and reports messages/sec and MB/sec of each direction.
+ */
+static void bench_copy(int fd)
+{
+    char buffer[BUF_LEN];
+    int ret_val;
+
+    memset(buffer, 'm', BUF_LEN);
+    ret_val = ioctl(fd, MSG_SLOT_CHANNEL, COPY_BENCH_CHANNEL);
+    error_handler(ret_val != SUCCESS, "Error changing channel");
+
+    printf("%6s %14s %12s %14s %12s\n", "bytes", "write msg/s", "write MB/s", "read msg/s", "read MB/s");
+    for (int size = 1; size <= BUF_LEN; size *= 2)
+    {
+        double start = now_ns();
+        for (int i = 0; i < MSGS_PER_SIZE; i++)
+        {
+            ret_val = write(fd, buffer, size);
+            error_handler(ret_val != size, "Error writing message");
+        }
+        double write_sec = (now_ns() - start) / 1e9;
+
+        start = now_ns();
+        for (int i = 0; i < MSGS_PER_SIZE; i++)
+        {
+            ret_val = read(fd, buffer, BUF_LEN);
+            error_handler(ret_val != size, "Error reading message");
+        }
+        double read_sec = (now_ns() - start) / 1e9;
+
+        printf("%6d %14.0f %12.1f %14.0f %12.1f\n", size,
+               MSGS_PER_SIZE / write_sec, (double) MSGS_PER_SIZE * size / write_sec / 1e6,
+               MSGS_PER_SIZE / read_sec, (double) MSGS_PER_SIZE * size / read_sec / 1e6);
+    }
+}
+
+// State shared by the latency benchmark's writer (main thread) and reader
+typedef struct latency_ctx_st
+{
+    char* f_path;
+    int use_epoll;
+    unsigned int first_id;
+    // Index of the round the reader is about to wait for
+    atomic_int armed_round;
+    double samples[LATENCY_ROUNDS];
+} latency_ctx_t;
+
+/*
+ * Reader side of the latency benchmark: for each round, moves to a fresh (empty) channel, sleeps in
+ * read() or epoll_wait() until the writer's message arrives, and records now - (timestamp in message).
+ */
+static void* latency_reader(void* arg)
+{
+    latency_ctx_t* ctx = (latency_ctx_t*) arg;
+    struct epoll_event event = { .events = EPOLLIN };
+    double sent_ns;
+    int ret_val;
+    int epfd = -1;
+
+    int fd = open(ctx -> f_path, ctx -> use_epoll ? O_RDWR | O_NONBLOCK : O_RDWR);
+    error_handler(fd < 0, "Couldn't Open file");
+    if (ctx -> use_epoll)
+    {
+        epfd = epoll_create1(0);
+        error_handler(epfd < 0, "epoll_create1()");
+    }
+
+    for (int i = 0; i < LATENCY_ROUNDS; i++)
+    {
+        ret_val = ioctl(fd, MSG_SLOT_CHANNEL, ctx -> first_id + i);
+        error_handler(ret_val != SUCCESS, "Error changing channel");
+        if (ctx -> use_epoll)
+        {
+            // The fd waits on its current channel, so it's re-registered after every switch
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            ret_val = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+            error_handler(ret_val != SUCCESS, "epoll_ctl()");
+        }
+        atomic_store(&ctx -> armed_round, i);
+
+        if (ctx -> use_epoll)
+        {
+            ret_val = epoll_wait(epfd, &event, 1, -1);
+            error_handler(ret_val != 1, "epoll_wait()");
+        }
+        ret_val = read(fd, &sent_ns, sizeof(sent_ns));
+        ctx -> samples[i] = now_ns() - sent_ns;
+        error_handler(ret_val != sizeof(sent_ns), "Error reading message");
+    }
+
+    if (epfd >= 0)
+    {
+        close(epfd);
+    }
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Measures write-to-wakeup latency of a reader blocked in read(), and of one blocked in epoll_wait().
+ */
+static void bench_latency(int fd, char* f_path)
+{
+    static latency_ctx_t ctx;
+    pthread_t reader;
+    double sent_ns;
+    int ret_val;
+
+    printf("%-8s %10s %10s %10s %10s %10s   (usec)\n", "waiter", "avg", "p50", "p99", "p999", "max");
+    for (int use_epoll = 0; use_epoll <= 1; use_epoll++)
+    {
+        ctx.f_path = f_path;
+        ctx.use_epoll = use_epoll;
+        // Channels keep their message forever, so every run needs never-written channels
+        ctx.first_id = 1 + (unsigned int) ((unsigned long) now_ns() % 0x70000000u);
+        atomic_store(&ctx.armed_round, -1);
+        ret_val = pthread_create(&reader, NULL, latency_reader, &ctx);
+        error_handler(ret_val != SUCCESS, "pthread_create()");
+
+        for (int i = 0; i < LATENCY_ROUNDS; i++)
+        {
+            ret_val = ioctl(fd, MSG_SLOT_CHANNEL, ctx.first_id + i);
+            error_handler(ret_val != SUCCESS, "Error changing channel");
+            while (atomic_load(&ctx.armed_round) != i)
+            {
+                // reader is still handling the previous round
+            }
+            usleep(LATENCY_WRITER_DELAY_US);
+            sent_ns = now_ns();
+            ret_val = write(fd, &sent_ns, sizeof(sent_ns));
+            error_handler(ret_val != sizeof(sent_ns), "Error writing message");
+        }
+
+        pthread_join(reader, NULL);
+        print_latencies(use_epoll ? "epoll" : "read", ctx.samples, LATENCY_ROUNDS);
+    }
+}
+
+// State shared by the ring benchmark's consumer (main thread) and producer
+typedef struct ring_ctx_st
+{
+    char* f_path;
+    unsigned int channel_id;
+    struct msg_slot_ring_cfg cfg;
+} ring_ctx_t;
+
+// Opens its own fd on the benchmark's ring channel and maps the ring
+static int open_ring(ring_ctx_t* ctx, msg_slot_ring_t* ring)
+{
+    int fd = open(ctx -> f_path, O_RDWR);
+    error_handler(fd < 0, "Couldn't Open file");
+    int ret_val = ioctl(fd, MSG_SLOT_CHANNEL, ctx -> channel_id);
+    error_handler(ret_val != SUCCESS, "Error changing channel");
+    ret_val = msg_slot_ring_open(ring, fd, ctx -> cfg);
+    error_handler(ret_val != SUCCESS, "Error mapping ring");
+    return fd;
+}
+
+static void* ring_producer(void* arg)
+{
+    ring_ctx_t* ctx = (ring_ctx_t*) arg;
+    msg_slot_ring_t ring;
+    char msg[RING_MSG_LEN];
+
+    int fd = open_ring(ctx, &ring);
+    memset(msg, 'r', sizeof(msg));
+    for (int i = 0; i < RING_MSGS; i++)
+    {
+        error_handler(msg_slot_ring_send(&ring, msg, sizeof(msg), 0) != 0, "Error sending to ring");
+    }
+    msg_slot_ring_close(&ring);
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Moves RING_MSGS messages of RING_MSG_LEN bytes from a producer thread to the main thread
+ * through a mapped ring, and reports messages/sec.
+ */
+static void bench_ring(char* f_path)
+{
+    ring_ctx_t ctx = { .f_path = f_path, .cfg = { .slot_size = 128, .slot_count = 1024 } };
+    msg_slot_ring_t ring;
+    pthread_t producer;
+    __u32 len;
+    int ret_val;
+
+    // A channel that was written (or mapped with another geometry) can't become this ring, so a fresh one is used
+    ctx.channel_id = 1 + (unsigned int) ((unsigned long) now_ns() % 0x70000000u);
+    int fd = open_ring(&ctx, &ring);
+
+    double start = now_ns();
+    ret_val = pthread_create(&producer, NULL, ring_producer, &ctx);
+    error_handler(ret_val != SUCCESS, "pthread_create()");
+    for (int i = 0; i < RING_MSGS; i++)
+    {
+        error_handler(msg_slot_ring_peek(&ring, &len, 0) == NULL, "Error receiving from ring");
+        error_handler(len != RING_MSG_LEN, "Unexpected message length");
+        msg_slot_ring_consume(&ring);
+    }
+    double ring_sec = (now_ns() - start) / 1e9;
+    pthread_join(producer, NULL);
+
+    printf("%-10s %14s %12s\n", "path", "msg/s", "MB/s");
+    printf("%-10s %14.0f %12.1f\n", "ring", RING_MSGS / ring_sec, (double) RING_MSGS * RING_MSG_LEN / ring_sec / 1e6);
+    msg_slot_ring_close(&ring);
+    close(fd);
+}
+
+/*
+ * Writes a 16-byte update to each of FANOUT_CHANNELS channels, FANOUT_ROUNDS times, once with a
+ * channel switch + write() per channel and once with a single MSG_SLOT_WRITE_BATCH per round.
+ */
+static void bench_fanout(int fd)
+{
+    static struct msg_slot_batch_entry entries[FANOUT_CHANNELS];
+    struct msg_slot_batch batch = { .entries = (__u64) (unsigned long) entries, .count = FANOUT_CHANNELS };
+    char update[16];
+    int ret_val;
+
+    memset(update, 'u', sizeof(update));
+    for (int c = 0; c < FANOUT_CHANNELS; c++)
+    {
+        entries[c].channel_id = FANOUT_FIRST_CHANNEL + c;
+        entries[c].length = sizeof(update);
+        entries[c].buffer = (__u64) (unsigned long) update;
+    }
+
+    double start = now_ns();
+    for (int r = 0; r < FANOUT_ROUNDS; r++)
+    {
+        for (int c = 0; c < FANOUT_CHANNELS; c++)
+        {
+            ret_val = ioctl(fd, MSG_SLOT_CHANNEL, FANOUT_FIRST_CHANNEL + c);
+            error_handler(ret_val != SUCCESS, "Error changing channel");
+            ret_val = write(fd, update, sizeof(update));
+            error_handler(ret_val != sizeof(update), "Error writing message");
+        }
+    }
+    double single_sec = (now_ns() - start) / 1e9;
+
+    start = now_ns();
+    for (int r = 0; r < FANOUT_ROUNDS; r++)
+    {
+        ret_val = ioctl(fd, MSG_SLOT_WRITE_BATCH, &batch);
+        error_handler(ret_val != FANOUT_CHANNELS, "Error writing batch");
+    }
+    double batch_sec = (now_ns() - start) / 1e9;
+
+    double msgs = (double) FANOUT_ROUNDS * FANOUT_CHANNELS;
+    printf("%-14s %14s\n", "path", "msg/s");
+    printf("%-14s %14.0f\n", "ioctl+write", msgs / single_sec);
+    printf("%-14s %14.0f\n", "write batch", msgs / batch_sec);
+}
+
+//================== MAIN ===========================
+int main(int argc, char * argv[])
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <device-path> ioctl|copy|latency|ring|fanout\n", argv[0]);
+        exit(1);
+    }
+    char* f_path = argv[1];
+    char* bench_name = argv[2];
+
+    int fd = open(f_path, O_RDWR);
+    error_handler(fd < 0, "Couldn't Open file");
+
+    if (strcmp(bench_name, "ioctl") == 0)
+    {
+        bench_ioctl(fd);
+    }
+    else if (strcmp(bench_name, "copy") == 0)
+    {
+        bench_copy(fd);
+    }
+    else if (strcmp(bench_name, "latency") == 0)
+    {
+        bench_latency(fd, f_path);
+    }
+    else if (strcmp(bench_name, "ring") == 0)
+    {
+        bench_ring(f_path);
+    }
+    else if (strcmp(bench_name, "fanout") == 0)
+    {
+        bench_fanout(fd);
+    }
+    else
+    {
+        fprintf(stderr, "Unknown benchmark: %s\n", bench_name);
+        exit(1);
+    }
+
+    close(fd);
+    return SUCCESS;
+}
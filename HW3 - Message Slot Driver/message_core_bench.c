@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "message_slot_core.h"
+
+/*
+ * --- MESSAGE SLOT CORE BENCHMARK ---
+ * Microbenchmarks of the channel store built in user space (see message_slot_shim.h),
+ * so no module / device / root is needed. Gets 1 argument via command-line:
+ *     lookup - channel creation, and lookups in a random order, for 10 up to 1M existing channels
+ *     copy   - write + read of a single-message channel, for messages of 1 up to BUF_LEN bytes
+ *     queue  - enqueue + dequeue of a queued channel, for messages of 1 up to MSG_SLOT_MAX_MSG_LEN bytes
+ * Costs include the shim's user copies (memcpy) but no syscalls, so they isolate the store's own work.
+ */
+
+#define LOOKUPS_PER_ROUND 10000000
+#define MAX_CHANNELS 1000000
+#define MSGS_PER_SIZE 1000000
+#define QUEUE_DEPTH 64
+
+//================== HELPERS ===========================
+static void error_handler(int err_cond, char* msg)
+{
+    if (err_cond)
+    {
+        fprintf(stderr, "%s\n", msg);
+        exit(1);
+    }
+}
+
+// Current monotonic time in nanoseconds
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift PRNG, cheap enough not to shadow the measured operation
+static unsigned int next_rand(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+//================== BENCHMARKS ===========================
+/*
+ * For each channels-count N (10, 100, ..., 1M): creates N channels (on a fresh minor),
+ * then looks them up in a random order, and reports the cost of both.
+ */
+static void bench_lookup(void)
+{
+    unsigned int seed = 0x9e3779b9;
+    channel_t* channel;
+
+    printf("%10s %16s %16s %16s\n", "channels", "create ns/op", "lookup ns/op", "bytes/channel");
+    for (unsigned int count = 10; count <= MAX_CHANNELS; count *= 10)
+    {
+        file_data_t* f_data = alloc_fdata(0);
+        error_handler(f_data == NULL, "Error allocating minor");
+
+        double start = now_ns();
+        for (unsigned int i = 1; i <= count; i++)
+        {
+            channel = get_or_create_channel(f_data, i);
+            error_handler(IS_ERR(channel), "Error creating channel");
+            put_channel(channel);
+        }
+        double create_ns = (now_ns() - start) / count;
+
+        start = now_ns();
+        for (int i = 0; i < LOOKUPS_PER_ROUND; i++)
+        {
+            channel = lookup_channel(f_data, 1 + next_rand(&seed) % count);
+            error_handler(channel == NULL, "Error looking up channel");
+            put_channel(channel);
+        }
+        double lookup_ns = (now_ns() - start) / LOOKUPS_PER_ROUND;
+
+        printf("%10u %16.1f %16.1f %16.1f\n", count, create_ns, lookup_ns,
+               (double) atomic_long_read(&f_data -> mem_bytes) / count);
+        free_fdata(f_data);
+    }
+}
+
+/*
+ * For each message size (1, 2, 4, ..., BUF_LEN): writes and then reads the message repeatedly
+ * on one channel, and reports the cost of each.
+ */
+static void bench_copy(void)
+{
+    char buffer[BUF_LEN];
+    ssize_t ret_val;
+
+    file_data_t* f_data = alloc_fdata(0);
+    error_handler(f_data == NULL, "Error allocating minor");
+    channel_t* channel = get_or_create_channel(f_data, 1);
+    error_handler(IS_ERR(channel), "Error creating channel");
+    memset(buffer, 'm', BUF_LEN);
+
+    printf("%10s %16s %16s\n", "msg bytes", "write ns/op", "read ns/op");
+    for (unsigned int size = 1; size <= BUF_LEN; size *= 2)
+    {
+        double start = now_ns();
+        for (int i = 0; i < MSGS_PER_SIZE; i++)
+        {
+            ret_val = channel_write_msg(channel, buffer, size, true);
+            error_handler(ret_val != size, "Error writing message");
+        }
+        double write_ns = (now_ns() - start) / MSGS_PER_SIZE;
+
+        start = now_ns();
+        for (int i = 0; i < MSGS_PER_SIZE; i++)
+        {
+            ret_val = channel_read_msg(channel, NULL, buffer, NULL, BUF_LEN, true);
+            error_handler(ret_val != size, "Error reading message");
+        }
+        double read_ns = (now_ns() - start) / MSGS_PER_SIZE;
+
+        printf("%10u %16.1f %16.1f\n", size, write_ns, read_ns);
+    }
+    put_channel(channel);
+    free_fdata(f_data);
+}
+
+/*
+ * For each message size (1, 4, 16, ..., MSG_SLOT_MAX_MSG_LEN): fills a queued channel and drains it,
+ * and reports the cost per message of each direction.
+ */
+static void bench_queue(void)
+{
+    static char buffer[MSG_SLOT_MAX_MSG_LEN];
+    struct msg_slot_queue_cfg cfg = { QUEUE_DEPTH, MSG_SLOT_MAX_MSG_LEN, MSG_SLOT_OVERFLOW_FAIL };
+    double enqueue_ns;
+    double dequeue_ns;
+    ssize_t ret_val;
+
+    file_data_t* f_data = alloc_fdata(0);
+    error_handler(f_data == NULL, "Error allocating minor");
+    channel_t* channel = get_or_create_channel(f_data, 1);
+    error_handler(IS_ERR(channel), "Error creating channel");
+    error_handler(channel_set_queue(channel, &cfg) != SUCCESS, "Error configuring queue");
+    memset(buffer, 'q', sizeof(buffer));
+
+    printf("%10s %16s %16s\n", "msg bytes", "enqueue ns/op", "dequeue ns/op");
+    for (unsigned int size = 1; size <= MSG_SLOT_MAX_MSG_LEN; size *= 4)
+    {
+        enqueue_ns = 0;
+        dequeue_ns = 0;
+        for (int round = 0; round < MSGS_PER_SIZE / QUEUE_DEPTH; round++)
+        {
+            double start = now_ns();
+            for (int i = 0; i < QUEUE_DEPTH; i++)
+            {
+                ret_val = channel_write_msg(channel, buffer, size, true);
+                error_handler(ret_val != size, "Error enqueueing message");
+            }
+            double middle = now_ns();
+            for (int i = 0; i < QUEUE_DEPTH; i++)
+            {
+                ret_val = channel_read_msg(channel, NULL, buffer, NULL, sizeof(buffer), true);
+                error_handler(ret_val != size, "Error dequeueing message");
+            }
+            enqueue_ns += middle - start;
+            dequeue_ns += now_ns() - middle;
+        }
+        int msgs = MSGS_PER_SIZE / QUEUE_DEPTH * QUEUE_DEPTH;
+        printf("%10u %16.1f %16.1f\n", size, enqueue_ns / msgs, dequeue_ns / msgs);
+    }
+    put_channel(channel);
+    free_fdata(f_data);
+}
+
+//================== MAIN ===========================
+int main(int argc, char * argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s lookup|copy|queue\n", argv[0]);
+        exit(1);
+    }
+    channel_cache = kmem_cache_create("message_slot_channel", sizeof(channel_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+    error_handler(channel_cache == NULL, "Error creating channel cache");
+
+    if (strcmp(argv[1], "lookup") == 0)
+    {
+        bench_lookup();
+    }
+    else if (strcmp(argv[1], "copy") == 0)
+    {
+        bench_copy();
+    }
+    else if (strcmp(argv[1], "queue") == 0)
+    {
+        bench_queue();
+    }
+    else
+    {
+        fprintf(stderr, "Unknown benchmark: %s\n", argv[1]);
+        exit(1);
+    }
+
+    kmem_cache_destroy(channel_cache);
+    return SUCCESS;
+}
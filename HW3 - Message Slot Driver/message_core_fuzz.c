@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include "message_slot_core.h"
+
+/*
+ * --- MESSAGE SLOT CORE FUZZER ---
+ * libFuzzer target for the channel store built in user space (see message_slot_shim.h).
+ * The input is a sequence of operations on a fresh minor, each an opcode byte followed by its arguments:
+ * write, read, queue configuration, queue statistics, ring configuration, broadcast configuration, sequence waits
+ * and detaching (as the idle reclaimer does), on a small set of channel-ids. Reads of a broadcast channel go
+ * through a cursor per channel-id, as a single subscriber's would. Transfers never block. After the sequence
+ * the store's accounting is checked against its channels, and everything is freed (so leaks are reported by
+ * the sanitizer).
+ * Build (see the Makefile's 'fuzz' target) and run: ./message_core_fuzz [corpus-dir]
+ */
+
+// Channel-ids used are 1..FUZZ_CHANNELS, so operations keep meeting the same channels
+#define FUZZ_CHANNELS 8
+
+enum
+{
+    OP_WRITE,
+    OP_READ,
+    OP_SET_QUEUE,
+    OP_QUEUE_STATS,
+    OP_SET_RING,
+    OP_DETACH,
+    OP_SET_BROADCAST,
+    OP_WAIT_SEQ,
+    OPS_COUNT
+};
+
+// Consumes the input
+typedef struct input_st
+{
+    const uint8_t* data;
+    size_t size;
+} input_t;
+
+static uint8_t next_u8(input_t* in)
+{
+    if (in -> size == 0)
+    {
+        return 0;
+    }
+    in -> size--;
+    return *in -> data++;
+}
+
+static uint32_t next_u16(input_t* in)
+{
+    return next_u8(in) | (next_u8(in) << 8);
+}
+
+// Aborts (so the fuzzer reports a crash) when the store's invariants don't hold
+static void check(int cond, const char* msg)
+{
+    if (!cond)
+    {
+        fprintf(stderr, "invariant violated: %s\n", msg);
+        abort();
+    }
+}
+
+// The minor's counters must match its channels
+static void check_accounting(file_data_t* f_data)
+{
+    channel_t* channel;
+    unsigned long id;
+    long channels = 0;
+    long mem_bytes = 0;
+
+    xa_for_each(&f_data -> channels, id, channel)
+    {
+        check(channel -> id == id, "channel indexed under another id");
+        check(refcount_read(&channel -> refs) == 1, "channel reference leaked");
+        check(channel -> queue.count <= channel -> queue.depth, "queue overfilled");
+        channels++;
+        mem_bytes += channel -> mem_bytes;
+    }
+    check(channels == atomic_long_read(&f_data -> channels_count), "channels count mismatch");
+    check(mem_bytes == atomic_long_read(&f_data -> mem_bytes), "memory accounting mismatch");
+}
+
+// Read cursors of the channels (index 0 is unused)
+static u64 cursors[FUZZ_CHANNELS + 1];
+
+static void run_op(file_data_t* f_data, input_t* in)
+{
+    static char msg[MSG_SLOT_MAX_MSG_LEN + 1];
+    static char buffer[MSG_SLOT_MAX_MSG_LEN + 1];
+    uint8_t op = next_u8(in) % OPS_COUNT;
+    unsigned int id = 1 + next_u8(in) % FUZZ_CHANNELS;
+    channel_t* channel;
+    ssize_t ret_val;
+
+    if (op == OP_DETACH)
+    {
+        channel = lookup_channel(f_data, id);
+        if (channel == NULL)
+        {
+            return;
+        }
+        put_channel(channel);
+        xa_lock(&f_data -> channels);
+        if (channel_try_detach(f_data, channel))
+        {
+            call_rcu(&channel -> rcu, free_channel_rcu);
+            // A channel created under this id again starts its sequence numbers over
+            cursors[id] = 0;
+        }
+        xa_unlock(&f_data -> channels);
+        return;
+    }
+
+    channel = get_or_create_channel(f_data, id);
+    check(!IS_ERR(channel), "channel creation failed");
+    if (op == OP_WRITE)
+    {
+        size_t length = next_u16(in) % (sizeof(msg) + 1);
+        memset(msg, next_u8(in), length);
+        ret_val = channel_write_msg(channel, msg, length, true);
+        check(ret_val == (ssize_t) length || ret_val < 0, "partial write");
+    }
+    else if (op == OP_READ)
+    {
+        size_t length = next_u16(in) % (sizeof(buffer) + 1);
+        // Odd bytes read through the cursor, even ones as a batched read does
+        u64* cursor = (next_u8(in) & 1) ? &cursors[id] : NULL;
+        ret_val = channel_read_msg(channel, cursor, buffer, NULL, length, true);
+        check(ret_val <= (ssize_t) length, "read past the buffer");
+        check(channel -> bcast.depth == 0 || cursors[id] <= channel -> bcast.next_seq, "cursor past the last message");
+    }
+    else if (op == OP_SET_QUEUE)
+    {
+        struct msg_slot_queue_cfg cfg;
+        // Mostly valid configurations, with the bounds crossed now and then
+        cfg.depth = next_u8(in) % 18;
+        cfg.max_msg_len = next_u16(in) % (MSG_SLOT_MAX_MSG_LEN / 256 + 2) * 257;
+        cfg.overflow_policy = next_u8(in) % 4;
+        channel_set_queue(channel, &cfg);
+    }
+    else if (op == OP_QUEUE_STATS)
+    {
+        struct msg_slot_queue_stats stats;
+        // A single-message channel reports a depth of 0
+        if (channel_queue_stats(channel, &stats) == SUCCESS && stats.depth > 0)
+        {
+            check(stats.count <= stats.depth, "stats report an overfilled queue");
+            check(stats.high_water <= stats.depth, "stats report a high-water mark above the depth");
+        }
+    }
+    else if (op == OP_SET_BROADCAST)
+    {
+        struct msg_slot_broadcast_cfg cfg;
+        cfg.depth = next_u8(in) % 18;
+        cfg.max_msg_len = next_u16(in) % (MSG_SLOT_MAX_MSG_LEN / 256 + 2) * 257;
+        if (channel_set_broadcast(channel, &cfg) == SUCCESS)
+        {
+            cursors[id] = channel_start_cursor(channel);
+        }
+    }
+    else if (op == OP_WAIT_SEQ)
+    {
+        struct msg_slot_seq_wait wait;
+        wait.seq = next_u8(in);
+        if (channel_wait_seq(channel, &cursors[id], &wait, true) == SUCCESS)
+        {
+            check(wait.latest > wait.seq, "wait returned before the sequence number");
+            check(wait.latest - wait.oldest < channel -> bcast.depth, "more messages retained than the depth");
+            check(wait.oldest <= wait.cursor && wait.cursor <= wait.latest + 1, "cursor out of the retained range");
+        }
+    }
+    else
+    {
+        struct msg_slot_ring_cfg cfg;
+        cfg.slot_size = next_u8(in) * 4;
+        cfg.slot_count = 1U << (next_u8(in) % 12);
+        channel_set_ring(channel, &cfg);
+    }
+    put_channel(channel);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    input_t in = { data, size };
+
+    if (channel_cache == NULL)
+    {
+        channel_cache = kmem_cache_create("message_slot_channel", sizeof(channel_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+        check(channel_cache != NULL, "channel cache creation failed");
+    }
+    file_data_t* f_data = alloc_fdata(0);
+    check(f_data != NULL, "minor allocation failed");
+    memset(cursors, 0, sizeof(cursors));
+
+    while (in.size > 0)
+    {
+        run_op(f_data, &in);
+    }
+    check_accounting(f_data);
+
+    free_fdata(f_data);
+    // Frees the detached channels
+    rcu_barrier();
+    return 0;
+}
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close */
+#include <sys/ioctl.h>  /* ioctl */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>       /* clock_gettime */
+#include <pthread.h>
+#include <sched.h>      /* CPU pinning */
+#include <stdatomic.h>
+#include "message_slot.h"
+
+/*
+ * --- MESSAGE SLOT LOAD GENERATOR ---
+ * Usage: message_load <device-path> [options]
+ *   -t threads      worker threads, each with its own fd (default 4)
+ *   -c channels     channels the operations are spread over, uniformly at random (default 1024)
+ *   -s size[-max]   message size, or a range sizes are drawn from uniformly (default 32, up to BUF_LEN)
+ *   -r percent      percentage of reads, the rest are writes (default 50)
+ *   -d seconds      duration (default 5)
+ *   -a api          xfer - a single MSG_SLOT_SEND / MSG_SLOT_RECV per operation (default)
+ *                   rw   - ioctl(MSG_SLOT_CHANNEL) + write() / read(), as the demo programs did
+ *   -p              pin thread i to the i-th CPU the process may run on (round-robin)
+ * Every channel gets a message before the run, so reads find one. Reports throughput,
+ * and per operation type its p50 / p99 / p999 / max latency.
+ */
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_CHANNELS 1024
+#define DEFAULT_MSG_SIZE 32
+#define DEFAULT_READ_PERCENT 50
+#define DEFAULT_DURATION_SECS 5
+#define FIRST_CHANNEL 0x50000000
+
+// Latency histogram: exact below 2^HIST_SUB_BITS ns, then 2^HIST_SUB_BITS buckets per power of 2 (~3% error)
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_COUNT)
+
+enum { OP_READ, OP_WRITE, OPS_COUNT };
+static const char* op_names[OPS_COUNT] = { "read", "write" };
+
+typedef struct load_cfg_st
+{
+    char* f_path;
+    int threads;
+    unsigned int channels;
+    unsigned int min_size;
+    unsigned int max_size;
+    unsigned int read_percent;
+    unsigned int duration_secs;
+    int use_rw;
+    int pin;
+} load_cfg_t;
+
+// Per-thread results, merged by main once the thread is done
+typedef struct worker_st
+{
+    pthread_t thread;
+    int index;
+    int cpu;
+    const load_cfg_t* cfg;
+    unsigned long ops[OPS_COUNT];
+    unsigned long bytes[OPS_COUNT];
+    unsigned long errors;
+    unsigned long hist[OPS_COUNT][HIST_BUCKETS];
+} worker_t;
+
+static atomic_int stop_flag;
+
+//================== HELPERS ===========================
+static void error_handler(int err_cond, char* msg)
+{
+    if (err_cond)
+    {
+        perror(msg);
+        exit(1);
+    }
+}
+
+static unsigned long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// xorshift PRNG, cheap enough not to shadow the measured syscall
+static unsigned int next_rand(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int hist_index(unsigned long ns)
+{
+    if (ns < HIST_SUB_COUNT)
+    {
+        return ns;
+    }
+    int msb = 63 - __builtin_clzl(ns);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + ((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+// Lowest latency (ns) counted into the bucket
+static unsigned long hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT)
+    {
+        return index;
+    }
+    int msb = (index >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (unsigned long) (HIST_SUB_COUNT + (index & (HIST_SUB_COUNT - 1))) << (msb - HIST_SUB_BITS);
+}
+
+// Latency (ns) below which 'fraction' of the 'total' samples fall
+static unsigned long hist_percentile(const unsigned long* hist, unsigned long total, double fraction)
+{
+    unsigned long rank = (unsigned long) (fraction * total);
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist[i];
+        if (seen > rank)
+        {
+            return hist_value(i);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+static unsigned long hist_max(const unsigned long* hist)
+{
+    for (int i = HIST_BUCKETS - 1; i >= 0; i--)
+    {
+        if (hist[i] != 0)
+        {
+            return hist_value(i);
+        }
+    }
+    return 0;
+}
+
+// The 'n'-th CPU of the process' affinity mask (round-robin), for pinning
+static int nth_allowed_cpu(int n)
+{
+    cpu_set_t allowed;
+    error_handler(sched_getaffinity(0, sizeof(allowed), &allowed) != 0, "Error getting CPU affinity");
+    n %= CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+        {
+            return cpu;
+        }
+    }
+    return 0;
+}
+
+//================== WORKERS ===========================
+// One operation on the fd, returns the syscall's result
+static int do_op(int fd, const load_cfg_t* cfg, int op, unsigned int channel_id, char* buffer, unsigned int size)
+{
+    if (!cfg -> use_rw)
+    {
+        struct msg_slot_xfer xfer =
+        {
+            .channel_id = channel_id,
+            .length = (op == OP_READ) ? BUF_LEN : size,
+            .buffer = (unsigned long) buffer,
+        };
+        return ioctl(fd, (op == OP_READ) ? MSG_SLOT_RECV : MSG_SLOT_SEND, &xfer);
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, channel_id) != SUCCESS)
+    {
+        return -1;
+    }
+    return (op == OP_READ) ? read(fd, buffer, BUF_LEN) : write(fd, buffer, size);
+}
+
+static void* worker_main(void* arg)
+{
+    worker_t* worker = (worker_t*) arg;
+    const load_cfg_t* cfg = worker -> cfg;
+    unsigned int seed = 0x9e3779b9 * (worker -> index + 1);
+    char buffer[BUF_LEN];
+
+    if (worker -> cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker -> cpu, &cpus);
+        errno = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        error_handler(errno != 0, "Error pinning thread");
+    }
+    // Non-blocking, so a channel emptied by another reader can't hang the run
+    int fd = open(cfg -> f_path, O_RDWR | O_NONBLOCK);
+    error_handler(fd < 0, "Couldn't Open file");
+    memset(buffer, 'l', sizeof(buffer));
+
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed))
+    {
+        unsigned int channel_id = FIRST_CHANNEL + next_rand(&seed) % cfg -> channels;
+        int op = (next_rand(&seed) % 100 < cfg -> read_percent) ? OP_READ : OP_WRITE;
+        unsigned int size = cfg -> min_size + next_rand(&seed) % (cfg -> max_size - cfg -> min_size + 1);
+
+        unsigned long start = now_ns();
+        int ret_val = do_op(fd, cfg, op, channel_id, buffer, size);
+        unsigned long elapsed = now_ns() - start;
+
+        if (ret_val < 0)
+        {
+            worker -> errors++;
+            continue;
+        }
+        worker -> ops[op]++;
+        worker -> bytes[op] += ret_val;
+        worker -> hist[op][hist_index(elapsed)]++;
+    }
+    close(fd);
+    return NULL;
+}
+
+//================== MAIN ===========================
+static void usage(char* prog)
+{
+    fprintf(stderr, "Usage: %s <device-path> [-t threads] [-c channels] [-s size[-max]] [-r read-percent] "
+                    "[-d seconds] [-a xfer|rw] [-p]\n", prog);
+    exit(1);
+}
+
+static load_cfg_t parse_args(int argc, char* argv[])
+{
+    load_cfg_t cfg =
+    {
+        .threads = DEFAULT_THREADS,
+        .channels = DEFAULT_CHANNELS,
+        .min_size = DEFAULT_MSG_SIZE,
+        .max_size = DEFAULT_MSG_SIZE,
+        .read_percent = DEFAULT_READ_PERCENT,
+        .duration_secs = DEFAULT_DURATION_SECS,
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:s:r:d:a:p")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': cfg.threads = atoi(optarg); break;
+            case 'c': cfg.channels = atoi(optarg); break;
+            case 's':
+                if (sscanf(optarg, "%u-%u", &cfg.min_size, &cfg.max_size) != 2)
+                {
+                    cfg.max_size = cfg.min_size = atoi(optarg);
+                }
+                break;
+            case 'r': cfg.read_percent = atoi(optarg); break;
+            case 'd': cfg.duration_secs = atoi(optarg); break;
+            case 'a': cfg.use_rw = (strcmp(optarg, "rw") == 0); break;
+            case 'p': cfg.pin = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || cfg.threads <= 0 || cfg.channels == 0 || cfg.min_size == 0 ||
+        cfg.min_size > cfg.max_size || cfg.max_size > BUF_LEN || cfg.read_percent > 100 || cfg.duration_secs == 0)
+    {
+        usage(argv[0]);
+    }
+    cfg.f_path = argv[optind];
+    return cfg;
+}
+
+int main(int argc, char * argv[])
+{
+    load_cfg_t cfg = parse_args(argc, argv);
+    char buffer[BUF_LEN];
+
+    // Leaves a message in every channel
+    int fd = open(cfg.f_path, O_RDWR);
+    error_handler(fd < 0, "Couldn't Open file");
+    memset(buffer, 'l', sizeof(buffer));
+    for (unsigned int i = 0; i < cfg.channels; i++)
+    {
+        struct msg_slot_xfer xfer = { FIRST_CHANNEL + i, cfg.max_size, (unsigned long) buffer };
+        error_handler(ioctl(fd, MSG_SLOT_SEND, &xfer) < 0, "Error filling channels");
+    }
+    close(fd);
+
+    worker_t* workers = calloc(cfg.threads, sizeof(*workers));
+    error_handler(workers == NULL, "Error allocating workers");
+    for (int i = 0; i < cfg.threads; i++)
+    {
+        workers[i].index = i;
+        workers[i].cfg = &cfg;
+        workers[i].cpu = cfg.pin ? nth_allowed_cpu(i) : -1;
+        errno = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        error_handler(errno != 0, "Error creating thread");
+    }
+    unsigned long start = now_ns();
+    struct timespec duration = { .tv_sec = cfg.duration_secs };
+    while (nanosleep(&duration, &duration) != 0 && errno == EINTR)
+    {
+    }
+    atomic_store(&stop_flag, 1);
+
+    // Merges the workers' results into the first one
+    worker_t* total = &workers[0];
+    for (int i = 0; i < cfg.threads; i++)
+    {
+        errno = pthread_join(workers[i].thread, NULL);
+        error_handler(errno != 0, "Error joining thread");
+        if (i == 0)
+        {
+            continue;
+        }
+        total -> errors += workers[i].errors;
+        for (int op = 0; op < OPS_COUNT; op++)
+        {
+            total -> ops[op] += workers[i].ops[op];
+            total -> bytes[op] += workers[i].bytes[op];
+            for (int b = 0; b < HIST_BUCKETS; b++)
+            {
+                total -> hist[op][b] += workers[i].hist[op][b];
+            }
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    printf("%d threads%s, %u channels, %u-%u bytes, %u%% reads, %s, %.1f sec\n", cfg.threads,
+           cfg.pin ? " (pinned)" : "", cfg.channels, cfg.min_size, cfg.max_size, cfg.read_percent,
+           cfg.use_rw ? "ioctl + read/write" : "MSG_SLOT_SEND/RECV", secs);
+    printf("%-6s %14s %10s %10s %10s %10s %10s\n", "op", "ops/sec", "MB/sec", "p50 us", "p99 us", "p999 us", "max us");
+    for (int op = 0; op < OPS_COUNT; op++)
+    {
+        const unsigned long* hist = total -> hist[op];
+        unsigned long count = total -> ops[op];
+        if (count == 0)
+        {
+            continue;
+        }
+        printf("%-6s %14.0f %10.1f %10.2f %10.2f %10.2f %10.2f\n", op_names[op], count / secs,
+               total -> bytes[op] / secs / 1e6, hist_percentile(hist, count, 0.5) / 1e3,
+               hist_percentile(hist, count, 0.99) / 1e3, hist_percentile(hist, count, 0.999) / 1e3,
+               hist_max(hist) / 1e3);
+    }
+    printf("%-6s %14.0f   (%lu failed operations)\n", "total", (total -> ops[OP_READ] + total -> ops[OP_WRITE]) / secs,
+           total -> errors);
+
+    free(workers);
+    return SUCCESS;
+}
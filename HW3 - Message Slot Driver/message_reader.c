@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <fcntl.h>      /* open */
 #include <unistd.h>     /* exit */
 #include <sys/ioctl.h>  /* ioctl */
@@ -6,23 +7,29 @@
 #include "message_slot.h"
 
 /*
- *  --- MESSAGE SENDER SCRIPT ---
- * Gets 2 arguments via command-line:
+ *  --- MESSAGE READER SCRIPT ---
+ * Gets 2 (or 3) arguments via command-line:
  * (1) file-path of the dedicated message-slot device
  * (2) target channel id, assumes non-negative valid int
+ * (3) optional - number of messages to read (loop mode), defaults to 1.
+ *     In loop mode each message is followed by a newline. Only a queued or broadcast channel is accepted, as
+ *     reading a single-message channel doesn't consume its message (it would be printed again and again)
+ * Each message is read by a single MSG_SLOT_RECV ioctl, selecting the channel and reading at once.
  */
 int main(int argc, char * argv[])
 {
-    char* buffer[BUF_LEN];
+    // Large enough for a queued channel's message as well
+    static char buffer[MSG_SLOT_MAX_MSG_LEN + 1];
     int bytes_read;
 
-    if(argc != 3)
+    if(argc != 3 && argc != 4)
     {
         perror("Invalid args count");
         exit(1);
     }
     char* f_path = argv[1];
     unsigned int target_channel_id = atoi(argv[2]);
+    long count = (argc == 4) ? atol(argv[3]) : 1;
 
     int fd = open(f_path, O_RDWR);
     if(fd < 0)
@@ -30,28 +37,49 @@ int main(int argc, char * argv[])
         perror("Couldn't Open file");
         exit(1);
     }
+    struct msg_slot_xfer xfer =
+    {
+        .channel_id = target_channel_id,
+        .length = MSG_SLOT_MAX_MSG_LEN,
+        .buffer = (unsigned long) buffer,
+    };
     int ret_val;
-    ret_val = ioctl(fd, MSG_SLOT_CHANNEL, target_channel_id);
-    if(ret_val != SUCCESS)
+    if (argc == 4)
     {
-        perror("Error changing channel");
-        exit(1);
+        // Selecting the channel keeps a broadcast channel's cursor for the reads that follow
+        struct msg_slot_queue_stats stats;
+        if (ioctl(fd, MSG_SLOT_CHANNEL, target_channel_id) < 0 || ioctl(fd, MSG_SLOT_QUEUE_STATS, &stats) < 0)
+        {
+            perror("Error getting the channel's queue statistics");
+            exit(1);
+        }
+        if (stats.depth == 0)
+        {
+            errno = EINVAL;
+            perror("Loop mode needs a queued or broadcast channel");
+            exit(1);
+        }
     }
-
-
-    bytes_read = read(fd, buffer, BUF_LEN);
-    if(bytes_read < 0)
+    for (long i = 0; i < count; i++)
     {
-        perror("Error reading message");
-        exit(1);
+        bytes_read = ioctl(fd, MSG_SLOT_RECV, &xfer);
+        if(bytes_read < 0)
+        {
+            perror("Error reading message");
+            exit(1);
+        }
+        if (argc == 4)
+        {
+            buffer[bytes_read++] = '\n';
+        }
+        ret_val = write(STDOUT_FILENO, buffer, bytes_read);
+        if (ret_val != bytes_read)
+        {
+            perror("Error writing  message to STDOUT");
+            exit(1);
+        }
     }
     close(fd);
-    ret_val = write(STDOUT_FILENO, buffer, bytes_read);
-    if (ret_val != bytes_read)
-    {
-        perror("Error writing  message to STDOUT");
-        exit(1);
-    }
 
    return SUCCESS;
 }
@@ -8,14 +8,16 @@
 
 /*
  * --- MESSAGE SENDER SCRIPT ---
- * Gets 3 arguments via command-line:
+ * Gets 3 (or 4) arguments via command-line:
  * (1) file-path of the dedicated message-slot device
  * (2) target channel id, assumes non-negative valid int
  * (3) message to write to the device
+ * (4) optional - number of times to send the message (loop mode), defaults to 1
+ * Each message is sent by a single MSG_SLOT_SEND ioctl, selecting the channel and writing at once.
  */
 int main(int argc, char * argv[])
 {
-    if(argc != 4)
+    if(argc != 4 && argc != 5)
     {
         perror("Invalid args count");
         exit(1);
@@ -23,24 +25,28 @@ int main(int argc, char * argv[])
     char* f_path = argv[1];
     unsigned int target_channel_id = atoi(argv[2]);
     char* msg_to_write = argv[3];
+    long count = (argc == 5) ? atol(argv[4]) : 1;
     int fd = open(f_path, O_RDWR);
     if(fd < 0)
     {
         perror("Couldn't Open file");
         exit(1);
     }
-    int ret_val;
-    ret_val = ioctl(fd, MSG_SLOT_CHANNEL, target_channel_id);
-    if(ret_val != SUCCESS)
+    struct msg_slot_xfer xfer =
     {
-        perror("Error changing channel");
-        exit(1);
-    }
-    ret_val = write(fd, msg_to_write, strlen(msg_to_write));
-    if(ret_val < 0)
+        .channel_id = target_channel_id,
+        .length = strlen(msg_to_write),
+        .buffer = (unsigned long) msg_to_write,
+    };
+    int ret_val;
+    for (long i = 0; i < count; i++)
     {
-        perror("Error writing message");
-        exit(1);
+        ret_val = ioctl(fd, MSG_SLOT_SEND, &xfer);
+        if(ret_val < 0)
+        {
+            perror("Error writing message");
+            exit(1);
+        }
     }
 
     close(fd);
@@ -3,19 +3,41 @@
 #undef MODULE
 #define MODULE
 
-#include <linux/errno.h>
-#include <linux/kernel.h>   /* We're doing kernel work */
 #include <linux/module.h>   /* Specifically, a module */
 #include <linux/fs.h>       /* for register_chrdev */
-#include <linux/uaccess.h>  /* for get_user and put_user */
-#include <linux/string.h>   /* for memset. NOTE - not string.h!*/
-#include <linux/slab.h>
-#include "message_slot.h"
+#include <linux/poll.h>     /* for poll / epoll */
+#include <linux/mm.h>       /* for mmap */
+#include <linux/workqueue.h>  /* for reclaiming idle channels */
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>   /* for the per-minor counters */
+#include <linux/debugfs.h>  /* for exporting the counters */
+#include <linux/seq_file.h>
+#include <linux/version.h>
+// io_uring commands' declarations moved to their own header in 6.7
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>  /* for io_uring commands */
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#include <linux/io_uring.h>
+#endif
+// The channel store (also built in user space, see message_slot_core.h)
+#include "message_slot_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "message_slot_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Defines 'Message Slot' device, which contains channel through-which "
                    "different processes are able to leave messages one to other");
 
+// Channels that weren't used for longer than this (and aren't selected by any fd) are freed, with their messages
+static unsigned int idle_reclaim_secs = 0;
+module_param(idle_reclaim_secs, uint, 0644);
+MODULE_PARM_DESC(idle_reclaim_secs, "Reclaim channels idle for this many seconds (0 = never)");
+
+// How often the idle-channels reclaimer checks whether it got enabled
+#define RECLAIM_DISABLED_PERIOD_SECS 5
+// Channels scanned by the reclaimer before it lets go of the index's lock for a while
+#define RECLAIM_BATCH 1024
 
 //================== STRUCTS ==========================
 struct chardev_info
@@ -23,52 +45,78 @@ struct chardev_info
     spinlock_t lock;
 };
 
-// Channel Struct
-/*
- * * Channel-Struct Explained: *
- * For each file, we shall keep a linked list of channels.
- * The head of the linked lists will always be a channel with 0-id.
- * Each channel's data will be kept by this struct.
- */
-typedef struct channel_st
-{
-    // ID of the channcel represnted in the struct
-    unsigned int id;
-    // Pointer to the message written in the channel
-    char * msg;
-    int msg_len;
-    // Pointer to next channel (channels will act as a linked list)
-    struct channel_st * next_channel;
-
-} channel_t;
-
 /*
- * * File-Data Struct Explained: *
- * For each file (i.e. a device), keeps a structure with it's valuable and unique data.
- * A simplified way of seeing it: a structure for the channels-linked-list
+ * * Open-File Struct Explained: *
+ * For each open file-descriptor, keeps its own state (pointed from 'private_data').
+ * This way many fds may use the same device concurrently, each with its own channel.
  */
-typedef struct file_data_st
+typedef struct open_file_st
 {
-    // Points the the first channel (head of linked list)
-    channel_t* head;
-    // Points to the most-recently-added channel (tail of linked list)
-    channel_t* tail;
-    // Points to the current channel being used
+    // The device (minor) this fd was opened on
+    file_data_t* f_data;
+    // Points to the current channel being used by this fd (holding a reference on it)
     channel_t* current_channel;
+    // Sequence number of the next message this fd reads from its current channel (broadcast mode)
+    u64 cursor;
 
-} file_data_t;
+} open_file_t;
 
 // Maps each file to the file_data corresponds to its. Maps by minor number.
 // Size of the array is constant, so we don't worry about space complexity
 static file_data_t* devices_arr [MINOR_NUM_BOUND];
 
-// used to prevent concurrent access into the same device
-static int dev_open_flag = 0;
-
+// 'lock' protects 'devices_arr' (i.e. initialization of a minor)
 static struct chardev_info device_info;
 
-static void free_fdata (file_data_t* f_data);
+// debugfs directory of the module ('message_slot'), holding a directory per minor
+static struct dentry* debugfs_root;
 
+// Periodically reclaims idle channels (see 'idle_reclaim_secs')
+static void reclaim_idle_channels(struct work_struct* work);
+static DECLARE_DELAYED_WORK(reclaim_work, reclaim_idle_channels);
+
+static channel_t* get_current_channel(open_file_t* o_file);
+static long minor_stats(file_data_t* f_data, struct msg_slot_minor_stats __user* user_stats);
+static void minor_debugfs_init(file_data_t* f_data);
+static long ioctl_dispatch(open_file_t* o_file, unsigned int ioctl_command_id, unsigned long ioctl_param,
+                           bool nonblock);
+static channel_t* select_channel(open_file_t* o_file, unsigned int id);
+static long do_xfer(open_file_t* o_file, struct msg_slot_xfer __user* user_xfer, bool is_write, bool nonblock);
+static long xfer_msg(open_file_t* o_file, const struct msg_slot_xfer* xfer, bool is_write, bool nonblock);
+static long do_batch(file_data_t* f_data, struct msg_slot_batch __user* user_batch, bool is_write);
+
+/*
+ * Counts (and traces) a read / write of the channel, whose result is 'ret'.
+ * Returns 'ret', so it may wrap the transfer itself.
+ */
+static inline ssize_t channel_count_xfer(channel_t* channel, bool is_write, size_t length, ssize_t ret)
+{
+    minor_pcpu_stats_t __percpu * stats = channel -> f_data -> stats;
+
+    if (ret < 0)
+    {
+        this_cpu_inc(stats -> errors);
+    }
+    else if (is_write)
+    {
+        this_cpu_inc(stats -> writes);
+        this_cpu_add(stats -> write_bytes, ret);
+    }
+    else
+    {
+        this_cpu_inc(stats -> reads);
+        this_cpu_add(stats -> read_bytes, ret);
+    }
+    if (is_write)
+    {
+        trace_msg_slot_write(channel -> f_data -> minor, channel -> id, length, ret);
+    }
+    else
+    {
+        trace_msg_slot_read(channel -> f_data -> minor, channel -> id, length, ret);
+    }
+    return ret;
+}
 
 
 //================== DEVICE FUNCTIONS (Device API Impl.) ===========================
@@ -79,45 +127,61 @@ static int device_open(struct inode * inode,
     unsigned long flags; // for spinlock
     int minor;
     file_data_t* f_data;
-    channel_t*  head;
+    file_data_t* new_f_data;
+    open_file_t* o_file;
 
-    spin_lock_irqsave(&device_info.lock, flags);
-    if (1 == dev_open_flag)
+    minor = iminor(inode);
+
+    o_file = (open_file_t *) kmalloc(sizeof(*o_file), GFP_KERNEL);
+    if (NULL == o_file)
     {
-        spin_unlock_irqrestore(&device_info.lock, flags);
-        return -EBUSY;
+        return -ENOMEM;
     }
-    ++dev_open_flag;
-    spin_unlock_irqrestore(&device_info.lock, flags);
+    memset(o_file, 0, sizeof(*o_file));
 
-    minor = iminor(inode);
-    printk(KERN_DEBUG "[OPEN] Invoking device_open(%p) Minor(%d) \n", file, minor);
+    spin_lock_irqsave(&device_info.lock, flags);
+    f_data = devices_arr[minor];
+    spin_unlock_irqrestore(&device_info.lock, flags);
 
     // Checks if it's the initialization of the driver (first time opened)
-    if(devices_arr[minor] == NULL)
+    if(f_data == NULL)
     {
-        printk(KERN_DEBUG "[OPEN -> INIT] Initialization of Minor=%d \n", minor);
-        // Creates a file-data structure, to be pointed from 'private_data' field in 'file'
-        // Also allocate "channel-zero" to be the head of the channels-linked-list
-        f_data = (file_data_t *) kmalloc(sizeof(*f_data),GFP_KERNEL);
-        if (NULL == f_data)
+        // Creates a file-data structure, shared by all the fds of this minor
+        new_f_data = alloc_fdata(minor);
+        if (NULL == new_f_data)
         {
+            kfree(o_file);
             return -ENOMEM;
         }
-        memset(f_data, 0, sizeof(*f_data));
 
-        head = (channel_t *) kmalloc(sizeof(*head),GFP_KERNEL);
-        if (NULL == head)
+        // Installs it, unless a concurrent open of the same minor has won the race
+        spin_lock_irqsave(&device_info.lock, flags);
+        if (devices_arr[minor] == NULL)
         {
-            return -ENOMEM;
+            devices_arr[minor] = new_f_data;
+            new_f_data = NULL;
+        }
+        f_data = devices_arr[minor];
+        spin_unlock_irqrestore(&device_info.lock, flags);
+
+        if (new_f_data != NULL)
+        {
+            free_fdata(new_f_data);
+        }
+        else
+        {
+            // This open has initialized the minor
+            minor_debugfs_init(f_data);
+            trace_msg_slot_open(minor, true);
         }
-        memset(head, 0, sizeof(*head));
-        f_data -> head = head;
-        f_data -> tail = head;
-        devices_arr[minor] = f_data;
     }
-    // Saves fdata pointer to private_data, so it can be accessed later
-    file -> private_data = (void*) devices_arr[minor]; //WORKS WELL?
+    else
+    {
+        trace_msg_slot_open(minor, false);
+    }
+    // Saves the fd's state to private_data, so it can be accessed later
+    o_file -> f_data = f_data;
+    file -> private_data = (void*) o_file;
     return SUCCESS;
 }
 
@@ -125,13 +189,17 @@ static int device_open(struct inode * inode,
 static int device_release(struct inode * inode,
                           struct file * file)
 {
-    unsigned long flags; // for spinlock
-    printk(KERN_DEBUG "[RELEASE] Invoking device_release(%p,%p)\n", inode, file);
+    open_file_t * o_file;
 
-    // ready for our next caller
-    spin_lock_irqsave(&device_info.lock, flags);
-    --dev_open_flag;
-    spin_unlock_irqrestore(&device_info.lock, flags);
+    // Channels (and their messages) belong to the minor, only the fd's state goes away
+    o_file = (open_file_t *) (file -> private_data);
+    trace_msg_slot_release(o_file -> f_data -> minor,
+                           o_file -> current_channel != NULL ? o_file -> current_channel -> id : 0);
+    if (o_file -> current_channel != NULL)
+    {
+        put_channel(o_file -> current_channel);
+    }
+    kfree(o_file);
 
     return SUCCESS;
 }
@@ -142,42 +210,44 @@ static int device_release(struct inode * inode,
 static ssize_t device_read(struct file * file,
                            char __user* buffer, size_t length, loff_t * offset )
 {
-    // read doesn't really do anything (for now)
-    file_data_t * f_data;
+    open_file_t * o_file = (open_file_t *) (file -> private_data);
     channel_t * curr_channel;
-    char* msg;
-    int i;
-
-    printk(KERN_DEBUG "[READ] Invocing device_read(%p,%ld)",file, length);
-    f_data = (file_data_t *) (file -> private_data);
+    ssize_t ret_val;
 
-    curr_channel = f_data -> current_channel;
+    curr_channel = get_current_channel(o_file);
     if(curr_channel == NULL)
     {
         // No channel has been set to be the current
         return -EINVAL;
     }
-    msg = curr_channel -> msg;
-    if(msg == NULL)
-    {
-        // No message exists
-        return -EWOULDBLOCK;
-    }
-    if(length < curr_channel -> msg_len)
-    {
-        // Buffer-length is smaller than the message's
-        return -ENOSPC;
-    }
+    // Blocks until a message is written, unless opened with O_NONBLOCK
+    ret_val = channel_count_xfer(curr_channel, false, length,
+                                 channel_read_msg(curr_channel, &o_file -> cursor, buffer, NULL, length,
+                                                  file -> f_flags & O_NONBLOCK));
+    put_channel(curr_channel);
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+// Same as device_read, for readv(). The whole vector is treated as one buffer
+static ssize_t device_read_iter(struct kiocb * iocb, struct iov_iter * to)
+{
+    open_file_t * o_file = (open_file_t *) (iocb -> ki_filp -> private_data);
+    channel_t * curr_channel;
+    size_t length;
+    ssize_t ret_val;
 
-    for(i = 0; i < (curr_channel -> msg_len); i++)
+    curr_channel = get_current_channel(o_file);
+    if(curr_channel == NULL)
     {
-        if(0 != put_user(msg[i], &buffer[i]))
-        {
-            return -EFAULT;
-        }
+        return -EINVAL;
     }
-
-    return curr_channel -> msg_len;
+    length = iov_iter_count(to);
+    ret_val = channel_read_msg(curr_channel, &o_file -> cursor, NULL, to, length,
+                               (iocb -> ki_filp -> f_flags & O_NONBLOCK) || (iocb -> ki_flags & IOCB_NOWAIT));
+    channel_count_xfer(curr_channel, false, length, ret_val);
+    put_channel(curr_channel);
+    return ret_val;
 }
 
 //---------------------------------------------------------------
@@ -188,96 +258,283 @@ static ssize_t device_write( struct file*       file,
                              size_t             length,
                              loff_t*            offset)
 {
-    file_data_t * f_data;
     channel_t * curr_channel;
-    char* msg;
-    int i;
+    ssize_t ret_val;
 
-    printk(KERN_DEBUG "[WRITE] Invoking device_write(%p,%ld)\n", file, length);
-    f_data = (file_data_t *) (file -> private_data);
-    curr_channel = f_data -> current_channel;
+    curr_channel = get_current_channel((open_file_t *) (file -> private_data));
     if(curr_channel == NULL)
     {
         // No channel has been set to be the current
         return -EINVAL;
     }
-    if(length == 0 || length > BUF_LEN)
+    // A full queue (of MSG_SLOT_OVERFLOW_BLOCK policy) blocks, unless opened with O_NONBLOCK
+    ret_val = channel_count_xfer(curr_channel, true, length,
+                                 channel_write_msg(curr_channel, buffer, length, file -> f_flags & O_NONBLOCK));
+    put_channel(curr_channel);
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+// Same as device_write, for writev(). The whole vector is one message
+static ssize_t device_write_iter(struct kiocb * iocb, struct iov_iter * from)
+{
+    channel_t * curr_channel;
+    char inline_buf[MSG_INLINE_LEN];
+    char* staged_msg;
+    size_t length;
+    ssize_t ret_val;
+
+    curr_channel = get_current_channel((open_file_t *) (iocb -> ki_filp -> private_data));
+    if(curr_channel == NULL)
     {
-        // Invalid message length
-        return -EMSGSIZE;
+        return -EINVAL;
+    }
+    length = iov_iter_count(from);
+    if(length == 0 || length > channel_max_msg_len(curr_channel))
+    {
+        ret_val = -EMSGSIZE;
+        goto out;
     }
 
-    if(curr_channel -> msg == NULL)
+    // Short messages are staged on the stack (see channel_publish_msg)
+    staged_msg = (length <= MSG_INLINE_LEN) ? inline_buf : (char*) kmalloc(length, GFP_KERNEL);
+    if (NULL == staged_msg)
+    {
+        ret_val = -ENOMEM;
+        goto out;
+    }
+    if (!copy_from_iter_full(staged_msg, length, from))
     {
-        // Allocates memory block for the channel's message
-        curr_channel -> msg = (char*) kmalloc(BUF_LEN, GFP_KERNEL);
-        if (NULL == curr_channel)
+        if (staged_msg != inline_buf)
         {
-            return -ENOMEM;
+            kfree(staged_msg);
         }
+        ret_val = -EFAULT;
+        goto out;
     }
-    // Overwrite message, to be the msg passed from user
-    msg = curr_channel -> msg;
-    memset(msg, 0, BUF_LEN);
-    for(i = 0; i < length; i++)
+    ret_val = channel_publish_msg(curr_channel, staged_msg, length,
+                                  (iocb -> ki_filp -> f_flags & O_NONBLOCK) || (iocb -> ki_flags & IOCB_NOWAIT));
+out:
+    channel_count_xfer(curr_channel, true, length, ret_val);
+    put_channel(curr_channel);
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+/*
+ * Makes the device usable from poll / epoll:
+ * readable once the fd's current channel holds a message (one past the fd's cursor, if broadcast),
+ * writable unless it's a full queue whose writers block.
+ * The fd waits on its current channel only, so pollers should re-arm after MSG_SLOT_CHANNEL.
+ */
+static __poll_t device_poll(struct file * file, poll_table * wait)
+{
+    open_file_t * o_file = (open_file_t *) (file -> private_data);
+    channel_t * curr_channel;
+    struct msg_slot_ring_hdr* ring;
+    u32 head;
+    u32 tail;
+    __poll_t mask;
+
+    curr_channel = get_current_channel(o_file);
+    if(curr_channel == NULL)
+    {
+        // No channel has been set to be the current
+        return EPOLLERR;
+    }
+
+    // A channel with waiters registered on its queue is never reclaimed, so it may outlive this reference
+    poll_wait(file, &curr_channel -> wq, wait);
+    ring = READ_ONCE(curr_channel -> ring);
+    if (ring != NULL)
     {
-        if(0 != get_user(msg[i], &buffer[i]))
+        // Mapped ring: the indices are read straight from the shared memory
+        head = READ_ONCE(ring -> head);
+        tail = READ_ONCE(ring -> tail);
+        mask = (head != tail) ? EPOLLIN | EPOLLRDNORM : 0;
+        if (head - tail < curr_channel -> ring_slot_count)
         {
-            return -EFAULT;
+            mask |= EPOLLOUT | EPOLLWRNORM;
         }
     }
+    else
+    {
+        mask = 0;
+        if (channel_has_msg(curr_channel, &o_file -> cursor))
+        {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+        if (channel_has_room(curr_channel))
+        {
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        }
+    }
+    put_channel(curr_channel);
+    return mask;
+}
 
-    curr_channel -> msg_len = length;
-    return length;
-}	
+//---------------------------------------------------------------
+/*
+ * Maps the fd's current channel's ring (see MSG_SLOT_SET_RING) into the caller's address space.
+ */
+static int device_mmap(struct file * file, struct vm_area_struct * vma)
+{
+    channel_t * curr_channel;
+    struct msg_slot_ring_hdr* ring;
+    int ret_val;
+
+    curr_channel = get_current_channel((open_file_t *) (file -> private_data));
+    if(curr_channel == NULL)
+    {
+        // No channel has been set to be the current
+        return -EINVAL;
+    }
+    ring = smp_load_acquire(&curr_channel -> ring);
+    if (ring == NULL || vma -> vm_pgoff != 0)
+    {
+        // Not a ring channel, or an offset inside the ring was requested
+        ret_val = -EINVAL;
+    }
+    else
+    {
+        // Fails if the requested size exceeds the ring, and keeps the mapping from being expanded.
+        // Ring channels are never reclaimed, so the ring outlives the mapping
+        ret_val = remap_vmalloc_range(vma, ring, 0);
+    }
+    put_channel(curr_channel);
+    return ret_val;
+}
 
 //----------------------------------------------------------------
 static long device_ioctl(struct file * file,
                          unsigned int ioctl_command_id,
                          unsigned long ioctl_param)
 {
-    file_data_t * f_data;
+    open_file_t * o_file;
+    long ret_val;
+
+    o_file = (open_file_t *) (file -> private_data);
+    ret_val = ioctl_dispatch(o_file, ioctl_command_id, ioctl_param, file -> f_flags & O_NONBLOCK);
+
+    this_cpu_inc(o_file -> f_data -> stats -> ioctls);
+    if (ret_val < 0)
+    {
+        this_cpu_inc(o_file -> f_data -> stats -> errors);
+    }
+    trace_msg_slot_ioctl(o_file -> f_data -> minor, ioctl_command_id, ioctl_param, ret_val);
+    return ret_val;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+//----------------------------------------------------------------
+/*
+ * io_uring commands (IORING_OP_URING_CMD): 'cmd_op' is MSG_SLOT_SEND / MSG_SLOT_RECV, and the SQE's command
+ * area holds a struct msg_slot_xfer (which fits a regular 64 bytes SQE). Completes inline.
+ * On the submission path it mustn't block: -EAGAIN has io_uring retry it from a worker thread,
+ * where it may block (unless the fd is O_NONBLOCK).
+ */
+static int device_uring_cmd(struct io_uring_cmd * ioucmd, unsigned int issue_flags)
+{
+    const struct msg_slot_xfer* sqe_xfer;
+    struct msg_slot_xfer xfer;
+    struct file* file = ioucmd -> file;
+
+    if (MSG_SLOT_SEND != ioucmd -> cmd_op && MSG_SLOT_RECV != ioucmd -> cmd_op)
+    {
+        return -EINVAL;
+    }
+    // Since 6.6 the command holds its SQE, instead of a pointer to the SQE's command area
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+    sqe_xfer = (const struct msg_slot_xfer*) io_uring_sqe_cmd(ioucmd -> sqe);
+#else
+    sqe_xfer = (const struct msg_slot_xfer*) ioucmd -> cmd;
+#endif
+    // The SQE may live in memory shared with user space, so each field is read exactly once
+    xfer.channel_id = READ_ONCE(sqe_xfer -> channel_id);
+    xfer.length = READ_ONCE(sqe_xfer -> length);
+    xfer.buffer = READ_ONCE(sqe_xfer -> buffer);
+    return xfer_msg((open_file_t *) (file -> private_data), &xfer, MSG_SLOT_SEND == ioucmd -> cmd_op,
+                    (issue_flags & IO_URING_F_NONBLOCK) || (file -> f_flags & O_NONBLOCK));
+}
+#endif
+
+//================== HELPER FUNCTIONS ===========================
+// Performs the IOCTL command, see device_ioctl
+static long ioctl_dispatch(open_file_t* o_file, unsigned int ioctl_command_id, unsigned long ioctl_param,
+                           bool nonblock)
+{
     channel_t* current_channel;
+    long ret_val;
+
     if (MSG_SLOT_CHANNEL == ioctl_command_id)
     {
-        if (ioctl_param  <= 0)
+        if (ioctl_param  <= 0 || ioctl_param > UINT_MAX)
         {
             // Invalid channel-id passed
             return -EINVAL;
         }
-        printk(KERN_DEBUG "[IOCTL CMD] Setting CHANNEL ID to %ld\n", ioctl_param);
 
         // Sets the current-channel-id of the file to be the one requested
-
-        f_data = (file_data_t *) (file -> private_data);
-        current_channel = f_data -> head;
-        while(current_channel != NULL)
+        current_channel = select_channel(o_file, ioctl_param);
+        if (IS_ERR(current_channel))
         {
-            if (current_channel -> id == ioctl_param)
-            {
-                // The channel with the requested id already exists
-                break;
-            }
-            current_channel = current_channel -> next_channel;
+            return PTR_ERR(current_channel);
         }
-
+        put_channel(current_channel);
+    }
+    else if (MSG_SLOT_SEND == ioctl_command_id || MSG_SLOT_RECV == ioctl_command_id)
+    {
+        return do_xfer(o_file, (struct msg_slot_xfer __user*) ioctl_param, MSG_SLOT_SEND == ioctl_command_id,
+                       nonblock);
+    }
+    else if (MSG_SLOT_SET_QUEUE == ioctl_command_id || MSG_SLOT_QUEUE_STATS == ioctl_command_id ||
+             MSG_SLOT_SET_RING == ioctl_command_id || MSG_SLOT_RING_WAKE == ioctl_command_id ||
+             MSG_SLOT_SET_BROADCAST == ioctl_command_id || MSG_SLOT_WAIT_SEQ == ioctl_command_id)
+    {
+        current_channel = get_current_channel(o_file);
         if(current_channel == NULL)
         {
-            // requested channel-id is NOT an existing channel, hence it will now be created
-            current_channel = (channel_t *) kmalloc(sizeof(*current_channel),GFP_KERNEL);
-            if (NULL == current_channel)
-	        {
-	            return -ENOMEM;
-	        }
-            memset(current_channel, 0, sizeof(*current_channel));
-            // sets the allocated channel-id as requested
-            current_channel -> id = ioctl_param;
-            // updates linked list structure
-            f_data -> tail -> next_channel = current_channel;
-            f_data -> tail = current_channel;
+            // No channel has been set to be the current
+            return -EINVAL;
         }
-        // Sets the currently used channel to be as requested
-        f_data -> current_channel = current_channel;
+        if (MSG_SLOT_SET_QUEUE == ioctl_command_id)
+        {
+            ret_val = channel_set_queue(current_channel, (struct msg_slot_queue_cfg __user*) ioctl_param);
+        }
+        else if (MSG_SLOT_SET_RING == ioctl_command_id)
+        {
+            ret_val = channel_set_ring(current_channel, (struct msg_slot_ring_cfg __user*) ioctl_param);
+        }
+        else if (MSG_SLOT_SET_BROADCAST == ioctl_command_id)
+        {
+            ret_val = channel_set_broadcast(current_channel, (struct msg_slot_broadcast_cfg __user*) ioctl_param);
+        }
+        else if (MSG_SLOT_WAIT_SEQ == ioctl_command_id)
+        {
+            ret_val = channel_wait_seq(current_channel, &o_file -> cursor, (struct msg_slot_seq_wait __user*) ioctl_param,
+                                       nonblock);
+        }
+        else if (MSG_SLOT_RING_WAKE == ioctl_command_id)
+        {
+            // Called by a ring's producer / consumer that has just moved its index
+            wake_up_interruptible_poll(&current_channel -> wq, EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM);
+            ret_val = SUCCESS;
+        }
+        else
+        {
+            ret_val = channel_queue_stats(current_channel, (struct msg_slot_queue_stats __user*) ioctl_param);
+        }
+        put_channel(current_channel);
+        return ret_val;
+    }
+    else if (MSG_SLOT_WRITE_BATCH == ioctl_command_id || MSG_SLOT_READ_BATCH == ioctl_command_id)
+    {
+        return do_batch(o_file -> f_data, (struct msg_slot_batch __user*) ioctl_param,
+                        MSG_SLOT_WRITE_BATCH == ioctl_command_id);
+    }
+    else if (MSG_SLOT_MINOR_STATS == ioctl_command_id)
+    {
+        return minor_stats(o_file -> f_data, (struct msg_slot_minor_stats __user*) ioctl_param);
     }
     else
     {
@@ -288,27 +545,331 @@ static long device_ioctl(struct file * file,
     return SUCCESS;
 }
 
-//================== HELPER FUNCTIONS ===========================
-void free_fdata(file_data_t* f_data)
+//---------------------------------------------------------------
+/*
+ * Sets the fd's current channel to be channel 'id' (creating it if needed).
+ * Returns it holding a reference (besides the fd's own), or ERR_PTR on failure.
+ */
+static channel_t* select_channel(open_file_t* o_file, unsigned int id)
+{
+    channel_t* channel;
+    channel_t* prev_channel;
+
+    // Fast path: already the current one, as when sending / receiving repeatedly on the same channel
+    channel = get_current_channel(o_file);
+    if (channel != NULL)
+    {
+        if (channel -> id == id)
+        {
+            return channel;
+        }
+        put_channel(channel);
+    }
+
+    channel = get_or_create_channel(o_file -> f_data, id);
+    if (IS_ERR(channel))
+    {
+        return channel;
+    }
+    channel_touch(channel);
+    // A broadcast subscriber starts at the channel's latest message (cursors belong to the current channel)
+    WRITE_ONCE(o_file -> cursor, channel_start_cursor(channel));
+    // The fd's reference moves from the previous channel to the new one, the caller gets its own
+    refcount_inc(&channel -> refs);
+    prev_channel = xchg(&o_file -> current_channel, channel);
+    if (prev_channel != NULL)
+    {
+        put_channel(prev_channel);
+    }
+    return channel;
+}
+
+//---------------------------------------------------------------
+// Returns the fd's current channel (holding a reference on it), or NULL if none was set
+static channel_t* get_current_channel(open_file_t* o_file)
+{
+    channel_t* channel;
+
+    rcu_read_lock();
+    // The fd's own reference keeps its current channel alive. If that fails, the fd has just moved
+    // to another channel (whose reference it already holds)
+    do
+    {
+        channel = READ_ONCE(o_file -> current_channel);
+    } while (channel != NULL && !refcount_inc_not_zero(&channel -> refs));
+    rcu_read_unlock();
+    return channel;
+}
+
+//---------------------------------------------------------------
+/*
+ * MSG_SLOT_SEND / MSG_SLOT_RECV: selects the channel, then writes / reads a message just like
+ * device_write / device_read do.
+ */
+static long do_xfer(open_file_t* o_file, struct msg_slot_xfer __user* user_xfer, bool is_write, bool nonblock)
+{
+    struct msg_slot_xfer xfer;
+
+    if (0 != copy_from_user(&xfer, user_xfer, sizeof(xfer)))
+    {
+        return -EFAULT;
+    }
+    return xfer_msg(o_file, &xfer, is_write, nonblock);
+}
+
+//---------------------------------------------------------------
+// Performs the (kernel's copy of) select-and-transfer request, for the ioctl and io_uring paths
+static long xfer_msg(open_file_t* o_file, const struct msg_slot_xfer* xfer, bool is_write, bool nonblock)
+{
+    channel_t* channel;
+    ssize_t ret_val;
+
+    if (xfer -> channel_id == 0)
+    {
+        // Invalid channel-id passed
+        return -EINVAL;
+    }
+    channel = select_channel(o_file, xfer -> channel_id);
+    if (IS_ERR(channel))
+    {
+        return PTR_ERR(channel);
+    }
+    if (is_write)
+    {
+        ret_val = channel_write_msg(channel, u64_to_user_ptr(xfer -> buffer), xfer -> length, nonblock);
+    }
+    else
+    {
+        ret_val = channel_read_msg(channel, &o_file -> cursor, u64_to_user_ptr(xfer -> buffer), NULL,
+                                   xfer -> length, nonblock);
+    }
+    channel_count_xfer(channel, is_write, xfer -> length, ret_val);
+    put_channel(channel);
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+/*
+ * MSG_SLOT_WRITE_BATCH / MSG_SLOT_READ_BATCH: performs a non-blocking write / read for each entry,
+ * and reports each entry's result in its 'status'. Returns the number of successful entries.
+ */
+static long do_batch(file_data_t* f_data, struct msg_slot_batch __user* user_batch, bool is_write)
+{
+    struct msg_slot_batch batch;
+    struct msg_slot_batch_entry* entries;
+    struct msg_slot_batch_entry* entry;
+    channel_t* channel;
+    long succeeded = 0;
+    unsigned int i;
+
+    if (0 != copy_from_user(&batch, user_batch, sizeof(batch)))
+    {
+        return -EFAULT;
+    }
+    if (batch.count == 0 || batch.count > MSG_SLOT_MAX_BATCH)
+    {
+        return -EINVAL;
+    }
+    entries = (struct msg_slot_batch_entry*) kmalloc_array(batch.count, sizeof(*entries), GFP_KERNEL);
+    if (NULL == entries)
+    {
+        return -ENOMEM;
+    }
+    if (0 != copy_from_user(entries, u64_to_user_ptr(batch.entries), batch.count * sizeof(*entries)))
+    {
+        kfree(entries);
+        return -EFAULT;
+    }
+
+    for (i = 0; i < batch.count; i++)
+    {
+        entry = &entries[i];
+        if (entry -> channel_id == 0)
+        {
+            // Invalid channel-id passed
+            entry -> status = -EINVAL;
+            continue;
+        }
+        if (is_write)
+        {
+            channel = get_or_create_channel(f_data, entry -> channel_id);
+            if (IS_ERR(channel))
+            {
+                entry -> status = PTR_ERR(channel);
+                continue;
+            }
+            entry -> status = channel_count_xfer(channel, true, entry -> length,
+                                                 channel_write_msg(channel, u64_to_user_ptr(entry -> buffer),
+                                                                   entry -> length, true));
+        }
+        else
+        {
+            // Reading never creates channels, a missing one simply has no message yet
+            channel = lookup_channel(f_data, entry -> channel_id);
+            if (channel == NULL)
+            {
+                entry -> status = -EAGAIN;
+                continue;
+            }
+            entry -> status = channel_count_xfer(channel, false, entry -> length,
+                                                 channel_read_msg(channel, NULL, u64_to_user_ptr(entry -> buffer), NULL,
+                                                                  entry -> length, true));
+        }
+        put_channel(channel);
+        if (entry -> status >= 0)
+        {
+            succeeded++;
+        }
+    }
+
+    if (0 != copy_to_user(u64_to_user_ptr(batch.entries), entries, batch.count * sizeof(*entries)))
+    {
+        succeeded = -EFAULT;
+    }
+    kfree(entries);
+    return succeeded;
+}
+
+//---------------------------------------------------------------
+/*
+ * Frees the minor's channels that are referenced by the index alone (no fd selected them and no operation is
+ * in progress), have nobody waiting on them, aren't mapped rings, and weren't used for 'idle_secs'.
+ */
+static void reclaim_fdata(file_data_t* f_data, unsigned long idle_jiffies)
 {
-    channel_t* curr_channel;
-    channel_t* channel_to_free;
-    curr_channel = f_data -> head;
-    while(curr_channel != NULL)
+    channel_t* channel;
+    unsigned long id;
+    unsigned int scanned = 0;
+
+    xa_lock(&f_data -> channels);
+    xa_for_each(&f_data -> channels, id, channel)
     {
-        channel_to_free = curr_channel;
-        // gets next channel
-        curr_channel = curr_channel -> next_channel;
+        if (++scanned % RECLAIM_BATCH == 0)
+        {
+            // Lets creators in. xa_for_each() resumes by index, so it's fine to drop the lock
+            xa_unlock(&f_data -> channels);
+            cond_resched();
+            xa_lock(&f_data -> channels);
+        }
+        if (time_before(jiffies, READ_ONCE(channel -> last_used) + idle_jiffies) ||
+            !channel_try_detach(f_data, channel))
+        {
+            continue;
+        }
+        atomic_long_inc(&f_data -> reclaimed_count);
+        trace_msg_slot_reclaim(f_data -> minor, channel -> id, channel -> mem_bytes);
+        // Lock-free lookups may still be looking at it
+        call_rcu(&channel -> rcu, free_channel_rcu);
+    }
+    xa_unlock(&f_data -> channels);
+}
 
-        // frees current channel
-        if (channel_to_free -> msg != NULL)
+//---------------------------------------------------------------
+static void reclaim_idle_channels(struct work_struct* work)
+{
+    unsigned int idle_secs = READ_ONCE(idle_reclaim_secs);
+    file_data_t* f_data;
+    int i;
+
+    if (idle_secs == 0)
+    {
+        // Disabled, checks again later (the parameter is writable at runtime)
+        schedule_delayed_work(&reclaim_work, RECLAIM_DISABLED_PERIOD_SECS * HZ);
+        return;
+    }
+    for (i = 0; i < MINOR_NUM_BOUND; i++)
+    {
+        // Minors are only freed on module exit, after this work is cancelled
+        f_data = READ_ONCE(devices_arr[i]);
+        if (f_data != NULL)
         {
-            kfree(channel_to_free -> msg);
+            reclaim_fdata(f_data, (unsigned long) idle_secs * HZ);
         }
-        kfree(channel_to_free);
     }
-    // Frees fdata
-    kfree(f_data);
+    // Scans twice per idle period, so a channel is reclaimed at most 1.5 periods after its last use
+    schedule_delayed_work(&reclaim_work, max(idle_secs / 2, 1u) * HZ);
+}
+
+//---------------------------------------------------------------
+// MSG_SLOT_MINOR_STATS: reports the minor's channels and memory usage
+static long minor_stats(file_data_t* f_data, struct msg_slot_minor_stats __user* user_stats)
+{
+    struct msg_slot_minor_stats stats;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.channels = atomic_long_read(&f_data -> channels_count);
+    stats.mem_bytes = atomic_long_read(&f_data -> mem_bytes);
+    stats.reclaimed = atomic_long_read(&f_data -> reclaimed_count);
+    if (0 != copy_to_user(user_stats, &stats, sizeof(stats)))
+    {
+        return -EFAULT;
+    }
+    return SUCCESS;
+}
+
+//---------------------------------------------------------------
+// debugfs: message_slot/<minor>/stats
+static int minor_stats_show(struct seq_file* m, void* unused)
+{
+    file_data_t* f_data = (file_data_t*) m -> private;
+    minor_pcpu_stats_t total;
+    minor_pcpu_stats_t* cpu_stats;
+    int cpu;
+
+    memset(&total, 0, sizeof(total));
+    for_each_possible_cpu(cpu)
+    {
+        cpu_stats = per_cpu_ptr(f_data -> stats, cpu);
+        total.reads += READ_ONCE(cpu_stats -> reads);
+        total.writes += READ_ONCE(cpu_stats -> writes);
+        total.read_bytes += READ_ONCE(cpu_stats -> read_bytes);
+        total.write_bytes += READ_ONCE(cpu_stats -> write_bytes);
+        total.ioctls += READ_ONCE(cpu_stats -> ioctls);
+        total.errors += READ_ONCE(cpu_stats -> errors);
+    }
+    seq_printf(m, "reads: %llu\nwrites: %llu\nread_bytes: %llu\nwrite_bytes: %llu\nioctls: %llu\nerrors: %llu\n",
+               total.reads, total.writes, total.read_bytes, total.write_bytes, total.ioctls, total.errors);
+    seq_printf(m, "channels: %ld\nmem_bytes: %ld\nreclaimed: %ld\n",
+               atomic_long_read(&f_data -> channels_count), atomic_long_read(&f_data -> mem_bytes),
+               atomic_long_read(&f_data -> reclaimed_count));
+    return SUCCESS;
+}
+DEFINE_SHOW_ATTRIBUTE(minor_stats);
+
+//---------------------------------------------------------------
+// debugfs: message_slot/<minor>/channels, a line per channel
+static int minor_channels_show(struct seq_file* m, void* unused)
+{
+    file_data_t* f_data = (file_data_t*) m -> private;
+    channel_t* channel;
+    unsigned long id;
+
+    seq_printf(m, "%-10s %12s %12s %14s %14s %10s\n", "channel", "reads", "writes", "read_bytes", "write_bytes", "mem_bytes");
+    // Reclaimed channels are freed after an RCU grace period, so they stay readable while walking
+    rcu_read_lock();
+    xa_for_each(&f_data -> channels, id, channel)
+    {
+        seq_printf(m, "%-10u %12llu %12llu %14llu %14llu %10lu\n", channel -> id,
+                   READ_ONCE(channel -> reads), READ_ONCE(channel -> writes),
+                   READ_ONCE(channel -> read_bytes), READ_ONCE(channel -> write_bytes),
+                   READ_ONCE(channel -> mem_bytes));
+    }
+    rcu_read_unlock();
+    return SUCCESS;
+}
+DEFINE_SHOW_ATTRIBUTE(minor_channels);
+
+//---------------------------------------------------------------
+// Creates the minor's debugfs directory. Failures are ignored, as debugfs is only for inspection
+static void minor_debugfs_init(file_data_t* f_data)
+{
+    struct dentry* dir;
+    char name[16];
+
+    snprintf(name, sizeof(name), "%d", f_data -> minor);
+    dir = debugfs_create_dir(name, debugfs_root);
+    debugfs_create_file("stats", 0444, dir, f_data, &minor_stats_fops);
+    debugfs_create_file("channels", 0444, dir, f_data, &minor_channels_fops);
 }
 
 //==================== DEVICE MODULE SETUP =============================
@@ -320,8 +881,15 @@ struct file_operations Fops =
                 .owner          = THIS_MODULE,
                 .read           = device_read,
                 .write          = device_write,
+                .read_iter      = device_read_iter,
+                .write_iter     = device_write_iter,
+                .poll           = device_poll,
+                .mmap           = device_mmap,
                 .open           = device_open,
                 .unlocked_ioctl = device_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+                .uring_cmd      = device_uring_cmd,
+#endif
                 .release        = device_release,
         };
 
@@ -336,14 +904,27 @@ static int __init mod_init(void)
     memset(&device_info, 0, sizeof(struct chardev_info));
     spin_lock_init(&device_info.lock);
 
+    // Cache-line aligned, so a channel's header and inline message never straddle lines
+    channel_cache = kmem_cache_create("message_slot_channel", sizeof(channel_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (NULL == channel_cache)
+    {
+        return -ENOMEM;
+    }
+
+    // Before the device can be opened: opening a minor creates its directory under it
+    debugfs_root = debugfs_create_dir(DEVICE_RANGE_NAME, NULL);
+
     // Register driver capabilities
     rc = register_chrdev(MAJOR_NUM, DEVICE_RANGE_NAME, &Fops);
 
     if (rc < 0)
     {
         printk(KERN_ALERT "registraion failed for  %d\n", MAJOR_NUM);
+        debugfs_remove_recursive(debugfs_root);
+        kmem_cache_destroy(channel_cache);
         return rc;
     }
+    schedule_delayed_work(&reclaim_work, RECLAIM_DISABLED_PERIOD_SECS * HZ);
 
     printk(KERN_DEBUG "[MODULE INIT] Registeration is successful! ");
     printk(KERN_DEBUG "[MODULE INIT] USAGE : $ sudo mknod /dev/{CHOSEN_DEV_NAME} c %d 0\n", MAJOR_NUM);
@@ -359,6 +940,9 @@ static void __exit mod_cleanup(void)
 {
     int i;
     unregister_chrdev(MAJOR_NUM, DEVICE_RANGE_NAME);
+    // Waits for readers of the minors' files, before the minors are freed
+    debugfs_remove_recursive(debugfs_root);
+    cancel_delayed_work_sync(&reclaim_work);
     for (i=0; i < MINOR_NUM_BOUND; i++)
     {
         if(NULL != devices_arr[i])
@@ -366,6 +950,9 @@ static void __exit mod_cleanup(void)
             free_fdata(devices_arr[i]);
         }
     }
+    // Waits for channels reclaimed earlier to be freed, before their cache goes away
+    rcu_barrier();
+    kmem_cache_destroy(channel_cache);
     printk(KERN_DEBUG "[CLEANUP] Memory Freed, Devices unregistered");
 }
 
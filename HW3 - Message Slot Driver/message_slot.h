@@ -2,6 +2,7 @@
 #define CHARDEV_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 // Major num of our driver
 #define MAJOR_NUM 240
@@ -12,9 +13,215 @@
 // IOCTL command for setting channel
 #define MSG_SLOT_CHANNEL _IOW(MAJOR_NUM, 0, unsigned int)
 
-// Max bytes per message. Also the buffer used when writing a message.
+// Max bytes per message
 #define BUF_LEN 128
 
+/*
+ * * Queued Channels: *
+ * By default a channel holds a single message, overwritten by every write.
+ * MSG_SLOT_SET_QUEUE turns the (empty) current channel into a FIFO of up to 'depth' messages,
+ * each of up to 'max_msg_len' bytes. Reads then consume the oldest message.
+ * Setting 'depth' to 0 turns an empty queued channel back into a single-message channel.
+ */
+// IOCTL command for configuring the current channel's queue (struct msg_slot_queue_cfg)
+#define MSG_SLOT_SET_QUEUE _IOW(MAJOR_NUM, 1, struct msg_slot_queue_cfg)
+// IOCTL command for getting the current channel's queue statistics (struct msg_slot_queue_stats)
+#define MSG_SLOT_QUEUE_STATS _IOR(MAJOR_NUM, 2, struct msg_slot_queue_stats)
+
+// Bounds of a queued channel's configuration
+#define MSG_SLOT_MAX_QUEUE_DEPTH 4096
+#define MSG_SLOT_MAX_MSG_LEN (64 * 1024)
+
+// Overflow policies, i.e. what a write into a full queue does:
+// Writer sleeps until a reader consumes a message (fails with EAGAIN under O_NONBLOCK)
+#define MSG_SLOT_OVERFLOW_BLOCK 0
+// Oldest queued message is discarded to make room
+#define MSG_SLOT_OVERFLOW_DROP_OLDEST 1
+// Write fails with ENOBUFS
+#define MSG_SLOT_OVERFLOW_FAIL 2
+
+struct msg_slot_queue_cfg
+{
+    __u32 depth;
+    __u32 max_msg_len;
+    __u32 overflow_policy;
+};
+
+struct msg_slot_queue_stats
+{
+    // Configuration (depth is 0 for a single-message channel)
+    __u32 depth;
+    __u32 max_msg_len;
+    __u32 overflow_policy;
+    // Messages currently queued
+    __u32 count;
+    // Max 'count' ever reached since the queue was configured
+    __u32 high_water;
+    __u32 reserved;
+    // Messages discarded by MSG_SLOT_OVERFLOW_DROP_OLDEST
+    __u64 dropped;
+};
+
+/*
+ * * Mapped Rings: *
+ * MSG_SLOT_SET_RING turns the (empty) current channel into a single-producer / single-consumer ring
+ * in memory shared by the kernel and both processes, which mmap() it from their fds (offset 0,
+ * MSG_SLOT_RING_MAP_SIZE bytes). Messages are then exchanged through the mapping only, without
+ * syscalls or copies by the kernel; read() / write() on such a channel fail with EINVAL.
+ * The mapping starts with struct msg_slot_ring_hdr. Slot i starts at MSG_SLOT_RING_DATA_OFFSET + i * slot_size,
+ * and holds a __u32 message length followed by the message.
+ * - Producer: fills slot (head % slot_count) while head - tail < slot_count, then stores head + 1 (release).
+ * - Consumer: reads slot (tail % slot_count) while tail != head, then stores tail + 1 (release).
+ * Sleeping is done by poll(): the fd is readable while the ring isn't empty and writable while it isn't full.
+ * A side about to sleep sets its '*_waiting' flag and re-checks the ring. The other side, after moving its
+ * index, issues MSG_SLOT_RING_WAKE if that flag is set. message_slot_ring.h implements this protocol.
+ * A ring stays in place until the module is unloaded (mappings may outlive any fd).
+ */
+// IOCTL command for turning the current channel into a mapped ring (struct msg_slot_ring_cfg)
+#define MSG_SLOT_SET_RING _IOW(MAJOR_NUM, 3, struct msg_slot_ring_cfg)
+// IOCTL command for waking the pollers of the current (ring) channel
+#define MSG_SLOT_RING_WAKE _IO(MAJOR_NUM, 4)
+
+// Bound of a ring's total size
+#define MSG_SLOT_MAX_RING_SIZE (64 * 1024 * 1024)
+// Where the slots start within the mapping
+#define MSG_SLOT_RING_DATA_OFFSET 256
+// Bytes to mmap() for a ring of the given configuration
+#define MSG_SLOT_RING_MAP_SIZE(cfg) (MSG_SLOT_RING_DATA_OFFSET + (unsigned long) (cfg).slot_size * (cfg).slot_count)
+
+struct msg_slot_ring_cfg
+{
+    // Bytes per slot (including the length prefix), a multiple of 8
+    __u32 slot_size;
+    // Slots in the ring, a power of 2
+    __u32 slot_count;
+};
+
+// Each side's fields are kept on their own cache line, so the two sides don't false-share
+struct msg_slot_ring_hdr
+{
+    // Written by the producer
+    __u32 head;
+    __u32 producer_waiting;
+    __u8 producer_pad[56];
+    // Written by the consumer
+    __u32 tail;
+    __u32 consumer_waiting;
+    __u8 consumer_pad[56];
+    // Written by the kernel on MSG_SLOT_SET_RING, read-only afterwards
+    __u32 slot_size;
+    __u32 slot_count;
+};
+
+/*
+ * * Batches: *
+ * MSG_SLOT_WRITE_BATCH / MSG_SLOT_READ_BATCH perform a write / read for each of up to MSG_SLOT_MAX_BATCH
+ * entries, each addressing its own channel (the fd's current channel is left as is).
+ * Every entry gets its own 'status': bytes written / read, or a negative errno (same errors as write / read).
+ * Batched operations never block: an empty channel / full blocking queue yields -EAGAIN for that entry.
+ * Reading a channel that doesn't exist yields -EAGAIN as well (it isn't created).
+ * The ioctl returns the number of successful entries.
+ */
+#define MSG_SLOT_WRITE_BATCH _IOW(MAJOR_NUM, 5, struct msg_slot_batch)
+#define MSG_SLOT_READ_BATCH _IOW(MAJOR_NUM, 6, struct msg_slot_batch)
+
+#define MSG_SLOT_MAX_BATCH 1024
+
+struct msg_slot_batch_entry
+{
+    __u32 channel_id;
+    // Message length (write) / buffer length (read)
+    __u32 length;
+    // User address of the message (write) / of the buffer receiving it (read)
+    __u64 buffer;
+    // Set by the driver
+    __s32 status;
+    __u32 reserved;
+};
+
+struct msg_slot_batch
+{
+    // User address of an array of 'count' entries
+    __u64 entries;
+    __u32 count;
+    __u32 reserved;
+};
+
+// IOCTL command for getting the device's (minor's) usage (struct msg_slot_minor_stats)
+#define MSG_SLOT_MINOR_STATS _IOR(MAJOR_NUM, 7, struct msg_slot_minor_stats)
+
+struct msg_slot_minor_stats
+{
+    // Channels currently existing
+    __u64 channels;
+    // Memory held by the channels and their messages
+    __u64 mem_bytes;
+    // Channels freed for being idle (see the module's 'idle_reclaim_secs' parameter)
+    __u64 reclaimed;
+};
+
+/*
+ * * Select-and-transfer: *
+ * MSG_SLOT_SEND / MSG_SLOT_RECV set the fd's current channel (as MSG_SLOT_CHANNEL does) and write / read
+ * a message, in a single call. Otherwise they behave as write / read (blocking, errors), returning
+ * the number of bytes written / read. Staying on the same channel is cheapest.
+ * Both are also io_uring commands (IORING_OP_URING_CMD, kernel 5.19+): 'cmd_op' is MSG_SLOT_SEND / MSG_SLOT_RECV,
+ * and the struct msg_slot_xfer is copied into the SQE's command area. The CQE's 'res' is the ioctl's result.
+ */
+#define MSG_SLOT_SEND _IOW(MAJOR_NUM, 8, struct msg_slot_xfer)
+#define MSG_SLOT_RECV _IOW(MAJOR_NUM, 9, struct msg_slot_xfer)
+
+struct msg_slot_xfer
+{
+    __u32 channel_id;
+    // Message length (send) / buffer length (receive)
+    __u32 length;
+    // User address of the message (send) / of the buffer receiving it (receive)
+    __u64 buffer;
+};
+
+/*
+ * * Broadcast Channels: *
+ * MSG_SLOT_SET_BROADCAST turns the (empty, single-message) current channel into a publish / subscribe channel,
+ * retaining its last 'depth' messages of up to 'max_msg_len' bytes each. Every message written gets the next
+ * sequence number (starting at 1), and every fd keeps its own read cursor on its current channel, so each
+ * subscriber reads each message once, and a message is read by any number of subscribers without being copied
+ * by its writer. Writes never block: the oldest message is dropped to make room.
+ * - Selecting the channel (MSG_SLOT_CHANNEL / SEND / RECV) sets the fd's cursor to the latest message (or the
+ *   first one to come, when there's none yet); staying on the channel keeps it.
+ * - A read returns the message at the cursor, and moves the cursor past it. It blocks (or fails with EAGAIN)
+ *   while the fd has read everything. A subscriber that lagged more than 'depth' messages behind skips to
+ *   the oldest retained message (which MSG_SLOT_WAIT_SEQ's 'cursor' / 'oldest' tell).
+ * - The fd is readable (poll) while there's a message past its cursor. Batched reads get the latest message.
+ * - MSG_SLOT_WAIT_SEQ sleeps until the latest message's sequence number exceeds 'seq' (EAGAIN under O_NONBLOCK,
+ *   right away when it already does), then reports the channel's sequence numbers and the fd's cursor.
+ * Setting the same configuration again is a no-op, so every subscriber may issue it. A broadcast channel stays
+ * one until it's freed. An fd's cursor is shared by its threads, which should not read it concurrently.
+ */
+// IOCTL command for turning the current channel into a broadcast channel (struct msg_slot_broadcast_cfg)
+#define MSG_SLOT_SET_BROADCAST _IOW(MAJOR_NUM, 10, struct msg_slot_broadcast_cfg)
+// IOCTL command for waiting on the current (broadcast) channel's sequence number (struct msg_slot_seq_wait)
+#define MSG_SLOT_WAIT_SEQ _IOWR(MAJOR_NUM, 11, struct msg_slot_seq_wait)
+
+struct msg_slot_broadcast_cfg
+{
+    // Messages retained, up to MSG_SLOT_MAX_QUEUE_DEPTH
+    __u32 depth;
+    // Up to MSG_SLOT_MAX_MSG_LEN
+    __u32 max_msg_len;
+};
+
+struct msg_slot_seq_wait
+{
+    // Set by the caller: waits until 'latest' > 'seq'
+    __u64 seq;
+    // Set by the driver: sequence numbers of the latest / oldest retained messages (0 when there's none)
+    __u64 latest;
+    __u64 oldest;
+    // Set by the driver: sequence number of the fd's next message
+    __u64 cursor;
+};
+
 // Success integer
 #define SUCCESS 0
 
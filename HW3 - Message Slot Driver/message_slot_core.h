@@ -0,0 +1,1013 @@
+#ifndef MESSAGE_SLOT_CORE_H
+#define MESSAGE_SLOT_CORE_H
+
+/*
+ * --- MESSAGE SLOT CORE ---
+ * The channel store of the message-slot device: channels index, messages, queues and rings.
+ * Kernel facilities are used through message_slot_shim.h, so the same code is built into the
+ * module (message_slot.c) and into user space tools (message_core_bench.c, message_core_fuzz.c),
+ * where the shim maps them onto libc / pthreads.
+ * Device specifics (fds, file operations, tracing, debugfs) stay in message_slot.c.
+ */
+
+#include "message_slot_shim.h"
+#include "message_slot.h"
+
+// Messages of up to this many bytes are stored inside the channel struct itself
+#define MSG_INLINE_LEN 40
+
+//================== STRUCTS ==========================
+// A single queued message
+typedef struct queued_msg_st
+{
+    char * msg;
+    unsigned int msg_len;
+
+} queued_msg_t;
+
+/*
+ * * Message-Queue Struct Explained: *
+ * Ring of messages of a queued channel (see MSG_SLOT_SET_QUEUE).
+ * Messages are kept in slots[head], slots[head+1], ... (mod depth), 'count' of them.
+ * A channel is queued IFF depth > 0.
+ */
+typedef struct msg_queue_st
+{
+    queued_msg_t * slots;
+    unsigned int depth;
+    unsigned int max_msg_len;
+    unsigned int overflow_policy;
+    unsigned int head;
+    unsigned int count;
+    unsigned int high_water;
+    u64 dropped;
+
+} msg_queue_t;
+
+/*
+ * * Broadcast Struct Explained: *
+ * Last messages of a broadcast channel (see MSG_SLOT_SET_BROADCAST), by sequence number.
+ * Message 'seq' is kept in slots[seq % depth], for seq in [max(1, next_seq - depth), next_seq).
+ * A channel is a broadcast one IFF depth > 0 (and then next_seq >= 1).
+ */
+typedef struct msg_bcast_st
+{
+    queued_msg_t * slots;
+    unsigned int depth;
+    unsigned int max_msg_len;
+    // Sequence number the next message written will get
+    u64 next_seq;
+
+} msg_bcast_t;
+
+struct file_data_st;
+
+// Channel Struct
+/*
+ * * Channel-Struct Explained: *
+ * For each file, we shall keep an index (xarray) of channels, keyed by channel-id.
+ * Each channel's data will be kept by this struct, allocated from 'channel_cache'.
+ * The cache aligns channels to cache lines, and the first fields are what reading / writing a
+ * short message touches: header and an inline message share a single cache line.
+ * * Lifetime: *
+ * 'refs' counts the index (1) plus every user of the channel: each fd that selected it, and each
+ * operation in progress. Only a channel referenced by the index alone may be reclaimed (when idle),
+ * and it's freed after an RCU grace period, as lock-free lookups may still be looking at it.
+ */
+typedef struct channel_st
+{
+    // Pointer to the message written in the channel (single-message mode), either 'inline_msg' or kmalloc'ed
+    char * msg;
+    int msg_len;
+    // ID of the channcel represnted in the struct
+    unsigned int id;
+    // Storage of messages of up to MSG_INLINE_LEN bytes
+    char inline_msg[MSG_INLINE_LEN];
+    // jiffies of the last time the channel was selected / read / written
+    unsigned long last_used;
+
+    refcount_t refs;
+    // The device (minor) the channel belongs to
+    struct file_data_st* f_data;
+    // Memory held by the channel (struct and messages), also summed into its minor's 'mem_bytes'
+    unsigned long mem_bytes;
+    // Messages (and their bytes) read from / written into the channel, updated under 'lock'
+    u64 reads;
+    u64 writes;
+    u64 read_bytes;
+    u64 write_bytes;
+    struct rcu_head rcu;
+    // Serializes accesses to the channel's message. Channels are independent of each other,
+    // so fds working on different channels never contend on the same lock
+    struct mutex lock;
+    // Readers (and pollers) waiting for a message, and writers waiting for room in a full queue
+    wait_queue_head_t wq;
+    // Messages of the channel (queued mode). Embedded, so lock-free wait conditions may peek at it
+    msg_queue_t queue;
+    // Messages of the channel (broadcast mode), embedded for the same reason
+    msg_bcast_t bcast;
+    // Shared-memory ring of the channel (mapped-ring mode, see MSG_SLOT_SET_RING), NULL otherwise.
+    // Once set it's never freed before the channel itself, as user mappings may still point to it
+    struct msg_slot_ring_hdr* ring;
+    // Kernel's copy of the ring's geometry (the header is writable by user space)
+    unsigned int ring_slot_count;
+    unsigned long ring_size;
+
+} channel_t;
+
+/*
+ * Counters of a minor, one copy per CPU (summed when read), so that concurrent
+ * operations never contend on them
+ */
+typedef struct minor_pcpu_stats_st
+{
+    u64 reads;
+    u64 writes;
+    u64 read_bytes;
+    u64 write_bytes;
+    u64 ioctls;
+    u64 errors;
+
+} minor_pcpu_stats_t;
+
+/*
+ * * File-Data Struct Explained: *
+ * For each file (i.e. a device), keeps a structure with it's valuable and unique data.
+ * A simplified way of seeing it: a structure for the channels-index
+ */
+typedef struct file_data_st
+{
+    // Maps channel-id -> channel_t*. Lookups (xa_load) are RCU-safe and lock-free,
+    // insertions and removals take the xarray's internal lock.
+    struct xarray channels;
+    // Memory usage of the minor (see MSG_SLOT_MINOR_STATS)
+    atomic_long_t channels_count;
+    atomic_long_t mem_bytes;
+    atomic_long_t reclaimed_count;
+    // Operations counters (see debugfs: message_slot/<minor>/stats)
+    minor_pcpu_stats_t __percpu * stats;
+    int minor;
+
+} file_data_t;
+
+static struct kmem_cache* channel_cache;
+
+static void free_fdata (file_data_t* f_data);
+static channel_t* get_or_create_channel(file_data_t* f_data, unsigned int id);
+static channel_t* lookup_channel(file_data_t* f_data, unsigned int id);
+static void put_channel(channel_t* channel);
+static ssize_t channel_read_msg(channel_t* channel, u64* cursor, char __user* buffer,
+                                struct iov_iter* to, size_t length, bool nonblock);
+static ssize_t channel_publish_msg(channel_t* channel, char* staged_msg, size_t length, bool nonblock);
+static ssize_t channel_write_msg(channel_t* channel, const char __user* buffer, size_t length, bool nonblock);
+static unsigned int channel_max_msg_len(channel_t* channel);
+static long channel_set_queue(channel_t* channel, struct msg_slot_queue_cfg __user* user_cfg);
+static long channel_queue_stats(channel_t* channel, struct msg_slot_queue_stats __user* user_stats);
+static long channel_set_ring(channel_t* channel, struct msg_slot_ring_cfg __user* user_cfg);
+static long channel_set_broadcast(channel_t* channel, struct msg_slot_broadcast_cfg __user* user_cfg);
+static long channel_wait_seq(channel_t* channel, u64* cursor, struct msg_slot_seq_wait __user* user_wait,
+                             bool nonblock);
+static void free_channel(channel_t* channel);
+static void free_channel_rcu(struct rcu_head* head);
+static file_data_t* alloc_fdata(int minor);
+static bool channel_try_detach(file_data_t* f_data, channel_t* channel);
+
+// Sequence number of the oldest message a broadcast channel retains (or of the first to come)
+static inline u64 bcast_oldest_seq(unsigned int depth, u64 next_seq)
+{
+    return next_seq > depth ? next_seq - depth : 1;
+}
+
+/*
+ * Where a reader of a broadcast channel starts: at the latest message, or the first to come.
+ * 1 for other channels, where cursors are unused.
+ */
+static inline u64 channel_start_cursor(channel_t* channel)
+{
+    u64 next_seq = READ_ONCE(channel -> bcast.next_seq);
+    return next_seq > 1 ? next_seq - 1 : 1;
+}
+
+/*
+ * Wait-conditions of a channel. May be evaluated without the channel's lock
+ * (as a hint for sleeping / polling), they are re-checked under the lock.
+ * 'cursor' is the reader's cursor on a broadcast channel (NULL: any message will do).
+ */
+static inline bool channel_has_msg(channel_t* channel, const u64* cursor)
+{
+    if (READ_ONCE(channel -> ring) != NULL)
+    {
+        // Lets sleepers of a channel that has just become a ring find out (and fail)
+        return true;
+    }
+    if (READ_ONCE(channel -> bcast.depth) > 0)
+    {
+        return READ_ONCE(channel -> bcast.next_seq) > (cursor != NULL ? max(READ_ONCE(*cursor), (u64) 1) : 1);
+    }
+    if (READ_ONCE(channel -> queue.depth) > 0)
+    {
+        return READ_ONCE(channel -> queue.count) > 0;
+    }
+    return READ_ONCE(channel -> msg) != NULL;
+}
+
+static inline bool channel_has_room(channel_t* channel)
+{
+    return READ_ONCE(channel -> queue.depth) == 0 ||
+           READ_ONCE(channel -> queue.overflow_policy) != MSG_SLOT_OVERFLOW_BLOCK ||
+           READ_ONCE(channel -> queue.count) < READ_ONCE(channel -> queue.depth);
+}
+
+// Updates the memory accounted to the channel (and its minor). Called with the channel's lock held,
+// or when nobody else may access the channel
+static inline void channel_account(channel_t* channel, long bytes)
+{
+    channel -> mem_bytes += bytes;
+    atomic_long_add(bytes, &channel -> f_data -> mem_bytes);
+}
+
+static inline void channel_touch(channel_t* channel)
+{
+    WRITE_ONCE(channel -> last_used, jiffies);
+}
+
+// Heap-allocated messages are freed, inline ones live as long as the channel
+static inline void channel_free_msg(channel_t* channel, char* msg)
+{
+    if (msg != channel -> inline_msg)
+    {
+        kfree(msg);
+    }
+}
+
+//================== CHANNEL STORE ===========================
+//---------------------------------------------------------------
+/*
+ * Returns the channel with the given id (holding a reference on it, see put_channel),
+ * creating (and indexing) it if it doesn't exist yet. Returns ERR_PTR on failure.
+ */
+static channel_t* get_or_create_channel(file_data_t* f_data, unsigned int id)
+{
+    channel_t* channel;
+    channel_t* new_channel = NULL;
+    channel_t* existing;
+
+    while (true)
+    {
+        // Fast path: the channel exists. The index is walked under RCU, so no lock is taken
+        channel = lookup_channel(f_data, id);
+        if (channel != NULL)
+        {
+            break;
+        }
+
+        if (new_channel == NULL)
+        {
+            // requested channel-id is NOT an existing channel, hence it will now be created
+            new_channel = (channel_t *) kmem_cache_zalloc(channel_cache, GFP_KERNEL);
+            if (NULL == new_channel)
+            {
+                return ERR_PTR(-ENOMEM);
+            }
+            mutex_init(&new_channel -> lock);
+            init_waitqueue_head(&new_channel -> wq);
+            // sets the allocated channel-id as requested
+            new_channel -> id = id;
+            new_channel -> f_data = f_data;
+            new_channel -> last_used = jiffies;
+            // One reference for the index, one for the caller
+            refcount_set(&new_channel -> refs, 2);
+        }
+
+        // Publishes the channel, unless someone has already inserted this id meanwhile
+        existing = xa_cmpxchg(&f_data -> channels, id, NULL, new_channel, GFP_KERNEL);
+        if (xa_is_err(existing))
+        {
+            channel = ERR_PTR(xa_err(existing));
+            break;
+        }
+        if (existing == NULL)
+        {
+            channel_account(new_channel, sizeof(*new_channel));
+            atomic_long_inc(&f_data -> channels_count);
+            return new_channel;
+        }
+        // Lost the race to a concurrent creator, so its channel is looked up again
+    }
+
+    if (new_channel != NULL)
+    {
+        kmem_cache_free(channel_cache, new_channel);
+    }
+    return channel;
+}
+
+//---------------------------------------------------------------
+// Returns the channel with the given id (holding a reference on it), or NULL if it doesn't exist
+static channel_t* lookup_channel(file_data_t* f_data, unsigned int id)
+{
+    channel_t* channel;
+
+    rcu_read_lock();
+    channel = xa_load(&f_data -> channels, id);
+    if (channel != NULL && !refcount_inc_not_zero(&channel -> refs))
+    {
+        // Being reclaimed right now, so it's as good as gone
+        channel = NULL;
+    }
+    rcu_read_unlock();
+    return channel;
+}
+
+//---------------------------------------------------------------
+// Drops a reference taken by one of the getters above. The index's own reference is never dropped here
+static void put_channel(channel_t* channel)
+{
+    refcount_dec(&channel -> refs);
+}
+
+//---------------------------------------------------------------
+/*
+ * Copies the channel's message into the user's buffer (either 'buffer', or 'to' when not NULL),
+ * returns the message's length or a negative errno.
+ * For a queued channel, the oldest message is read and removed from the queue.
+ * For a broadcast channel, the message at '*cursor' is read, and the cursor moves past it
+ * (with a NULL 'cursor', the latest message is read).
+ * When the channel has no message yet: fails with -EWOULDBLOCK if 'nonblock', otherwise sleeps until a write.
+ */
+static ssize_t channel_read_msg(channel_t* channel, u64* cursor, char __user* buffer,
+                                struct iov_iter* to, size_t length, bool nonblock)
+{
+    msg_queue_t* queue = &channel -> queue;
+    msg_bcast_t* bcast = &channel -> bcast;
+    char* msg;
+    size_t msg_len;
+    ssize_t ret_val;
+    u64 seq = 0;
+    bool consumed = false;
+
+    mutex_lock(&channel -> lock);
+    while(!channel_has_msg(channel, cursor))
+    {
+        mutex_unlock(&channel -> lock);
+        if (nonblock)
+        {
+            // No message exists
+            return -EWOULDBLOCK;
+        }
+        // Sleeps (without holding the lock) until channel_publish_msg() wakes us up
+        if (wait_event_interruptible(channel -> wq, channel_has_msg(channel, cursor)))
+        {
+            return -ERESTARTSYS;
+        }
+        mutex_lock(&channel -> lock);
+    }
+
+    if (channel -> ring != NULL)
+    {
+        // Ring messages are consumed through the mapping only
+        mutex_unlock(&channel -> lock);
+        return -EINVAL;
+    }
+    channel_touch(channel);
+    if (bcast -> depth > 0)
+    {
+        // A lagging reader skips the messages that were already dropped
+        seq = (cursor != NULL) ? max(*cursor, bcast_oldest_seq(bcast -> depth, bcast -> next_seq))
+                               : bcast -> next_seq - 1;
+        msg = bcast -> slots[seq % bcast -> depth].msg;
+        msg_len = bcast -> slots[seq % bcast -> depth].msg_len;
+    }
+    else if (queue -> depth > 0)
+    {
+        msg = queue -> slots[queue -> head].msg;
+        msg_len = queue -> slots[queue -> head].msg_len;
+    }
+    else
+    {
+        msg = channel -> msg;
+        msg_len = channel -> msg_len;
+    }
+
+    ret_val = msg_len;
+    if(length < msg_len)
+    {
+        // Buffer-length is smaller than the message's
+        ret_val = -ENOSPC;
+    }
+    else if (to != NULL)
+    {
+        if (copy_to_iter(msg, msg_len, to) != msg_len)
+        {
+            ret_val = -EFAULT;
+        }
+    }
+    else if (0 != copy_to_user(buffer, msg, msg_len))
+    {
+        ret_val = -EFAULT;
+    }
+
+    if (ret_val >= 0)
+    {
+        channel -> reads++;
+        channel -> read_bytes += msg_len;
+        if (seq > 0 && cursor != NULL)
+        {
+            WRITE_ONCE(*cursor, seq + 1);
+        }
+    }
+    if (ret_val >= 0 && queue -> depth > 0)
+    {
+        // Dequeues the message that was read
+        channel_account(channel, -(long) msg_len);
+        queue -> slots[queue -> head].msg = NULL;
+        queue -> head = (queue -> head + 1) % queue -> depth;
+        WRITE_ONCE(queue -> count, queue -> count - 1);
+        consumed = true;
+    }
+    mutex_unlock(&channel -> lock);
+
+    if (consumed)
+    {
+        kfree(msg);
+        // Wakes writers blocked on a full queue
+        if (wq_has_sleeper(&channel -> wq))
+        {
+            wake_up_interruptible_poll(&channel -> wq, EPOLLOUT | EPOLLWRNORM);
+        }
+    }
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+/*
+ * Publishes 'staged_msg' (a fully copied message) into the channel.
+ * Readers see either the old or the new message, never a mix.
+ * Messages longer than MSG_INLINE_LEN are kmalloc'ed by the caller and their ownership passes here,
+ * shorter ones are staged in the caller's (stack) buffer and copied.
+ * Single-message channel: replaces the message (stored inline, when short).
+ * Queued channel: appends the message, handling a full queue by the channel's overflow policy
+ * (sleeping for room unless 'nonblock').
+ * Broadcast channel: appends the message under the next sequence number, dropping the oldest one.
+ */
+static ssize_t channel_publish_msg(channel_t* channel, char* staged_msg, size_t length, bool nonblock)
+{
+    msg_queue_t* queue = &channel -> queue;
+    msg_bcast_t* bcast = &channel -> bcast;
+    // Whether 'staged_msg' is a heap buffer we own (and must free, unless it's stored)
+    bool staged_owned = length > MSG_INLINE_LEN;
+    char* old_msg = NULL;
+    ssize_t ret_val = length;
+    queued_msg_t* slot;
+    unsigned int tail;
+
+    mutex_lock(&channel -> lock);
+    while (!channel_has_room(channel))
+    {
+        mutex_unlock(&channel -> lock);
+        if (nonblock)
+        {
+            ret_val = -EAGAIN;
+            goto out;
+        }
+        // Sleeps (without holding the lock) until channel_read_msg() consumes a message
+        if (wait_event_interruptible(channel -> wq, channel_has_room(channel)))
+        {
+            ret_val = -ERESTARTSYS;
+            goto out;
+        }
+        mutex_lock(&channel -> lock);
+    }
+
+    if (channel -> ring != NULL)
+    {
+        // Ring messages are produced through the mapping only
+        ret_val = -EINVAL;
+    }
+    // The length was checked before copying, but the channel's mode may have changed since
+    else if (length > channel_max_msg_len(channel))
+    {
+        ret_val = -EMSGSIZE;
+    }
+    else if (bcast -> depth > 0)
+    {
+        if (!staged_owned)
+        {
+            // Broadcast messages live on the heap as well
+            staged_msg = kmemdup(staged_msg, length, GFP_KERNEL);
+            if (NULL == staged_msg)
+            {
+                ret_val = -ENOMEM;
+                goto unlock;
+            }
+        }
+        // Replaces the oldest message, once all slots are used
+        slot = &bcast -> slots[bcast -> next_seq % bcast -> depth];
+        old_msg = slot -> msg;
+        channel_account(channel, (long) length - (long) slot -> msg_len);
+        slot -> msg = staged_msg;
+        slot -> msg_len = length;
+        staged_owned = false;
+        WRITE_ONCE(bcast -> next_seq, bcast -> next_seq + 1);
+    }
+    else if (queue -> depth == 0)
+    {
+        if (channel -> msg != NULL && channel -> msg != channel -> inline_msg)
+        {
+            old_msg = channel -> msg;
+            channel_account(channel, -(long) channel -> msg_len);
+        }
+        if (!staged_owned)
+        {
+            memcpy(channel -> inline_msg, staged_msg, length);
+            staged_msg = channel -> inline_msg;
+        }
+        else
+        {
+            channel_account(channel, length);
+            staged_owned = false;
+        }
+        channel -> msg_len = length;
+        WRITE_ONCE(channel -> msg, staged_msg);
+    }
+    else
+    {
+        if (!staged_owned)
+        {
+            // Queued messages always live on the heap, in an exact-size buffer
+            staged_msg = kmemdup(staged_msg, length, GFP_KERNEL);
+            if (NULL == staged_msg)
+            {
+                ret_val = -ENOMEM;
+                goto unlock;
+            }
+            staged_owned = true;
+        }
+        if (queue -> count == queue -> depth)
+        {
+            if (queue -> overflow_policy == MSG_SLOT_OVERFLOW_FAIL)
+            {
+                ret_val = -ENOBUFS;
+                goto unlock;
+            }
+            // MSG_SLOT_OVERFLOW_DROP_OLDEST
+            old_msg = queue -> slots[queue -> head].msg;
+            channel_account(channel, -(long) queue -> slots[queue -> head].msg_len);
+            queue -> slots[queue -> head].msg = NULL;
+            queue -> head = (queue -> head + 1) % queue -> depth;
+            queue -> count--;
+            queue -> dropped++;
+        }
+        tail = (queue -> head + queue -> count) % queue -> depth;
+        queue -> slots[tail].msg = staged_msg;
+        queue -> slots[tail].msg_len = length;
+        channel_account(channel, length);
+        staged_owned = false;
+        WRITE_ONCE(queue -> count, queue -> count + 1);
+        queue -> high_water = max(queue -> high_water, queue -> count);
+    }
+    if (ret_val >= 0)
+    {
+        channel -> writes++;
+        channel -> write_bytes += length;
+        channel_touch(channel);
+    }
+unlock:
+    mutex_unlock(&channel -> lock);
+
+    // Wakes blocked readers and pollers. wq_has_sleeper() keeps the common no-waiters case lock-free
+    if (ret_val >= 0 && wq_has_sleeper(&channel -> wq))
+    {
+        wake_up_interruptible_poll(&channel -> wq, EPOLLIN | EPOLLRDNORM);
+    }
+
+    // kfree(NULL) is a no-op, in case it's the channel's first message
+    kfree(old_msg);
+out:
+    if (staged_owned)
+    {
+        // Not stored in the channel (i.e. failed)
+        kfree(staged_msg);
+    }
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+/*
+ * Writes the user's message into the channel: copies the whole message at once into a staging
+ * buffer, so the channel's current message stays untouched until the new one is complete.
+ * Short messages are staged on the stack, longer ones in an exact-size kmalloc'ed buffer.
+ */
+static ssize_t channel_write_msg(channel_t* channel, const char __user* buffer, size_t length, bool nonblock)
+{
+    char inline_buf[MSG_INLINE_LEN];
+    char* staged_msg;
+
+    if(length == 0 || length > channel_max_msg_len(channel))
+    {
+        // Invalid message length
+        return -EMSGSIZE;
+    }
+    if (length <= MSG_INLINE_LEN)
+    {
+        if (0 != copy_from_user(inline_buf, buffer, length))
+        {
+            return -EFAULT;
+        }
+        staged_msg = inline_buf;
+    }
+    else
+    {
+        // -EFAULT / -ENOMEM on failure
+        staged_msg = memdup_user(buffer, length);
+        if (IS_ERR(staged_msg))
+        {
+            return PTR_ERR(staged_msg);
+        }
+    }
+    return channel_publish_msg(channel, staged_msg, length, nonblock);
+}
+
+//---------------------------------------------------------------
+// Max length of a message written into the channel
+static unsigned int channel_max_msg_len(channel_t* channel)
+{
+    if (READ_ONCE(channel -> bcast.depth) > 0)
+    {
+        return READ_ONCE(channel -> bcast.max_msg_len);
+    }
+    if (READ_ONCE(channel -> queue.depth) > 0)
+    {
+        return READ_ONCE(channel -> queue.max_msg_len);
+    }
+    return BUF_LEN;
+}
+
+//---------------------------------------------------------------
+/*
+ * MSG_SLOT_SET_QUEUE: (re)configures the channel's queue. The channel must hold no messages (nor be a
+ * broadcast one), so no message is ever lost or truncated by a configuration change.
+ */
+static long channel_set_queue(channel_t* channel, struct msg_slot_queue_cfg __user* user_cfg)
+{
+    struct msg_slot_queue_cfg cfg;
+    msg_queue_t* queue = &channel -> queue;
+    queued_msg_t* new_slots = NULL;
+    queued_msg_t* old_slots;
+
+    if (0 != copy_from_user(&cfg, user_cfg, sizeof(cfg)))
+    {
+        return -EFAULT;
+    }
+    if (cfg.depth > MSG_SLOT_MAX_QUEUE_DEPTH)
+    {
+        return -EINVAL;
+    }
+    if (cfg.depth > 0)
+    {
+        if (cfg.max_msg_len == 0 || cfg.max_msg_len > MSG_SLOT_MAX_MSG_LEN ||
+            cfg.overflow_policy > MSG_SLOT_OVERFLOW_FAIL)
+        {
+            return -EINVAL;
+        }
+        new_slots = (queued_msg_t*) kcalloc(cfg.depth, sizeof(*new_slots), GFP_KERNEL);
+        if (NULL == new_slots)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    mutex_lock(&channel -> lock);
+    if (channel -> msg != NULL || queue -> count > 0 || channel -> ring != NULL || channel -> bcast.depth > 0)
+    {
+        mutex_unlock(&channel -> lock);
+        kfree(new_slots);
+        return -EBUSY;
+    }
+    old_slots = queue -> slots;
+    channel_account(channel, ((long) cfg.depth - (long) queue -> depth) * (long) sizeof(*new_slots));
+    queue -> slots = new_slots;
+    queue -> head = 0;
+    queue -> high_water = 0;
+    queue -> dropped = 0;
+    WRITE_ONCE(queue -> max_msg_len, cfg.max_msg_len);
+    WRITE_ONCE(queue -> overflow_policy, cfg.overflow_policy);
+    WRITE_ONCE(queue -> depth, cfg.depth);
+    mutex_unlock(&channel -> lock);
+
+    kfree(old_slots);
+    // Writers blocked on the old (full) configuration should re-evaluate
+    wake_up_interruptible_all(&channel -> wq);
+    return SUCCESS;
+}
+
+//---------------------------------------------------------------
+/*
+ * MSG_SLOT_SET_RING: turns the channel into a mapped ring of the given geometry.
+ * The channel must hold no messages and be neither queued nor a broadcast one. Setting the same geometry again is a no-op,
+ * so both sides of the ring may issue it.
+ */
+static long channel_set_ring(channel_t* channel, struct msg_slot_ring_cfg __user* user_cfg)
+{
+    struct msg_slot_ring_cfg cfg;
+    struct msg_slot_ring_hdr* ring;
+    unsigned long ring_size;
+    long ret_val = SUCCESS;
+
+    if (0 != copy_from_user(&cfg, user_cfg, sizeof(cfg)))
+    {
+        return -EFAULT;
+    }
+    if (cfg.slot_size < 2 * sizeof(u32) || cfg.slot_size % 8 != 0 ||
+        cfg.slot_count < 2 || (cfg.slot_count & (cfg.slot_count - 1)) != 0 ||
+        MSG_SLOT_RING_MAP_SIZE(cfg) > MSG_SLOT_MAX_RING_SIZE)
+    {
+        return -EINVAL;
+    }
+    ring_size = MSG_SLOT_RING_MAP_SIZE(cfg);
+
+    // Zeroed, page-aligned, and marked as mappable to user space
+    ring = (struct msg_slot_ring_hdr*) vmalloc_user(ring_size);
+    if (NULL == ring)
+    {
+        return -ENOMEM;
+    }
+    ring -> slot_size = cfg.slot_size;
+    ring -> slot_count = cfg.slot_count;
+
+    mutex_lock(&channel -> lock);
+    if (channel -> ring != NULL)
+    {
+        if (channel -> ring_slot_count != cfg.slot_count || channel -> ring_size != ring_size)
+        {
+            ret_val = -EBUSY;
+        }
+    }
+    else if (channel -> msg != NULL || channel -> queue.depth > 0 || channel -> bcast.depth > 0)
+    {
+        ret_val = -EBUSY;
+    }
+    else
+    {
+        channel -> ring_slot_count = cfg.slot_count;
+        channel -> ring_size = ring_size;
+        channel_account(channel, ring_size);
+        // Publishes the (initialized) ring to lock-free readers (poll, mmap)
+        smp_store_release(&channel -> ring, ring);
+        ring = NULL;
+    }
+    mutex_unlock(&channel -> lock);
+
+    // vfree(NULL) is a no-op, in case the ring was installed
+    vfree(ring);
+    // Blocked readers of the channel should now find out it's a ring
+    wake_up_interruptible_all(&channel -> wq);
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+/*
+ * MSG_SLOT_SET_BROADCAST: turns the channel into a broadcast channel of the given configuration.
+ * The channel must be an empty single-message one. Setting the same configuration again is a no-op.
+ */
+static long channel_set_broadcast(channel_t* channel, struct msg_slot_broadcast_cfg __user* user_cfg)
+{
+    struct msg_slot_broadcast_cfg cfg;
+    msg_bcast_t* bcast = &channel -> bcast;
+    queued_msg_t* new_slots;
+    long ret_val = SUCCESS;
+
+    if (0 != copy_from_user(&cfg, user_cfg, sizeof(cfg)))
+    {
+        return -EFAULT;
+    }
+    if (cfg.depth == 0 || cfg.depth > MSG_SLOT_MAX_QUEUE_DEPTH ||
+        cfg.max_msg_len == 0 || cfg.max_msg_len > MSG_SLOT_MAX_MSG_LEN)
+    {
+        return -EINVAL;
+    }
+    new_slots = (queued_msg_t*) kcalloc(cfg.depth, sizeof(*new_slots), GFP_KERNEL);
+    if (NULL == new_slots)
+    {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&channel -> lock);
+    if (bcast -> depth > 0)
+    {
+        if (bcast -> depth != cfg.depth || bcast -> max_msg_len != cfg.max_msg_len)
+        {
+            ret_val = -EBUSY;
+        }
+    }
+    else if (channel -> msg != NULL || channel -> queue.depth > 0 || channel -> ring != NULL)
+    {
+        ret_val = -EBUSY;
+    }
+    else
+    {
+        channel_account(channel, (long) cfg.depth * (long) sizeof(*new_slots));
+        bcast -> slots = new_slots;
+        new_slots = NULL;
+        WRITE_ONCE(bcast -> max_msg_len, cfg.max_msg_len);
+        WRITE_ONCE(bcast -> next_seq, 1);
+        WRITE_ONCE(bcast -> depth, cfg.depth);
+    }
+    mutex_unlock(&channel -> lock);
+
+    // kfree(NULL) is a no-op, in case the slots were installed
+    kfree(new_slots);
+    return ret_val;
+}
+
+//---------------------------------------------------------------
+/*
+ * MSG_SLOT_WAIT_SEQ: sleeps until the broadcast channel's latest message is past the requested sequence
+ * number (fails with -EAGAIN instead if 'nonblock'), then reports the channel's sequence numbers
+ * and the reader's 'cursor'.
+ */
+static long channel_wait_seq(channel_t* channel, u64* cursor, struct msg_slot_seq_wait __user* user_wait,
+                             bool nonblock)
+{
+    struct msg_slot_seq_wait wait;
+    msg_bcast_t* bcast = &channel -> bcast;
+    u64 oldest;
+
+    if (0 != copy_from_user(&wait, user_wait, sizeof(wait)))
+    {
+        return -EFAULT;
+    }
+    if (READ_ONCE(bcast -> depth) == 0)
+    {
+        // Not a broadcast channel (which never stops being one)
+        return -EINVAL;
+    }
+    // The latest message is next_seq - 1, so it's past 'seq' once next_seq - 1 > seq
+    if (READ_ONCE(bcast -> next_seq) - 1 <= wait.seq)
+    {
+        if (nonblock)
+        {
+            return -EAGAIN;
+        }
+        if (wait_event_interruptible(channel -> wq, READ_ONCE(bcast -> next_seq) - 1 > wait.seq))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    mutex_lock(&channel -> lock);
+    oldest = bcast_oldest_seq(bcast -> depth, bcast -> next_seq);
+    wait.latest = bcast -> next_seq - 1;
+    wait.oldest = (wait.latest > 0) ? oldest : 0;
+    wait.cursor = max(READ_ONCE(*cursor), oldest);
+    mutex_unlock(&channel -> lock);
+
+    if (0 != copy_to_user(user_wait, &wait, sizeof(wait)))
+    {
+        return -EFAULT;
+    }
+    return SUCCESS;
+}
+
+//---------------------------------------------------------------
+// MSG_SLOT_QUEUE_STATS: reports the channel's queue configuration and statistics
+static long channel_queue_stats(channel_t* channel, struct msg_slot_queue_stats __user* user_stats)
+{
+    struct msg_slot_queue_stats stats;
+    msg_queue_t* queue = &channel -> queue;
+
+    memset(&stats, 0, sizeof(stats));
+    mutex_lock(&channel -> lock);
+    if (channel -> bcast.depth > 0)
+    {
+        // A broadcast channel reports as a queue that drops its oldest messages, none of which are consumed
+        stats.depth = channel -> bcast.depth;
+        stats.max_msg_len = channel -> bcast.max_msg_len;
+        stats.overflow_policy = MSG_SLOT_OVERFLOW_DROP_OLDEST;
+        stats.count = min(channel -> bcast.next_seq - 1, (u64) channel -> bcast.depth);
+        stats.high_water = stats.count;
+        stats.dropped = channel -> bcast.next_seq - 1 - stats.count;
+    }
+    else if (queue -> depth > 0)
+    {
+        stats.depth = queue -> depth;
+        stats.max_msg_len = queue -> max_msg_len;
+        stats.overflow_policy = queue -> overflow_policy;
+        stats.count = queue -> count;
+        stats.high_water = queue -> high_water;
+        stats.dropped = queue -> dropped;
+    }
+    else
+    {
+        stats.max_msg_len = BUF_LEN;
+        stats.count = (channel -> msg != NULL);
+        stats.high_water = stats.count;
+    }
+    mutex_unlock(&channel -> lock);
+
+    if (0 != copy_to_user(user_stats, &stats, sizeof(stats)))
+    {
+        return -EFAULT;
+    }
+    return SUCCESS;
+}
+
+//---------------------------------------------------------------
+// Frees the channel, with all of its messages
+static void free_channel(channel_t* channel)
+{
+    msg_queue_t* queue = &channel -> queue;
+    unsigned int i;
+
+    for (i = 0; i < queue -> count; i++)
+    {
+        kfree(queue -> slots[(queue -> head + i) % queue -> depth].msg);
+    }
+    kfree(queue -> slots);
+    for (i = 0; i < channel -> bcast.depth; i++)
+    {
+        kfree(channel -> bcast.slots[i].msg);
+    }
+    kfree(channel -> bcast.slots);
+    channel_free_msg(channel, channel -> msg);
+    vfree(channel -> ring);
+    kmem_cache_free(channel_cache, channel);
+}
+
+static void free_channel_rcu(struct rcu_head* head)
+{
+    free_channel(container_of(head, channel_t, rcu));
+}
+
+//---------------------------------------------------------------
+/*
+ * Removes the channel from its minor's index, if it's referenced by the index alone (no fd selected it
+ * and no operation is in progress) and nobody waits on it. Mapped rings are never removed, user mappings
+ * may still point to them. Called with the index's lock held.
+ * On success the caller owns the channel, and frees it once lock-free lookups are done (i.e. via call_rcu).
+ */
+static bool channel_try_detach(file_data_t* f_data, channel_t* channel)
+{
+    if (READ_ONCE(channel -> ring) != NULL)
+    {
+        return false;
+    }
+    // From here on lookups fail to take a reference, so nobody new may start using the channel
+    if (!refcount_dec_if_one(&channel -> refs))
+    {
+        return false;
+    }
+    if (waitqueue_active(&channel -> wq))
+    {
+        // Still registered by a poller (e.g. epoll), which would be left with a dangling wait-queue
+        refcount_set(&channel -> refs, 1);
+        return false;
+    }
+    __xa_erase(&f_data -> channels, channel -> id);
+    atomic_long_sub(channel -> mem_bytes, &f_data -> mem_bytes);
+    atomic_long_dec(&f_data -> channels_count);
+    return true;
+}
+
+//---------------------------------------------------------------
+/*
+ * Creates the file-data structure of a minor, shared by all of its fds.
+ * Channels are created lazily (on MSG_SLOT_CHANNEL), so the index starts empty. Returns NULL on failure.
+ */
+static file_data_t* alloc_fdata(int minor)
+{
+    file_data_t* f_data;
+
+    f_data = (file_data_t *) kzalloc(sizeof(*f_data), GFP_KERNEL);
+    if (NULL == f_data)
+    {
+        return NULL;
+    }
+    xa_init(&f_data -> channels);
+    f_data -> minor = minor;
+    f_data -> stats = alloc_percpu(minor_pcpu_stats_t);
+    if (NULL == f_data -> stats)
+    {
+        kfree(f_data);
+        return NULL;
+    }
+    return f_data;
+}
+
+//---------------------------------------------------------------
+static void free_fdata(file_data_t* f_data)
+{
+    channel_t* channel_to_free;
+    unsigned long id;
+
+    xa_for_each(&f_data -> channels, id, channel_to_free)
+    {
+        free_channel(channel_to_free);
+    }
+    xa_destroy(&f_data -> channels);
+    free_percpu(f_data -> stats);
+    // Frees fdata
+    kfree(f_data);
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef MESSAGE_SLOT_RING_H
+#define MESSAGE_SLOT_RING_H
+
+/*
+ * --- MAPPED RING HELPERS (user space) ---
+ * Implements the producer / consumer sides of a mapped-ring channel, as described in message_slot.h.
+ * In steady state no syscall is made: only a side about to sleep, and the side waking it, enter the kernel.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "message_slot.h"
+
+typedef struct msg_slot_ring_st
+{
+    int fd;
+    struct msg_slot_ring_hdr* hdr;
+    char* data;
+    __u32 slot_size;
+    __u32 slot_mask;
+    unsigned long map_size;
+} msg_slot_ring_t;
+
+/*
+ * Turns the fd's current channel into a ring of the given geometry (if it isn't one already),
+ * and maps it. Returns 0, or -1 with errno set.
+ */
+static inline int msg_slot_ring_open(msg_slot_ring_t* ring, int fd, struct msg_slot_ring_cfg cfg)
+{
+    if (ioctl(fd, MSG_SLOT_SET_RING, &cfg) != 0)
+    {
+        return -1;
+    }
+    void* mem = mmap(NULL, MSG_SLOT_RING_MAP_SIZE(cfg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+    {
+        return -1;
+    }
+    ring -> fd = fd;
+    ring -> hdr = (struct msg_slot_ring_hdr*) mem;
+    ring -> data = (char*) mem + MSG_SLOT_RING_DATA_OFFSET;
+    ring -> slot_size = cfg.slot_size;
+    ring -> slot_mask = cfg.slot_count - 1;
+    ring -> map_size = MSG_SLOT_RING_MAP_SIZE(cfg);
+    return 0;
+}
+
+static inline void msg_slot_ring_close(msg_slot_ring_t* ring)
+{
+    munmap(ring -> hdr, ring -> map_size);
+}
+
+// Max message length that fits in a slot
+static inline __u32 msg_slot_ring_max_msg_len(msg_slot_ring_t* ring)
+{
+    return ring -> slot_size - sizeof(__u32);
+}
+
+// Wakes the other side if it announced (via 'waiting') that it's about to sleep
+static inline void msg_slot_ring_notify(msg_slot_ring_t* ring, __u32* waiting)
+{
+    // Orders our index store before reading the other side's flag (pairs with msg_slot_ring_wait)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+    {
+        ioctl(ring -> fd, MSG_SLOT_RING_WAKE);
+    }
+}
+
+/*
+ * Sleeps in poll() until 'ready' holds, announcing it through 'waiting' first.
+ * 'ready' is re-checked after announcing, so a concurrent notify is never missed.
+ */
+static inline int msg_slot_ring_wait(msg_slot_ring_t* ring, __u32* waiting, short events,
+                                     int (*ready)(msg_slot_ring_t*))
+{
+    struct pollfd pfd = { .fd = ring -> fd, .events = events };
+    int ret_val = 0;
+
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!ready(ring))
+    {
+        ret_val = poll(&pfd, 1, -1);
+        if (ret_val < 0 && errno != EINTR)
+        {
+            break;
+        }
+        ret_val = 0;
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return ret_val;
+}
+
+static inline int msg_slot_ring_readable(msg_slot_ring_t* ring)
+{
+    return __atomic_load_n(&ring -> hdr -> head, __ATOMIC_ACQUIRE) != ring -> hdr -> tail;
+}
+
+static inline int msg_slot_ring_writable(msg_slot_ring_t* ring)
+{
+    return ring -> hdr -> head - __atomic_load_n(&ring -> hdr -> tail, __ATOMIC_ACQUIRE) <= ring -> slot_mask;
+}
+
+//================== PRODUCER ===========================
+/*
+ * Copies 'msg' into the next free slot and publishes it.
+ * Returns 0, or -1 with errno EAGAIN (ring is full, when 'nonblock') / EMSGSIZE.
+ */
+static inline int msg_slot_ring_send(msg_slot_ring_t* ring, const void* msg, __u32 len, int nonblock)
+{
+    struct msg_slot_ring_hdr* hdr = ring -> hdr;
+
+    if (len > msg_slot_ring_max_msg_len(ring))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    while (!msg_slot_ring_writable(ring))
+    {
+        if (nonblock)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (msg_slot_ring_wait(ring, &hdr -> producer_waiting, POLLOUT, msg_slot_ring_writable) != 0)
+        {
+            return -1;
+        }
+    }
+
+    __u32 head = hdr -> head;
+    char* slot = ring -> data + (unsigned long) (head & ring -> slot_mask) * ring -> slot_size;
+    memcpy(slot, &len, sizeof(len));
+    memcpy(slot + sizeof(len), msg, len);
+    __atomic_store_n(&hdr -> head, head + 1, __ATOMIC_RELEASE);
+    msg_slot_ring_notify(ring, &hdr -> consumer_waiting);
+    return 0;
+}
+
+//================== CONSUMER ===========================
+/*
+ * Returns a pointer to the oldest message, in place (zero-copy), and its length via 'len'.
+ * The message stays valid until msg_slot_ring_consume(). Returns NULL with errno EAGAIN
+ * if the ring is empty and 'nonblock'.
+ */
+static inline const void* msg_slot_ring_peek(msg_slot_ring_t* ring, __u32* len, int nonblock)
+{
+    struct msg_slot_ring_hdr* hdr = ring -> hdr;
+
+    while (!msg_slot_ring_readable(ring))
+    {
+        if (nonblock)
+        {
+            errno = EAGAIN;
+            return NULL;
+        }
+        if (msg_slot_ring_wait(ring, &hdr -> consumer_waiting, POLLIN, msg_slot_ring_readable) != 0)
+        {
+            return NULL;
+        }
+    }
+
+    char* slot = ring -> data + (unsigned long) (hdr -> tail & ring -> slot_mask) * ring -> slot_size;
+    memcpy(len, slot, sizeof(*len));
+    if (*len > msg_slot_ring_max_msg_len(ring))
+    {
+        // Corrupted by the producer, never trust the shared length
+        *len = msg_slot_ring_max_msg_len(ring);
+    }
+    return slot + sizeof(*len);
+}
+
+// Releases the message returned by msg_slot_ring_peek(), making its slot available to the producer
+static inline void msg_slot_ring_consume(msg_slot_ring_t* ring)
+{
+    __atomic_store_n(&ring -> hdr -> tail, ring -> hdr -> tail + 1, __ATOMIC_RELEASE);
+    msg_slot_ring_notify(ring, &ring -> hdr -> producer_waiting);
+}
+
+#endif
@@ -0,0 +1,629 @@
+#ifndef MESSAGE_SLOT_SHIM_H
+#define MESSAGE_SLOT_SHIM_H
+
+/*
+ * --- KERNEL SHIM ---
+ * The kernel facilities used by the channel store (message_slot_core.h).
+ * In the module these are the kernel's own. In user space they're mapped onto libc / pthreads / GCC atomics,
+ * keeping the kernel's semantics where the store relies on them:
+ * - xarray: a radix tree of 64-slot nodes, read lock-free (like xa_load under RCU), written under a lock.
+ *   Unlike the kernel's, nodes are never shrunk before xa_destroy().
+ * - RCU: readers never block writers. With no grace periods, call_rcu() callbacks are deferred until rcu_barrier().
+ * - Wait-queues: a mutex + condition variable, sleeping until the condition holds. Nothing is interruptible.
+ * - User copies: plain memcpy(), user pointers are just pointers.
+ * - Per-CPU counters: a single copy, updated atomically.
+ */
+
+#ifdef __KERNEL__
+
+#include <linux/errno.h>
+#include <linux/kernel.h>   /* We're doing kernel work */
+#include <linux/uaccess.h>  /* for copy_to_user and copy_from_user */
+#include <linux/uio.h>      /* for iov_iter (readv / writev) */
+#include <linux/string.h>   /* for memset. NOTE - not string.h!*/
+#include <linux/slab.h>
+#include <linux/mutex.h>    /* for the per-channel lock */
+#include <linux/wait.h>     /* for blocking reads */
+#include <linux/poll.h>     /* for the wake-up masks */
+#include <linux/vmalloc.h>  /* for the mapped rings */
+#include <linux/err.h>      /* for ERR_PTR, IS_ERR */
+#include <linux/xarray.h>   /* for the channels index */
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+
+#else
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>      /* for the wake-up masks */
+#include <sys/types.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef unsigned int gfp_t;
+
+#define __user
+#define __percpu
+#define GFP_KERNEL 0
+#define ERESTARTSYS 512
+#define MAX_ERRNO 4095
+#define L1_CACHE_BYTES 64
+#define PAGE_SIZE 4096UL
+#define SLAB_HWCACHE_ALIGN 1UL
+
+#define container_of(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
+#define max(a, b) ({ __typeof__(a) __a = (a); __typeof__(b) __b = (b); __a > __b ? __a : __b; })
+#define min(a, b) ({ __typeof__(a) __a = (a); __typeof__(b) __b = (b); __a < __b ? __a : __b; })
+#define u64_to_user_ptr(x) ((void*) (uintptr_t) (x))
+
+//================== ATOMICS ===========================
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, val) __atomic_store_n((p), (val), __ATOMIC_RELEASE)
+#define xchg(p, val) __atomic_exchange_n((p), (val), __ATOMIC_SEQ_CST)
+
+typedef struct
+{
+    long counter;
+} atomic_long_t;
+
+#define atomic_long_read(v) __atomic_load_n(&(v) -> counter, __ATOMIC_RELAXED)
+#define atomic_long_set(v, i) __atomic_store_n(&(v) -> counter, (i), __ATOMIC_RELAXED)
+#define atomic_long_add(i, v) ((void) __atomic_add_fetch(&(v) -> counter, (i), __ATOMIC_RELAXED))
+#define atomic_long_sub(i, v) ((void) __atomic_sub_fetch(&(v) -> counter, (i), __ATOMIC_RELAXED))
+#define atomic_long_inc(v) atomic_long_add(1, v)
+#define atomic_long_dec(v) atomic_long_sub(1, v)
+
+typedef struct
+{
+    int refs;
+} refcount_t;
+
+static inline void refcount_set(refcount_t* r, int n)
+{
+    __atomic_store_n(&r -> refs, n, __ATOMIC_RELAXED);
+}
+
+static inline unsigned int refcount_read(refcount_t* r)
+{
+    return __atomic_load_n(&r -> refs, __ATOMIC_RELAXED);
+}
+
+static inline void refcount_inc(refcount_t* r)
+{
+    __atomic_add_fetch(&r -> refs, 1, __ATOMIC_RELAXED);
+}
+
+static inline bool refcount_inc_not_zero(refcount_t* r)
+{
+    int old = __atomic_load_n(&r -> refs, __ATOMIC_RELAXED);
+    do
+    {
+        if (old == 0)
+        {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&r -> refs, &old, old + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return true;
+}
+
+static inline void refcount_dec(refcount_t* r)
+{
+    __atomic_sub_fetch(&r -> refs, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool refcount_dec_if_one(refcount_t* r)
+{
+    int one = 1;
+    return __atomic_compare_exchange_n(&r -> refs, &one, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+//================== ERRORS ===========================
+#define IS_ERR_VALUE(x) ((unsigned long) (x) >= (unsigned long) -MAX_ERRNO)
+
+static inline void* ERR_PTR(long error)
+{
+    return (void*) error;
+}
+
+static inline long PTR_ERR(const void* ptr)
+{
+    return (long) ptr;
+}
+
+static inline bool IS_ERR(const void* ptr)
+{
+    return IS_ERR_VALUE(ptr);
+}
+
+//================== MEMORY ===========================
+#define kmalloc(size, gfp) malloc(size)
+#define kzalloc(size, gfp) calloc(1, (size))
+#define kcalloc(n, size, gfp) calloc((n), (size))
+#define kmalloc_array(n, size, gfp) \
+    (((size) != 0 && (n) > SIZE_MAX / (size)) ? NULL : malloc((size_t) (n) * (size)))
+#define kfree(ptr) free((void*) (ptr))
+
+static inline void* kmemdup(const void* src, size_t len, gfp_t gfp)
+{
+    void* dst = malloc(len);
+    if (dst != NULL)
+    {
+        memcpy(dst, src, len);
+    }
+    return dst;
+}
+
+// Zeroed and page-aligned, like the kernel's (mappable) allocation
+static inline void* vmalloc_user(unsigned long size)
+{
+    unsigned long rounded = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    void* mem = aligned_alloc(PAGE_SIZE, rounded);
+    if (mem != NULL)
+    {
+        memset(mem, 0, rounded);
+    }
+    return mem;
+}
+
+#define vfree(ptr) free((void*) (ptr))
+
+struct kmem_cache
+{
+    size_t size;
+    size_t align;
+};
+
+static inline struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align,
+                                                   unsigned long flags, void (*ctor)(void*))
+{
+    struct kmem_cache* cache = (struct kmem_cache*) malloc(sizeof(*cache));
+    if (cache != NULL)
+    {
+        cache -> align = (flags & SLAB_HWCACHE_ALIGN) ? L1_CACHE_BYTES : (align ? align : sizeof(void*));
+        cache -> size = (size + cache -> align - 1) & ~(cache -> align - 1);
+    }
+    return cache;
+}
+
+static inline void* kmem_cache_zalloc(struct kmem_cache* cache, gfp_t gfp)
+{
+    void* obj = aligned_alloc(cache -> align, cache -> size);
+    if (obj != NULL)
+    {
+        memset(obj, 0, cache -> size);
+    }
+    return obj;
+}
+
+#define kmem_cache_free(cache, obj) free(obj)
+#define kmem_cache_destroy(cache) free(cache)
+
+#define alloc_percpu(type) ((type*) calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define this_cpu_add(x, val) ((void) __atomic_add_fetch(&(x), (val), __ATOMIC_RELAXED))
+#define this_cpu_inc(x) this_cpu_add(x, 1)
+#define per_cpu_ptr(ptr, cpu) (ptr)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+//================== USER COPIES ===========================
+static inline unsigned long copy_from_user(void* to, const void* from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_to_user(void* to, const void* from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline void* memdup_user(const void* src, size_t len)
+{
+    void* dst = kmemdup(src, len, GFP_KERNEL);
+    return (dst != NULL) ? dst : ERR_PTR(-ENOMEM);
+}
+
+// A single flat buffer
+struct iov_iter
+{
+    char* buf;
+    size_t count;
+};
+
+#define iov_iter_count(iter) ((iter) -> count)
+
+static inline size_t copy_to_iter(const void* from, size_t n, struct iov_iter* to)
+{
+    n = min(n, to -> count);
+    memcpy(to -> buf, from, n);
+    to -> buf += n;
+    to -> count -= n;
+    return n;
+}
+
+//================== LOCKING ===========================
+struct mutex
+{
+    pthread_mutex_t m;
+};
+
+#define mutex_init(lock) pthread_mutex_init(&(lock) -> m, NULL)
+#define mutex_lock(lock) pthread_mutex_lock(&(lock) -> m)
+#define mutex_unlock(lock) pthread_mutex_unlock(&(lock) -> m)
+
+struct rcu_head
+{
+    struct rcu_head* next;
+    void (*func)(struct rcu_head*);
+};
+
+#define rcu_read_lock() do { } while (0)
+#define rcu_read_unlock() do { } while (0)
+
+static pthread_mutex_t shim_rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rcu_head* shim_rcu_pending;
+
+static inline void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head*))
+{
+    head -> func = func;
+    pthread_mutex_lock(&shim_rcu_lock);
+    head -> next = shim_rcu_pending;
+    shim_rcu_pending = head;
+    pthread_mutex_unlock(&shim_rcu_lock);
+}
+
+// Runs the deferred callbacks. The caller guarantees no lock-free reader is still running
+static inline void rcu_barrier(void)
+{
+    struct rcu_head* head;
+
+    pthread_mutex_lock(&shim_rcu_lock);
+    head = shim_rcu_pending;
+    shim_rcu_pending = NULL;
+    pthread_mutex_unlock(&shim_rcu_lock);
+    while (head != NULL)
+    {
+        struct rcu_head* next = head -> next;
+        head -> func(head);
+        head = next;
+    }
+}
+
+//================== WAIT-QUEUES ===========================
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int waiters;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t* wq)
+{
+    pthread_mutex_init(&wq -> lock, NULL);
+    pthread_cond_init(&wq -> cond, NULL);
+    wq -> waiters = 0;
+}
+
+/*
+ * Sleeps until 'condition' holds, always returns 0.
+ * The waiter registers before checking, and wakers check for waiters after changing the condition
+ * (both with full barriers), so a wake-up is never missed.
+ */
+#define wait_event_interruptible(wq, condition)                      \
+({                                                                   \
+    pthread_mutex_lock(&(wq).lock);                                  \
+    __atomic_add_fetch(&(wq).waiters, 1, __ATOMIC_SEQ_CST);          \
+    while (!(condition))                                             \
+    {                                                                \
+        pthread_cond_wait(&(wq).cond, &(wq).lock);                   \
+    }                                                                \
+    __atomic_sub_fetch(&(wq).waiters, 1, __ATOMIC_RELAXED);          \
+    pthread_mutex_unlock(&(wq).lock);                                \
+    0;                                                               \
+})
+
+static inline bool waitqueue_active(wait_queue_head_t* wq)
+{
+    return __atomic_load_n(&wq -> waiters, __ATOMIC_RELAXED) > 0;
+}
+
+static inline bool wq_has_sleeper(wait_queue_head_t* wq)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return waitqueue_active(wq);
+}
+
+static inline void wake_up_interruptible_all(wait_queue_head_t* wq)
+{
+    pthread_mutex_lock(&wq -> lock);
+    pthread_cond_broadcast(&wq -> cond);
+    pthread_mutex_unlock(&wq -> lock);
+}
+
+#define wake_up_interruptible_poll(wq, mask) wake_up_interruptible_all(wq)
+
+//================== TIME ===========================
+#define HZ 1000
+
+static inline unsigned long shim_jiffies(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * HZ + ts.tv_nsec / (1000000000 / HZ);
+}
+
+#define jiffies shim_jiffies()
+#define time_after(a, b) ((long) ((b) - (a)) < 0)
+#define time_before(a, b) time_after(b, a)
+
+//================== XARRAY ===========================
+#define XA_CHUNK_SHIFT 6
+#define XA_CHUNK_SIZE (1UL << XA_CHUNK_SHIFT)
+#define XA_CHUNK_MASK (XA_CHUNK_SIZE - 1)
+
+// A node covers 2^(shift + XA_CHUNK_SHIFT) indices, its slots point to child nodes (or entries, when shift is 0)
+struct xa_node
+{
+    unsigned int shift;
+    void* slots[XA_CHUNK_SIZE];
+};
+
+struct xarray
+{
+    pthread_mutex_t lock;
+    struct xa_node* head;
+};
+
+// Errors are returned as tagged (internal) entries, as in the kernel
+#define XA_ERROR(err) ((void*) (((unsigned long) (long) (err) << 2) | 2UL))
+
+static inline bool xa_is_err(const void* entry)
+{
+    return ((unsigned long) entry & 3) == 2 && (unsigned long) entry >= (unsigned long) XA_ERROR(-MAX_ERRNO);
+}
+
+static inline int xa_err(void* entry)
+{
+    return xa_is_err(entry) ? (int) ((long) entry >> 2) : 0;
+}
+
+#define xa_lock(xa) pthread_mutex_lock(&(xa) -> lock)
+#define xa_unlock(xa) pthread_mutex_unlock(&(xa) -> lock)
+
+static inline void xa_init(struct xarray* xa)
+{
+    pthread_mutex_init(&xa -> lock, NULL);
+    xa -> head = NULL;
+}
+
+static inline bool xa_node_covers(const struct xa_node* node, unsigned long index)
+{
+    return ((index >> node -> shift) >> XA_CHUNK_SHIFT) == 0;
+}
+
+// Lock-free
+static inline void* xa_load(struct xarray* xa, unsigned long index)
+{
+    struct xa_node* node = __atomic_load_n(&xa -> head, __ATOMIC_ACQUIRE);
+    void* entry;
+
+    if (node == NULL || !xa_node_covers(node, index))
+    {
+        return NULL;
+    }
+    while (true)
+    {
+        entry = __atomic_load_n(&node -> slots[(index >> node -> shift) & XA_CHUNK_MASK], __ATOMIC_ACQUIRE);
+        if (node -> shift == 0 || entry == NULL)
+        {
+            return entry;
+        }
+        node = (struct xa_node*) entry;
+    }
+}
+
+static inline struct xa_node* xa_node_alloc(unsigned int shift)
+{
+    struct xa_node* node = (struct xa_node*) calloc(1, sizeof(*node));
+    if (node != NULL)
+    {
+        node -> shift = shift;
+    }
+    return node;
+}
+
+// Returns the leaf slot of 'index', creating the path to it if 'create'. Called with the lock held
+static inline void** xa_slot(struct xarray* xa, unsigned long index, bool create)
+{
+    struct xa_node* node = xa -> head;
+    struct xa_node* parent;
+    void** slot;
+
+    if (node == NULL || !xa_node_covers(node, index))
+    {
+        if (!create)
+        {
+            return NULL;
+        }
+        if (node == NULL)
+        {
+            node = xa_node_alloc(0);
+            if (node == NULL)
+            {
+                return NULL;
+            }
+            __atomic_store_n(&xa -> head, node, __ATOMIC_RELEASE);
+        }
+        // Grows the tree upwards, the current tree becoming the first slot of a new root
+        while (!xa_node_covers(node, index))
+        {
+            parent = xa_node_alloc(node -> shift + XA_CHUNK_SHIFT);
+            if (parent == NULL)
+            {
+                return NULL;
+            }
+            parent -> slots[0] = node;
+            __atomic_store_n(&xa -> head, parent, __ATOMIC_RELEASE);
+            node = parent;
+        }
+    }
+    while (node -> shift > 0)
+    {
+        slot = &node -> slots[(index >> node -> shift) & XA_CHUNK_MASK];
+        if (*slot == NULL)
+        {
+            if (!create)
+            {
+                return NULL;
+            }
+            parent = node;
+            node = xa_node_alloc(parent -> shift - XA_CHUNK_SHIFT);
+            if (node == NULL)
+            {
+                return NULL;
+            }
+            __atomic_store_n(slot, node, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            node = (struct xa_node*) *slot;
+        }
+    }
+    return &node -> slots[index & XA_CHUNK_MASK];
+}
+
+// Stores 'entry' at 'index' if the current entry is 'old'. Returns the entry that was there (or an error)
+static inline void* xa_cmpxchg(struct xarray* xa, unsigned long index, void* old, void* entry, gfp_t gfp)
+{
+    void** slot;
+    void* curr = NULL;
+
+    xa_lock(xa);
+    slot = xa_slot(xa, index, entry != NULL);
+    if (slot != NULL)
+    {
+        curr = *slot;
+        if (curr == old)
+        {
+            __atomic_store_n(slot, entry, __ATOMIC_RELEASE);
+        }
+    }
+    else if (entry != NULL)
+    {
+        curr = XA_ERROR(-ENOMEM);
+    }
+    xa_unlock(xa);
+    return curr;
+}
+
+// Called with the lock held
+static inline void* __xa_erase(struct xarray* xa, unsigned long index)
+{
+    void** slot = xa_slot(xa, index, false);
+    void* entry = NULL;
+
+    if (slot != NULL)
+    {
+        entry = *slot;
+        __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+    }
+    return entry;
+}
+
+static inline void* xa_erase(struct xarray* xa, unsigned long index)
+{
+    void* entry;
+
+    xa_lock(xa);
+    entry = __xa_erase(xa, index);
+    xa_unlock(xa);
+    return entry;
+}
+
+// First entry at an index >= 'from' within 'node' (whose first index is 'base'), its index is set to '*index'
+static inline void* xa_node_find(struct xa_node* node, unsigned long base, unsigned long from, unsigned long* index)
+{
+    unsigned long offset = (from > base) ? (from - base) >> node -> shift : 0;
+    unsigned long child_base;
+    void* entry;
+
+    for (; offset < XA_CHUNK_SIZE; offset++)
+    {
+        entry = __atomic_load_n(&node -> slots[offset], __ATOMIC_ACQUIRE);
+        if (entry == NULL)
+        {
+            continue;
+        }
+        child_base = base + (offset << node -> shift);
+        if (node -> shift == 0)
+        {
+            *index = child_base;
+            return entry;
+        }
+        entry = xa_node_find((struct xa_node*) entry, child_base, max(from, child_base), index);
+        if (entry != NULL)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Lock-free
+static inline void* xa_find_from(struct xarray* xa, unsigned long from, unsigned long* index)
+{
+    struct xa_node* node = __atomic_load_n(&xa -> head, __ATOMIC_ACQUIRE);
+
+    if (node == NULL || !xa_node_covers(node, from))
+    {
+        return NULL;
+    }
+    return xa_node_find(node, 0, from, index);
+}
+
+#define xa_for_each(xa, index, entry)                                                  \
+    for ((entry) = xa_find_from((xa), 0, &(index)); (entry) != NULL;                  \
+         (entry) = ((index) == ULONG_MAX) ? NULL : xa_find_from((xa), (index) + 1, &(index)))
+
+static inline void xa_node_free(struct xa_node* node)
+{
+    if (node -> shift > 0)
+    {
+        for (unsigned long i = 0; i < XA_CHUNK_SIZE; i++)
+        {
+            if (node -> slots[i] != NULL)
+            {
+                xa_node_free((struct xa_node*) node -> slots[i]);
+            }
+        }
+    }
+    free(node);
+}
+
+static inline void xa_destroy(struct xarray* xa)
+{
+    if (xa -> head != NULL)
+    {
+        xa_node_free(xa -> head);
+        xa -> head = NULL;
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,143 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM message_slot
+
+#if !defined(MESSAGE_SLOT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define MESSAGE_SLOT_TRACE_H
+
+/*
+ * --- TRACEPOINTS ---
+ * Static tracepoints of the message-slot device, replacing the per-operation printk()s.
+ * They cost (nearly) nothing unless enabled, e.g.:
+ *   $ echo 1 > /sys/kernel/tracing/events/message_slot/enable
+ *   $ cat /sys/kernel/tracing/trace_pipe
+ */
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(msg_slot_open,
+
+    TP_PROTO(int minor, bool minor_init),
+
+    TP_ARGS(minor, minor_init),
+
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(bool, minor_init)
+    ),
+
+    TP_fast_assign(
+        __entry -> minor = minor;
+        __entry -> minor_init = minor_init;
+    ),
+
+    TP_printk("minor=%d%s", __entry -> minor, __entry -> minor_init ? " (initialized)" : "")
+);
+
+TRACE_EVENT(msg_slot_release,
+
+    TP_PROTO(int minor, unsigned int channel_id),
+
+    TP_ARGS(minor, channel_id),
+
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, channel_id)
+    ),
+
+    TP_fast_assign(
+        __entry -> minor = minor;
+        __entry -> channel_id = channel_id;
+    ),
+
+    TP_printk("minor=%d channel=%u", __entry -> minor, __entry -> channel_id)
+);
+
+// A read / write of a message. 'ret' is the message's length, or a negative errno
+DECLARE_EVENT_CLASS(msg_slot_xfer,
+
+    TP_PROTO(int minor, unsigned int channel_id, size_t length, ssize_t ret),
+
+    TP_ARGS(minor, channel_id, length, ret),
+
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, channel_id)
+        __field(size_t, length)
+        __field(ssize_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry -> minor = minor;
+        __entry -> channel_id = channel_id;
+        __entry -> length = length;
+        __entry -> ret = ret;
+    ),
+
+    TP_printk("minor=%d channel=%u length=%zu ret=%zd",
+              __entry -> minor, __entry -> channel_id, __entry -> length, __entry -> ret)
+);
+
+DEFINE_EVENT(msg_slot_xfer, msg_slot_read,
+    TP_PROTO(int minor, unsigned int channel_id, size_t length, ssize_t ret),
+    TP_ARGS(minor, channel_id, length, ret)
+);
+
+DEFINE_EVENT(msg_slot_xfer, msg_slot_write,
+    TP_PROTO(int minor, unsigned int channel_id, size_t length, ssize_t ret),
+    TP_ARGS(minor, channel_id, length, ret)
+);
+
+TRACE_EVENT(msg_slot_ioctl,
+
+    TP_PROTO(int minor, unsigned int cmd, unsigned long param, long ret),
+
+    TP_ARGS(minor, cmd, param, ret),
+
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, cmd)
+        __field(unsigned long, param)
+        __field(long, ret)
+    ),
+
+    TP_fast_assign(
+        __entry -> minor = minor;
+        __entry -> cmd = cmd;
+        __entry -> param = param;
+        __entry -> ret = ret;
+    ),
+
+    TP_printk("minor=%d cmd=%u param=%#lx ret=%ld",
+              __entry -> minor, _IOC_NR(__entry -> cmd), __entry -> param, __entry -> ret)
+);
+
+// An idle channel freed by the reclaimer (see 'idle_reclaim_secs')
+TRACE_EVENT(msg_slot_reclaim,
+
+    TP_PROTO(int minor, unsigned int channel_id, unsigned long mem_bytes),
+
+    TP_ARGS(minor, channel_id, mem_bytes),
+
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, channel_id)
+        __field(unsigned long, mem_bytes)
+    ),
+
+    TP_fast_assign(
+        __entry -> minor = minor;
+        __entry -> channel_id = channel_id;
+        __entry -> mem_bytes = mem_bytes;
+    ),
+
+    TP_printk("minor=%d channel=%u mem_bytes=%lu", __entry -> minor, __entry -> channel_id, __entry -> mem_bytes)
+);
+
+#endif
+
+// The header lives next to message_slot.c rather than in include/trace/events (see the Makefile)
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE message_slot_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close */
+#include <sys/ioctl.h>  /* ioctl */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>       /* clock_gettime */
+#include <liburing.h>
+#include "message_slot.h"
+
+/*
+ * --- MESSAGE SLOT IO_URING BENCHMARK ---
+ * Gets 1 (up to 3) arguments via command-line:
+ * (1) file-path of the dedicated message-slot device
+ * (2) optional - number of channels the messages are spread over (round-robin), defaults to 64
+ * (3) optional - max io_uring queue depth, defaults to 256
+ * Sends (and then receives) small messages over the channels, and reports messages/sec of:
+ *     the sync path - ioctl(MSG_SLOT_CHANNEL) + write() / read(), and a single MSG_SLOT_SEND / MSG_SLOT_RECV
+ *     io_uring - MSG_SLOT_SEND / MSG_SLOT_RECV commands (IORING_OP_URING_CMD), submitted and reaped in batches
+ *     of 1 up to the max queue depth, one io_uring_enter() per batch
+ * Requires liburing, and a kernel of 5.19 or newer.
+ */
+
+#define MSGS 1000000
+#define MSG_LEN 32
+#define FIRST_CHANNEL 0x60000000
+#define DEFAULT_CHANNELS 64
+#define DEFAULT_QUEUE_DEPTH 256
+
+//================== HELPERS ===========================
+static void error_handler(int err_cond, char* msg)
+{
+    if (err_cond)
+    {
+        perror(msg);
+        exit(1);
+    }
+}
+
+// Current monotonic time in nanoseconds
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Fills the SQE with a MSG_SLOT_SEND / MSG_SLOT_RECV command. The request is copied into the SQE itself
+static void prep_xfer(struct io_uring_sqe* sqe, int fd, unsigned int cmd_op, unsigned int channel_id, char* buffer)
+{
+    struct msg_slot_xfer xfer =
+    {
+        .channel_id = channel_id,
+        .length = MSG_LEN,
+        .buffer = (unsigned long) buffer,
+    };
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+    sqe -> cmd_op = cmd_op;
+    memcpy(sqe -> cmd, &xfer, sizeof(xfer));
+}
+
+//================== BENCHMARKS ===========================
+// Sync path, as the demo programs did it: switches the channel, then writes / reads. Returns messages/sec
+static double run_select_rw(int fd, int is_write, char* buffer, unsigned int channels)
+{
+    int ret_val;
+    double start = now_ns();
+
+    for (int i = 0; i < MSGS; i++)
+    {
+        ret_val = ioctl(fd, MSG_SLOT_CHANNEL, FIRST_CHANNEL + i % channels);
+        error_handler(ret_val != SUCCESS, "Error changing channel");
+        ret_val = is_write ? write(fd, buffer, MSG_LEN) : read(fd, buffer, MSG_LEN);
+        error_handler(ret_val != MSG_LEN, is_write ? "Error writing message" : "Error reading message");
+    }
+    return MSGS / ((now_ns() - start) / 1e9);
+}
+
+// Sync path with select-and-transfer ioctls. Returns messages/sec
+static double run_sync_xfer(int fd, unsigned int cmd_op, char* buffer, unsigned int channels)
+{
+    struct msg_slot_xfer xfer = { .length = MSG_LEN, .buffer = (unsigned long) buffer };
+    int ret_val;
+    double start = now_ns();
+
+    for (int i = 0; i < MSGS; i++)
+    {
+        xfer.channel_id = FIRST_CHANNEL + i % channels;
+        ret_val = ioctl(fd, cmd_op, &xfer);
+        error_handler(ret_val != MSG_LEN, "Error in MSG_SLOT_SEND / MSG_SLOT_RECV");
+    }
+    return MSGS / ((now_ns() - start) / 1e9);
+}
+
+/*
+ * io_uring path: each round submits 'depth' commands (each reading into its own buffer)
+ * and waits for all of them, in a single io_uring_enter(). Returns messages/sec
+ */
+static double run_uring(struct io_uring* ring, int fd, unsigned int cmd_op, char* buffers,
+                        unsigned int channels, unsigned int depth)
+{
+    struct io_uring_cqe* cqe;
+    unsigned int head;
+    unsigned int reaped;
+    unsigned int batch;
+    int ret_val;
+    double start = now_ns();
+
+    for (int done = 0; done < MSGS; done += batch)
+    {
+        batch = (MSGS - done < (int) depth) ? MSGS - done : depth;
+        for (unsigned int i = 0; i < batch; i++)
+        {
+            prep_xfer(io_uring_get_sqe(ring), fd, cmd_op, FIRST_CHANNEL + (done + i) % channels,
+                      buffers + i * MSG_LEN);
+        }
+        ret_val = io_uring_submit_and_wait(ring, batch);
+        if (ret_val < 0)
+        {
+            errno = -ret_val;
+            error_handler(1, "Error submitting commands");
+        }
+
+        reaped = 0;
+        io_uring_for_each_cqe(ring, head, cqe)
+        {
+            if (cqe -> res < 0)
+            {
+                // -EOPNOTSUPP: the kernel (or the loaded module) lacks .uring_cmd support
+                errno = -cqe -> res;
+                error_handler(1, "Error in io_uring command");
+            }
+            reaped++;
+        }
+        io_uring_cq_advance(ring, reaped);
+        // Every command completes inline, so the whole batch is already there
+        error_handler(reaped != batch, "Missing completions");
+    }
+    return MSGS / ((now_ns() - start) / 1e9);
+}
+
+//================== MAIN ===========================
+int main(int argc, char * argv[])
+{
+    if(argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <device-path> [channels] [queue-depth]\n", argv[0]);
+        exit(1);
+    }
+    char* f_path = argv[1];
+    unsigned int channels = (argc > 2) ? atoi(argv[2]) : DEFAULT_CHANNELS;
+    unsigned int max_depth = (argc > 3) ? atoi(argv[3]) : DEFAULT_QUEUE_DEPTH;
+    if (channels == 0 || max_depth == 0)
+    {
+        fprintf(stderr, "channels and queue-depth must be positive\n");
+        exit(1);
+    }
+
+    int fd = open(f_path, O_RDWR);
+    error_handler(fd < 0, "Couldn't Open file");
+
+    struct io_uring ring;
+    int ret_val = io_uring_queue_init(max_depth, &ring, 0);
+    if (ret_val < 0)
+    {
+        errno = -ret_val;
+        error_handler(1, "Error setting up io_uring");
+    }
+    char* buffers = malloc((size_t) max_depth * MSG_LEN);
+    error_handler(buffers == NULL, "Error allocating buffers");
+    memset(buffers, 'm', (size_t) max_depth * MSG_LEN);
+
+    printf("%u channels, %d messages of %d bytes\n", channels, MSGS, MSG_LEN);
+    printf("%-28s %14s %14s\n", "path", "send msgs/sec", "recv msgs/sec");
+    // Writing first, so every channel holds a message when it's read
+    double send_rate = run_select_rw(fd, 1, buffers, channels);
+    double recv_rate = run_select_rw(fd, 0, buffers, channels);
+    printf("%-28s %14.0f %14.0f\n", "ioctl + write/read", send_rate, recv_rate);
+
+    send_rate = run_sync_xfer(fd, MSG_SLOT_SEND, buffers, channels);
+    recv_rate = run_sync_xfer(fd, MSG_SLOT_RECV, buffers, channels);
+    printf("%-28s %14.0f %14.0f\n", "ioctl SEND/RECV", send_rate, recv_rate);
+
+    for (unsigned int depth = 1; depth <= max_depth; depth *= 4)
+    {
+        send_rate = run_uring(&ring, fd, MSG_SLOT_SEND, buffers, channels, depth);
+        recv_rate = run_uring(&ring, fd, MSG_SLOT_RECV, buffers, channels, depth);
+        char title[32];
+        snprintf(title, sizeof(title), "io_uring depth %u", depth);
+        printf("%-28s %14.0f %14.0f\n", title, send_rate, recv_rate);
+    }
+
+    free(buffers);
+    io_uring_queue_exit(&ring);
+    close(fd);
+    return SUCCESS;
+}
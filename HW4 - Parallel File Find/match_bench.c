@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include "pfind_match.h"
+
+/*
+ * --- NAME MATCHING BENCHMARK ---
+ * Throughput of pfind's name matching engine (pfind_match.h) on a synthetic stream of file names, so no
+ * directory tree / disk is involved. For each pattern set, reports names/sec and MB/sec of the compiled
+ * matcher, and of the naive approach: checking every pattern in turn (strstr() / fnmatch() / regexec()), as pfind
+ * did with its single term.
+ * Literal sets are also run as a content search would: matcher_find() over the names as lines of one buffer
+ * (reported as engine "buffer", names/sec being lines/sec).
+ * Usage: ./match_bench [names-count]
+ * Build: gcc -O3 -Wall -std=c11 match_bench.c -o match_bench
+ */
+
+#define DEFAULT_NAMES 1000000
+#define MAX_NAME_LEN 40
+#define ROUNDS 5
+
+//================== HELPERS ===========================
+static void error_handler(int err_cond, char* msg)
+{
+    if (err_cond)
+    {
+        fprintf(stderr, "%s\n", msg);
+        exit(1);
+    }
+}
+
+// Current monotonic time in nanoseconds
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift PRNG
+static unsigned int next_rand(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+//================== NAMES ===========================
+// Pieces names are made of, roughly as in a source / home tree
+static const char* stems[] = { "main", "util", "test", "config", "index", "readme", "Makefile", "report",
+                               "image", "data", "backup", "notes", "build", "module", "parser", "lib" };
+static const char* exts[] = { ".c", ".h", ".txt", ".o", ".py", ".json", ".pdf", ".jpg", "", ".md", ".log", ".so" };
+
+/*
+ * Generates 'count' names (stem, optional separator and random letters / digits, extension), stored back to back
+ * (NUL-terminated) in a single buffer. Sets '*bytes' to the names' total length
+ */
+static char** gen_names(size_t count, size_t* bytes)
+{
+    unsigned int seed = 0x9e3779b9;
+    char** names = malloc(count * sizeof(char*));
+    char* pool = malloc(count * (MAX_NAME_LEN + 1));
+    error_handler(names == NULL || pool == NULL, "Error allocating names");
+
+    *bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        char* name = pool + i * (MAX_NAME_LEN + 1);
+        int len = snprintf(name, MAX_NAME_LEN + 1, "%s", stems[next_rand(&seed) % 16]);
+        int extra = next_rand(&seed) % 12;
+        if (extra > 0)
+        {
+            name[len++] = (next_rand(&seed) & 1) ? '_' : '-';
+        }
+        for (int j = 0; j < extra; j++)
+        {
+            unsigned int r = next_rand(&seed) % 36;
+            name[len++] = r < 26 ? 'a' + r : '0' + r - 26;
+        }
+        len += snprintf(name + len, MAX_NAME_LEN + 1 - len, "%s", exts[next_rand(&seed) % 12]);
+        names[i] = name;
+        *bytes += len;
+    }
+    return names;
+}
+
+//================== BENCHMARKS ===========================
+typedef struct pattern_set_st
+{
+    const char* label;
+    int kind;
+    int flags;
+    // Literal sets are generated: 'count' random 6-letter terms, plus 'terms' (NULL-terminated)
+    int count;
+    const char* terms[4];
+} pattern_set_t;
+
+/*
+ * Runs 'count' names through the matcher ROUNDS times, returns the best time per round (ns), and sets '*found'
+ * to the number of matching names
+ */
+static double run_matcher(const matcher_t* matcher, char** names, size_t count, size_t* found)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        size_t matches = 0;
+        double start = now_ns();
+        for (size_t i = 0; i < count; i++)
+        {
+            matches += matcher_match(matcher, names[i]);
+        }
+        double elapsed = now_ns() - start;
+        if (round == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+        *found = matches;
+    }
+    return best;
+}
+
+/*
+ * Same, checking every pattern in turn: strstr() / strcasestr() for literals, fnmatch() for globs and regexec() for
+ * regexes ('regexes' compiled beforehand), i.e. without the automaton or prefilters
+ */
+static double run_naive(const pattern_set_t* set, char** literals, regex_t* regexes, int literals_count, char** names,
+                        size_t count, size_t* found)
+{
+    int casefold = set->flags & MATCH_CASEFOLD;
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        size_t matches = 0;
+        double start = now_ns();
+        for (size_t i = 0; i < count; i++)
+        {
+            for (int j = 0; j < literals_count; j++)
+            {
+                int match;
+                if (set->kind == MATCH_GLOB)
+                {
+                    match = fnmatch(literals[j], names[i], 0) == 0;
+                }
+                else if (set->kind == MATCH_REGEX)
+                {
+                    match = regexec(&regexes[j], names[i], 0, NULL, 0) == 0;
+                }
+                else
+                {
+                    match = (casefold ? strcasestr(names[i], literals[j]) : strstr(names[i], literals[j])) != NULL;
+                }
+                if (match)
+                {
+                    matches++;
+                    break;
+                }
+            }
+        }
+        double elapsed = now_ns() - start;
+        if (round == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+        *found = matches;
+    }
+    return best;
+}
+
+/*
+ * Scans the names as '\n'-separated lines of 'text' ('len' bytes) with matcher_find(), ROUNDS times, returns the best
+ * time per round (ns), and sets '*found' to the number of matching lines
+ */
+static double run_find(const matcher_t* matcher, const char* text, size_t len, size_t* found)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        size_t matches = 0;
+        double start = now_ns();
+        for (size_t pos = 0; pos < len;)
+        {
+            long hit = matcher_find(matcher, text + pos, len - pos);
+            if (hit < 0)
+            {
+                break;
+            }
+            matches++;
+            const char* end = memchr(text + pos + hit, '\n', len - pos - hit);
+            pos = (NULL != end) ? (size_t) (end - text) + 1 : len;
+        }
+        double elapsed = now_ns() - start;
+        if (round == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+        *found = matches;
+    }
+    return best;
+}
+
+static void print_row(const char* label, const char* engine, double ns, size_t count, size_t bytes, size_t found)
+{
+    printf("%-22s %-8s %14.1f %10.1f %10zu\n", label, engine, count / (ns / 1e9) / 1e6, bytes / (ns / 1e9) / 1e6,
+           found);
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_NAMES;
+    error_handler(count == 0, "Usage: ./match_bench [names-count]");
+    size_t bytes;
+    char** names = gen_names(count, &bytes);
+    // The names as lines of a text
+    char* text = malloc(bytes + count);
+    error_handler(text == NULL, "Error allocating text");
+    size_t text_len = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t len = strlen(names[i]);
+        memcpy(text + text_len, names[i], len);
+        text[text_len + len] = '\n';
+        text_len += len + 1;
+    }
+
+    pattern_set_t sets[] = {
+        { "1 literal", MATCH_LITERAL, 0, 0, { "report", NULL } },
+        { "10 literals", MATCH_LITERAL, 0, 8, { "report", "notes", NULL } },
+        { "50 literals", MATCH_LITERAL, 0, 48, { "report", "notes", NULL } },
+        { "10 literals, -i", MATCH_LITERAL, MATCH_CASEFOLD, 8, { "REPORT", "Notes", NULL } },
+        { "3 globs", MATCH_GLOB, 0, 0, { "*.pdf", "test_*.c", "lib*.so", NULL } },
+        { "2 regexes", MATCH_REGEX, 0, 0, { "^backup-[0-9a-z]+\\.log$", "^image.*[0-9]\\.jpg$", NULL } },
+    };
+
+    printf("%zu names, %.1f MB\n", count, bytes / 1e6);
+    printf("%-22s %-8s %14s %10s %10s\n", "patterns", "engine", "M names/sec", "MB/sec", "matches");
+    unsigned int seed = 0x2545f491;
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        pattern_set_t* set = &sets[s];
+        char* literals[64];
+        int literals_count = 0;
+        for (int i = 0; i < set->count; i++)
+        {
+            literals[literals_count] = malloc(7);
+            error_handler(literals[literals_count] == NULL, "Error allocating literal");
+            for (int j = 0; j < 6; j++)
+            {
+                literals[literals_count][j] = 'a' + next_rand(&seed) % 26;
+            }
+            literals[literals_count++][6] = '\0';
+        }
+        for (int i = 0; set->terms[i] != NULL; i++)
+        {
+            literals[literals_count++] = strdup(set->terms[i]);
+        }
+
+        matcher_t matcher;
+        char err_buf[128];
+        matcher_init(&matcher);
+        for (int i = 0; i < literals_count; i++)
+        {
+            error_handler(matcher_add(&matcher, set->kind, literals[i]) != 0, "Error adding pattern");
+        }
+        error_handler(matcher_compile(&matcher, set->flags, err_buf, sizeof(err_buf)) != 0, "Error compiling patterns");
+
+        size_t found;
+        double ns = run_matcher(&matcher, names, count, &found);
+        print_row(set->label, "matcher", ns, count, bytes, found);
+        regex_t regexes[64];
+        for (int i = 0; set->kind == MATCH_REGEX && i < literals_count; i++)
+        {
+            error_handler(regcomp(&regexes[i], literals[i], REG_EXTENDED | REG_NOSUB) != 0, "Error compiling regex");
+        }
+        ns = run_naive(set, literals, regexes, literals_count, names, count, &found);
+        print_row(set->label, "naive", ns, count, bytes, found);
+        if (set->kind == MATCH_LITERAL)
+        {
+            ns = run_find(&matcher, text, text_len, &found);
+            print_row(set->label, "buffer", ns, count, text_len, found);
+        }
+        for (int i = 0; set->kind == MATCH_REGEX && i < literals_count; i++)
+        {
+            regfree(&regexes[i]);
+        }
+
+        matcher_destroy(&matcher);
+        for (int i = 0; i < literals_count; i++)
+        {
+            free(literals[i]);
+        }
+    }
+
+    free(text);
+    free(names[0]);
+    free(names);
+    return 0;
+}
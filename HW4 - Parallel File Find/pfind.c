@@ -1,251 +1,2852 @@
+#define _GNU_SOURCE
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <linux/io_uring.h>
+#include "pfind_match.h"
+#include "pfind_index.h"
+#include "pfind_hash.h"
 #include <errno.h>
+#include <getopt.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 
 
 //============= Macros ====================
 #define SUCCESS 0 // must be 0, as defined by linux functions
 #define MAIN_THREAD_ERR_EXIT_CODE 1 // exit code from the main thread in case of main-thread-errors
+#define DEQUE_INIT_SIZE 64 // initial capacity of a thread's deque (a power of 2), grows when full
+#define STEAL_ROUNDS 4 // rounds over all the other threads' deques an idle thread tries stealing, before sleeping
+#define CACHE_LINE 64
+#define DIRENTS_BUF_SIZE (32 * 1024) // bytes of directory entries read per getdents64()
+#define URING_DEPTH 64 // submission entries of a thread's io_uring, i.e. max requests in flight per thread
+#define URING_DIR_BATCH 16 // directories a thread opens at once with io_uring
+#define ARENA_CHUNK_SIZE (64 * 1024) // bytes per chunk of a thread's name-nodes arena (chunks are aligned to it)
+#define OUT_BUF_SIZE (64 * 1024) // bytes of output a thread gathers before writing them at once (holds any line)
+#define CONTENT_PREAD_MAX (256 * 1024) // -s: files up to this size are read with a single pread(), bigger ones in windows
+#define CONTENT_BINARY_PROBE (32 * 1024) // -s: a file with a '\0' among its first bytes is binary, so isn't scanned
+#define PREDS_MAX 16 // metadata predicates per run
+#define DUPE_PARTIAL 4096 // -D: bytes first hashed at each end of a file (files up to twice that are hashed whole)
+#define DUPE_BATCH 16 // -D: files a hashing thread claims at once
+
+// -D: hashing phases, see dedupe_run
+#define DUPE_PHASE_PARTIAL 0
+#define DUPE_PHASE_FULL 1
+
+// Metadata predicates (find-style options), each compares a field of the entries to a value
+#define PRED_SIZE 0 // -size [+-]N[cwbkMG]: in units (512-byte blocks by default), rounded up
+#define PRED_MTIME 1 // -mtime [+-]N: days since last modified, rounded down
+#define PRED_UID 2 // -uid [+-]N
+#define PRED_NEWER 3 // -newer <file>: modified after the file was
+#define PRED_TYPE 4 // -type <c>[,<c>...]: of any of the types (f, d, l, p, s, c, b), checked with 'pred_types'
+// getopt's value of the predicates' options: OPT_PRED + PRED_*
+#define OPT_PRED 256
+
+// What a run does
+#define MODE_SEARCH 0 // searches the tree
+#define MODE_BUILD 1 // -b: builds (or refreshes) an index of the tree, see pfind_index.h
+#define MODE_QUERY 2 // -q: searches an index instead of the tree
+#define MODE_DAEMON 3 // -d: indexes the tree, keeps the index current, and answers queries over a Unix socket
+#define MODE_CLIENT 4 // -c: queries a daemon
+
+// Search engines: how a thread opens its directories and stats their untyped entries
+#define ENGINE_AUTO 0 // io_uring if the kernel supports it, sync otherwise
+#define ENGINE_SYNC 1 // one syscall at a time
+#define ENGINE_URING 2 // batches of requests in flight through a per-thread io_uring
 
 //============= Global Variables ====================
 
-pthread_mutex_t qLock;
-// Condition Variables: (q for Queue, f for Flag)
-// Signals the queue is not empty
-pthread_cond_t qNotEmpty;
-// Signals all the threads were created (will be trigger all thread to start searching)
-pthread_cond_t fAllThreadsCreated;
-// Signals a creation of a thread
-pthread_cond_t fThreadWasCreated;
+// Guards 'active_count' and 'thread_encountered_err_flag'
+pthread_mutex_t qLock;
+// Serializes the threads' output flushes, so lines of different threads never interleave (e.g. in a pipe)
+pthread_mutex_t outLock;
+// Condition Variables: (f for Flag)
+// Signals all the threads were created (will be trigger all thread to start searching)
+pthread_cond_t fAllThreadsCreated;
+// Signals a creation of a thread
+pthread_cond_t fThreadWasCreated;
+
+// Idle threads sleep on 'fWorkAvailable' (with 'idleLock'), until work is pushed or the search is over
+pthread_mutex_t idleLock;
+pthread_cond_t fWorkAvailable;
+// Amount of threads sleeping on 'fWorkAvailable', so pushers only signal when someone sleeps
+atomic_int sleeping_count = 0;
+
+// Patterns the file names are matched against: the search term received as argument, and those of the options
+matcher_t matcher;
+
+// -s: patterns the matching files' contents are scanned for (literals only), 1 IFF there are such patterns
+matcher_t content_matcher;
+int content_search = 0;
+
+// find-style predicates matching entries must satisfy too (besides their name)
+typedef struct pred_st
+{
+    int field; // PRED_*
+    int cmp; // -1: the field must be less than 'value', 0: equal to it, 1: greater than it
+    int64_t value;
+    uint64_t unit; // PRED_SIZE: bytes per unit
+} pred_t;
+pred_t preds[PREDS_MAX];
+int preds_count = 0;
+// statx() fields the predicates (and -D) need (0 if d_type is enough)
+unsigned int preds_mask = 0;
+// Types a matching entry may be of, a bit per DT_* type: anything but directories (which are only searched),
+// unless -type says otherwise
+unsigned int pred_types = ~(1u << DT_DIR);
+// Time the run started, for PRED_MTIME
+int64_t preds_now;
+
+// -D: 1 IFF the run looks for duplicate files (among those matching)
+int dedupe = 0;
+
+// Amount of searching threads created
+int threads_count;
+
+// Amount of threads that are currently active (= didn't exit for an error / finished)
+int active_count = 0;
+// Amount of files matching the search term found on the run (summed from the threads' counts once they exit)
+long found_count = 0;
+
+// Ends each printed path: '\n', or '\0' with -0 (for xargs -0)
+char out_terminator = '\n';
+
+int mode = MODE_SEARCH;
+// The index file read: searched by MODE_QUERY, refreshed by MODE_BUILD (if it indexes the same root)
+index_t stored_index;
+// MODE_BUILD / MODE_DAEMON: amount of ids given to directories so far, i.e. the next directory's id (the root's is 0)
+atomic_uint index_dirs_count = 1;
+
+// Amount of directories pushed and not yet fully searched. The search is over when it drops to 0
+atomic_long pending_count = 0;
+
+// 1 IFF some searching-thread has encountered an error while running
+int thread_encountered_err_flag = 0;
+
+// Engine the searching threads use (ENGINE_SYNC / ENGINE_URING, resolved by main)
+int engine = ENGINE_AUTO;
+
+/*
+ * * Name-Node Explained: *
+ * A directory to search is kept as its own name (the root: its whole path) and a pointer to its parent's node,
+ * instead of its full path. A node holds a reference on its parent, so the ancestors of every queued directory
+ * stay alive (and its path can be rebuilt, see node_path) until it's searched. 'refs' counts the node's own
+ * reference (dropped once it's searched) plus one per child node.
+ * Nodes are bump-allocated from 'ARENA_CHUNK_SIZE' chunks of the creating thread's arena. A chunk counts its live
+ * nodes (plus one while its thread still allocates from it), and is freed (by whichever thread) when none is left.
+ */
+typedef struct name_node_st
+{
+    struct name_node_st* parent;
+    atomic_int refs;
+    unsigned short len; // of 'name'
+    // MODE_BUILD / MODE_DAEMON: the directory's id in the index being built, and in the stored index (or INDEX_NONE)
+    uint32_t dir_id;
+    uint32_t old_id;
+    char name[];
+} name_node_t;
+
+typedef struct arena_chunk_st
+{
+    atomic_long live;
+    size_t used; // bytes, including this header. Written by the owner thread only
+    _Alignas(8) char data[];
+} arena_chunk_t;
+
+/*
+ * * Work-Stealing Deque Explained: *
+ * Each searching thread has its own deque of directories (Chase-Lev): it pushes the subdirectories it finds
+ * and pops them from the bottom (LIFO, so it keeps working in a subtree it has just read), while idle threads
+ * steal from the top (FIFO, i.e. the oldest and usually biggest subtrees). The owner's push / pop take no lock,
+ * only popping the last element races with stealers (settled by a CAS on 'top'), as does each steal.
+ * Elements are kept in buf[i % size] for i in [top, bottom). When full, the owner moves them into an array twice
+ * the size. Stealers may still be reading the old array, so replaced arrays are only freed when the search is over.
+ */
+typedef struct deque_array_st
+{
+    long size;
+    struct deque_array_st* retired; // the array this one replaced
+    _Atomic(name_node_t*) buf[];
+} deque_array_t;
+
+typedef struct deque_st
+{
+    // 'top' is written by stealers, 'bottom' by the owner only, so each gets its own cache line
+    _Alignas(CACHE_LINE) atomic_long top;
+    _Alignas(CACHE_LINE) atomic_long bottom;
+    _Atomic(deque_array_t*) array;
+} deque_t;
+
+/*
+ * * IO-Uring Explained: *
+ * Rings shared with the kernel, set up with raw syscalls (so no liburing is needed): the thread fills SQEs
+ * (requests) and moves the SQ tail, one io_uring_enter() submits them all and waits for their CQEs (results).
+ * Requests that would block (e.g. a path lookup missing the dentry cache) are completed by kernel workers,
+ * so all the requests of a batch wait for the device concurrently, instead of one after the other.
+ */
+typedef struct uring_st
+{
+    int fd;
+    // Submission queue ring (indices into 'sqes')
+    _Atomic unsigned int* sq_head;
+    _Atomic unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    struct io_uring_sqe* sqes;
+    // Completion queue ring
+    _Atomic unsigned int* cq_head;
+    _Atomic unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    // Mappings, for unmapping them
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+    // SQEs filled since the last submission
+    unsigned int to_submit;
+} uring_t;
+
+// Searching thread's own state. Aligned so threads never share a cache line
+typedef struct worker_st
+{
+    _Alignas(CACHE_LINE) deque_t deque;
+    uring_t ring; // used by ENGINE_URING only
+    arena_chunk_t* chunk; // current chunk of the thread's name-nodes arena
+    unsigned int rand_state; // picks steal victims
+    int id;
+    // Output of the thread, written once full (or once the thread exited), and its own count of matching files
+    char* out_buf;
+    size_t out_len;
+    long found_count;
+    // -s: the file being scanned (a window of it for big files), -D: the file being hashed. 'content_cap' bytes,
+    // CONTENT_PREAD_MAX unless -s grew it for a longer line
+    char* content_buf;
+    size_t content_cap;
+    // -D: the candidate files the thread found (dupe_file_t), and their paths
+    index_buf_t dupes;
+    index_buf_t dupe_paths;
+    // MODE_BUILD / MODE_DAEMON: entries of the directories the thread indexed, their records (index_built_t),
+    // and the entries of the directory being read (names, and scratch_entry_t)
+    index_buf_t index_entries;
+    index_buf_t index_dirs;
+    index_buf_t scratch_names;
+    index_buf_t scratch_entries;
+    long reread_count; // directories read (i.e. not copied from the stored index)
+} worker_t;
+
+// Workers of the searching threads, indexed by thread number
+worker_t* workers;
+
+// A query of an index: its patterns, and where it prints
+typedef struct query_st
+{
+    const matcher_t* matcher;
+    FILE* out; // matching paths (and messages, unless 'terminator' is '\0')
+    FILE* err; // messages, with -0
+    char terminator;
+    // The error (an errno) the query stopped at, and the operation it's about (SUCCESS and NULL if none)
+    int error;
+    char* error_msg;
+} query_t;
+
+// MODE_DAEMON: directory of the live index (see the daemon's functions). Its entries are encoded as in an index file
+typedef struct live_dir_st
+{
+    index_buf_t entries;
+    uint32_t entries_count;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    char* path; // NULL for a free slot
+    int wd; // its inotify watch, or -1
+    int dirty; // 1 IFF it's queued for being read again
+} live_dir_t;
+
+// MODE_DAEMON: the live index's directories by id (the root's is 0), 'live_count' slots in all
+live_dir_t* live_dirs;
+uint32_t live_count = 0;
+
+// -D: a candidate file (regular, not empty)
+typedef struct dupe_file_st
+{
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t partial; // hash of its first and last DUPE_PARTIAL bytes (of all of it, for small files)
+    uint64_t full; // hash of all of it
+    size_t path_offset; // into its thread's 'dupe_paths'
+    const char* path; // once the search is over
+    int todo; // 1 IFF it's hashed in the current phase (for itself and its hardlinks, see dedupe_mark)
+    int failed; // 1 IFF it couldn't be read
+} dupe_file_t;
+
+// -D: the candidates of all the threads (once the search is over), and the next one a hashing thread claims
+dupe_file_t* dupe_files;
+size_t dupe_count = 0;
+atomic_size_t dupe_next;
+int dupe_phase;
+
+// Result of steal(), when it lost a race for the element (so the deque may still hold others)
+#define STEAL_ABORT ((name_node_t*) -1)
+
+// Directory entry, as returned by getdents64() (not exposed by all libc versions)
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+//=========== Functions Declarations =======================
+/*
+ * --- Search Queue ---
+ * Function to be run by the search-threads.
+ * Dequeues a directory from the queue as long as the queue is not completely exhausted.
+ * Matches each file's name against the patterns and counts the matches (with -s, scans the matching files' contents).
+ */
+_Noreturn void* search_queue(void*);
+/*
+ *  --- ENQUEUE ---
+ * Gets a directory's 'node', and pushes it to the bottom of the worker's deque, waking a sleeping thread if any.
+ * returns some ERRNO on errors, otherwise SUCCESS
+ * * The node's own reference passes to the queue, and then to whoever dequeues it
+ */
+int enqueue(worker_t*, name_node_t*);
+
+/*
+ * --- DEQUEUE ---
+ * Pops a node from the worker's own deque, or steals one from another thread's deque when it's empty,
+ * sleeping while no work is available. Once every directory was searched, exits the thread.
+ * Dropping the returned node (node_put) is *caller* responsibility
+ */
+name_node_t* dequeue(worker_t*);
+
+/*
+ * Marks a directory dequeued by the thread as searched (i.e. its subdirectories were all enqueued).
+ * The thread searching the last directory wakes everyone up, to exit.
+ */
+void dir_done(void);
+
+/*
+ * --- Index ---
+ * index_queue() is run by the threads instead of searching in MODE_BUILD: indexes every directory it dequeues,
+ * until the whole tree was (and exits the thread, as dequeue() does).
+ * query_dir() prints the matching files of the directory 'dir_id' and its subdirectories, of the stored index
+ * (or of the live one, in MODE_DAEMON), and returns their count. 'path' (of PATH_MAX bytes) starts with the
+ * directory's path, of 'path_len' bytes. It stops at an error (a corrupt index, a path too long), and records it in
+ * the query rather than exiting, as the daemon must outlive a bad query.
+ */
+_Noreturn void index_queue(worker_t*);
+long query_dir(query_t*, uint32_t, char*, size_t);
+
+/*
+ * --- Daemon ---
+ * daemon_run() turns the directories indexed by the threads into the live index, and keeps it current while serving
+ * queries on the Unix socket at the given path, until SIGINT / SIGTERM.
+ * daemon_query() sends a query (the matching options, see daemon_serve) to the daemon at the given socket, and prints
+ * its reply. Both exit the process.
+ */
+_Noreturn void daemon_run(const char*, const char*);
+_Noreturn void daemon_query(const char*, index_buf_t*);
+
+/*
+ * --- Predicates ---
+ * pred_parse() adds the predicate of the given field (PRED_*), parsed from its option's argument, returns SUCCESS or
+ * EINVAL (some ERRNO for -newer, whose file is stat-ed).
+ * preds_match() returns 1 IFF the entry 'name' of the directory 'dir_fd', of the given type (DT_*), satisfies all the
+ * predicates. 'stx' (NULL if there's none) may hold its metadata already, otherwise it's looked up if needed.
+ */
+int pred_parse(int, const char*);
+int preds_match(int, const char*, unsigned char, const struct statx*);
+
+/*
+ * --- Content Search ---
+ * grep_file() scans the file 'name' of the directory 'dir_fd' (whose path is 'dir_path') for the content patterns,
+ * and prints each line holding any of them, with its number. Returns the count of such lines (0 for binary files,
+ * and for files that can't be read).
+ */
+long grep_file(worker_t*, int, const char*, const char*);
+
+/*
+ * --- Dedupe ---
+ * dedupe_add() records the file 'name' of the directory path 'dir_path' as a candidate, with its size and inode
+ * from 'stx'.
+ * dedupe_run() finds the duplicates among the candidates of all the threads ('threads' are for hashing them), and
+ * prints them in sets, along with the amount of bytes removing them would reclaim.
+ */
+void dedupe_add(worker_t*, const char*, const char*, const struct statx*);
+void dedupe_run(pthread_t*);
+
+/*
+ * --- Output ---
+ * out_write() appends 'len' bytes to the worker's buffer, flushing it first if they don't fit.
+ * out_path() appends '<dir_path>/<name>' and the terminator of the output mode, the same way.
+ * out_record() appends 'prefix' ('prefix_len' bytes), 'len' bytes of data and '\n' the same way, as one piece even
+ * when they don't fit in the buffer at all.
+ * out_flush() writes the buffer to stdout at once, returns SUCCESS or some ERRNO.
+ */
+void out_write(worker_t*, const char*, size_t);
+void out_path(worker_t*, const char*, const char*);
+void out_record(worker_t*, const char*, size_t, const char*, size_t);
+int out_flush(worker_t*);
+
+/*
+ * --- Search Directory ---
+ * Reads all the entries of the (open) directory 'dir_fd', whose node is 'dir_node' and path is 'dir_path':
+ * enqueues its searchable subdirectories, and counts (and prints) its files matching the patterns.
+ * Untyped entries are stat-ed one by one (ENGINE_SYNC) or in batches through the worker's ring (ENGINE_URING).
+ */
+void search_dir(worker_t*, int, name_node_t*, char*);
+
+/*
+ * --- Name Nodes ---
+ * node_new() allocates a node from the worker's arena, holding a reference on 'parent' (if any). NULL on failure.
+ * node_put() drops a reference, freeing the node (and then dropping its parent's) when it was the last.
+ * node_path() writes the node's full path into 'buf' (of PATH_MAX bytes), returns its length or -1 if too long.
+ */
+name_node_t* node_new(worker_t*, name_node_t*, const char*, size_t);
+void node_put(name_node_t*);
+long node_path(name_node_t*, char*);
+
+/*
+ * --- IO-Uring Operations ---
+ * uring_init() sets up a ring of the given depth, returns SUCCESS or some ERRNO.
+ * uring_get_sqe() returns a zeroed SQE to fill (at most 'depth' between submissions).
+ * uring_submit_and_wait() submits the filled SQEs and waits for 'wait_nr' completions, returns SUCCESS or some ERRNO.
+ * uring_reap() moves the next CQE into 'cqe', returns 0 if there's none.
+ * uring_supported() returns 1 IFF the kernel supports the requests the search makes (openat, statx).
+ */
+int uring_init(uring_t*, unsigned int);
+struct io_uring_sqe* uring_get_sqe(uring_t*);
+int uring_submit_and_wait(uring_t*, unsigned int);
+int uring_reap(uring_t*, struct io_uring_cqe*);
+void uring_destroy(uring_t*);
+int uring_supported(void);
+
+/*
+ * --- Deque Operations ---
+ * push() / take() are called by the deque's owner only, steal() by any thread.
+ * take() / steal() return NULL when the deque is empty (steal() may also return STEAL_ABORT, see above)
+ */
+int deque_init(deque_t*);
+int deque_push(deque_t*, name_node_t*);
+name_node_t* deque_take(deque_t*);
+name_node_t* deque_steal(deque_t*);
+void deque_destroy(deque_t*);
+/*
+ * return SUCCESS IFF given dir-path is searchable
+ * The path is relative to the directory 'dir_fd' (or to the working directory, for AT_FDCWD)
+ */
+int is_searchable(int, char*);
+/*
+ * --- Error Handling ---
+ * @param err_cond: should be some defined err_no, or just a boolean condition that
+ *                  hold IFF error has occurred.
+ * @return: if (err_cond is non-zero) prints 'msg' to stderr with its strerror
+ *          performs exit, with exit code 1
+ */
+void error_handler_main(int, char*);
+
+/*
+ * Same as 'error_handler', but performs *thread* exit instead
+ */
+void error_handler_search_thread(int, char*);
+
+// Amount of directories the thread has dequeued, and didn't finish searching yet (see dir_done)
+_Thread_local int holding_dir = 0;
+
+//============ Threads Search and Enqueueing Main Function =======================
+_Noreturn void* search_queue(void* arg)
+{
+    worker_t* worker = (worker_t*) arg;
+    int ret_val;
+
+    // Waits for all threads to be created:
+    pthread_mutex_lock(&qLock);
+    active_count++;
+    pthread_cond_signal(&fThreadWasCreated);
+    pthread_cond_wait(&fAllThreadsCreated, &qLock);
+    pthread_mutex_unlock(&qLock);
+
+    if (mode == MODE_BUILD || mode == MODE_DAEMON)
+    {
+        index_queue(worker);
+    }
+
+    if (engine == ENGINE_URING)
+    {
+        ret_val = uring_init(&worker->ring, URING_DEPTH);
+        error_handler_search_thread(ret_val, "uring_init()");
+    }
+
+    while(1)
+    {
+        name_node_t* curr_nodes[URING_DIR_BATCH];
+        // Paths are only materialized (on the stack) to open the directories, and to print matches in them
+        char curr_paths[URING_DIR_BATCH][PATH_MAX];
+        int dir_fds[URING_DIR_BATCH];
+        int dirs_count = 1;
+
+        curr_nodes[0] = dequeue(worker);
+        error_handler_search_thread(NULL == curr_nodes[0], "Got NULL pointer from dequeue()");
+        if (engine == ENGINE_URING)
+        {
+            // Takes more directories from its own deque, to open them all at once
+            while (dirs_count < URING_DIR_BATCH && NULL != (curr_nodes[dirs_count] = deque_take(&worker->deque)))
+            {
+                holding_dir++;
+                dirs_count++;
+            }
+        }
+        for (int i = 0; i < dirs_count; ++i)
+        {
+            error_handler_search_thread(node_path(curr_nodes[i], curr_paths[i]) < 0 ? ENAMETOOLONG : SUCCESS,
+                                        "path length");
+        }
+
+        if (engine == ENGINE_SYNC)
+        {
+            // The directory is resolved by path once, its entries are then looked up relative to its fd
+            dir_fds[0] = open(curr_paths[0], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            // error in open() shouldn't happen, as far as permissions
+            error_handler_search_thread(dir_fds[0] < 0 ? -1 : SUCCESS, "open()");
+        }
+        else
+        {
+            for (int i = 0; i < dirs_count; ++i)
+            {
+                struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (unsigned long) curr_paths[i];
+                sqe->open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+                sqe->user_data = i;
+            }
+            ret_val = uring_submit_and_wait(&worker->ring, dirs_count);
+            error_handler_search_thread(ret_val, "io_uring_enter()");
+            struct io_uring_cqe cqe;
+            for (int i = 0; i < dirs_count; ++i)
+            {
+                error_handler_search_thread(!uring_reap(&worker->ring, &cqe) ? EIO : SUCCESS, "missing completion");
+                dir_fds[cqe.user_data] = cqe.res;
+            }
+        }
+
+        for (int i = 0; i < dirs_count; ++i)
+        {
+            // error in openat shouldn't happen, as far as permissions
+            if (dir_fds[i] < 0)
+            {
+                // The thread exits, skipping only this directory (as the sync engine would): the rest of the batch
+                // is queued back first, for the other threads to search
+                for (int j = i + 1; j < dirs_count; ++j)
+                {
+                    if (dir_fds[j] >= 0)
+                    {
+                        close(dir_fds[j]);
+                    }
+                    if (enqueue(worker, curr_nodes[j]) == SUCCESS)
+                    {
+                        dir_done();
+                    }
+                    else
+                    {
+                        node_put(curr_nodes[j]);
+                    }
+                }
+                node_put(curr_nodes[i]);
+                error_handler_search_thread(-dir_fds[i], "openat()");
+            }
+            search_dir(worker, dir_fds[i], curr_nodes[i], curr_paths[i]);
+            node_put(curr_nodes[i]);
+            close(dir_fds[i]);
+            dir_done();
+        }
+    }
+
+}
+
+/*
+ * Handles an entry of the directory 'dir_fd' (whose node is 'dir_node' and path is 'dir_path') of the given type:
+ * enqueues a searchable subdirectory, counts (and prints) a matching file.
+ * 'stx' holds the entry's metadata if it was stat-ed already (NULL otherwise)
+ */
+static void search_entry(worker_t* worker, int dir_fd, name_node_t* dir_node, char* dir_path, char* entry_name,
+                         unsigned char type, const struct statx* stx)
+{
+    int ret_val;
+
+    // CASE ENQUEUE : entry is a directory
+    if (type == DT_DIR)
+    {
+        // -type d: directories are also matches (though not scanned with -s, nor compared with -D)
+        if ((pred_types & (1u << DT_DIR)) && !content_search && !dedupe && matcher_match(&matcher, entry_name) &&
+            preds_match(dir_fd, entry_name, type, stx))
+        {
+            out_path(worker, dir_path, entry_name);
+            worker->found_count++;
+        }
+        // checks if the entry is searchable directory
+        if (is_searchable(dir_fd, entry_name) == SUCCESS)
+        {
+            // Only its name is stored, along with its parent
+            name_node_t* new_node = node_new(worker, dir_node, entry_name, strlen(entry_name));
+            error_handler_search_thread(new_node == NULL, "node_new() failed");
+            ret_val = enqueue(worker, new_node);
+            error_handler_search_thread(ret_val, "enqueue()");
+        }
+        else if (out_terminator == '\n')
+        { // not searchable
+            char msg[PATH_MAX + NAME_MAX + 64];
+            int len = snprintf(msg, sizeof(msg), "Directory %s/%s: Permission denied.\n", dir_path, entry_name);
+            out_write(worker, msg, len);
+        }
+        else
+        { // with -0, stdout only holds paths
+            fprintf(stderr, "Directory %s/%s: Permission denied.\n", dir_path, entry_name);
+        }
+    }
+
+    // CASE SEARCH: entry is a file of any other type
+    else
+    {
+        // The name first: it's in hand, metadata may need a syscall
+        if (matcher_match(&matcher, entry_name))
+        {
+            struct statx own_stx;
+            if (dedupe && type == DT_REG && NULL == stx)
+            { // -D: its size and inode, along with the predicates' fields
+                ret_val = statx(dir_fd, entry_name, AT_SYMLINK_NOFOLLOW, preds_mask, &own_stx);
+                error_handler_search_thread(ret_val, "statx()");
+                stx = &own_stx;
+            }
+            if (!preds_match(dir_fd, entry_name, type, stx))
+            {
+                return;
+            }
+            if (dedupe)
+            { // symlinks, FIFOs, devices etc. aren't compared, nor empty files
+                if (type == DT_REG && stx->stx_size > 0)
+                {
+                    dedupe_add(worker, dir_path, entry_name, stx);
+                    worker->found_count++;
+                }
+            }
+            else if (!content_search)
+            {
+                out_path(worker, dir_path, entry_name);
+                worker->found_count++;
+            }
+            else if (type == DT_REG && grep_file(worker, dir_fd, dir_path, entry_name) > 0)
+            { // symlinks, FIFOs, devices etc. aren't scanned
+                worker->found_count++;
+            }
+        }
+    }
+}
+
+/*
+ * ENGINE_URING: stats the 'count' untyped entries of the directory at once (only their type, and the fields the
+ * predicates need, are requested), then handles each of them
+ */
+static void search_untyped_entries(worker_t* worker, int dir_fd, name_node_t* dir_node, char* dir_path,
+                                   char** names, int count)
+{
+    struct statx stx[URING_DEPTH];
+    struct io_uring_cqe cqe;
+    int ret_val;
+
+    for (int i = 0; i < count; ++i)
+    {
+        struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dir_fd;
+        sqe->addr = (unsigned long) names[i];
+        sqe->len = STATX_TYPE | preds_mask;
+        sqe->off = (unsigned long) &stx[i];
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->user_data = i;
+    }
+    ret_val = uring_submit_and_wait(&worker->ring, count);
+    error_handler_search_thread(ret_val, "io_uring_enter()");
+    for (int i = 0; i < count; ++i)
+    {
+        error_handler_search_thread(!uring_reap(&worker->ring, &cqe) ? EIO : SUCCESS, "missing completion");
+        error_handler_search_thread(cqe.res < 0 ? -cqe.res : SUCCESS, "statx()");
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        search_entry(worker, dir_fd, dir_node, dir_path, names[i], IFTODT(stx[i].stx_mode), &stx[i]);
+    }
+}
+
+void search_dir(worker_t* worker, int dir_fd, name_node_t* dir_node, char* dir_path)
+{
+    char dirents[DIRENTS_BUF_SIZE];
+    // ENGINE_URING: untyped entries of the current batch, stat-ed together
+    char* untyped[URING_DEPTH];
+    int untyped_count = 0;
+    long nread;
+    int ret_val;
+
+    // Reads the directory's entries in batches, and iterates on each entry of each batch
+    while((nread = syscall(SYS_getdents64, dir_fd, dirents, sizeof(dirents))) > 0)
+    {
+        for (long offset = 0; offset < nread; offset += ((struct linux_dirent64*) (dirents + offset))->d_reclen)
+        {
+            struct linux_dirent64* entry = (struct linux_dirent64*) (dirents + offset);
+            char* entry_name = entry->d_name;
+
+            // CASE IGNORE : current entry is "." / ".."
+            if(strcmp(".", entry_name) == 0 || strcmp("..", entry_name) == 0)
+            {
+                continue;
+            }
+
+            // The entry's type comes with it, unless the filesystem doesn't report types.
+            // Symlinks are not followed, so a link to a directory is searched as a file
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN && engine == ENGINE_URING)
+            {
+                untyped[untyped_count++] = entry_name;
+                if (untyped_count == URING_DEPTH)
+                {
+                    search_untyped_entries(worker, dir_fd, dir_node, dir_path, untyped, untyped_count);
+                    untyped_count = 0;
+                }
+                continue;
+            }
+            if (type == DT_UNKNOWN)
+            {
+                struct statx stx;
+                ret_val = statx(dir_fd, entry_name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | preds_mask, &stx);
+                error_handler_search_thread(ret_val, "statx()");
+                search_entry(worker, dir_fd, dir_node, dir_path, entry_name, IFTODT(stx.stx_mode), &stx);
+                continue;
+            }
+            search_entry(worker, dir_fd, dir_node, dir_path, entry_name, type, NULL);
+        }
+        // The names point into 'dirents', which the next batch overwrites
+        if (untyped_count > 0)
+        {
+            search_untyped_entries(worker, dir_fd, dir_node, dir_path, untyped, untyped_count);
+            untyped_count = 0;
+        }
+    }
+    error_handler_search_thread(nread < 0 ? -1 : SUCCESS, "getdents64()");
+}
+
+//=================== QUEUE FUNCTIONS ====================
+
+int enqueue(worker_t* worker, name_node_t* node)
+{
+    // Counted before it's visible to stealers, so 'pending_count' can't drop to 0 while it's queued
+    atomic_fetch_add(&pending_count, 1);
+    if (deque_push(&worker->deque, node) != SUCCESS)
+    {
+        atomic_fetch_sub(&pending_count, 1);
+        return ENOMEM;
+    }
+
+    // Pairs with the sleeper's increment of 'sleeping_count' before it re-checks the deques:
+    // either it sees this push, or we see it sleeping (and then wait for it to sleep, holding 'idleLock')
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sleeping_count, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&idleLock);
+        pthread_cond_signal(&fWorkAvailable);
+        pthread_mutex_unlock(&idleLock);
+    }
+    return SUCCESS;
+}
+
+// Returns 1 IFF some thread's deque seems to hold work
+static int work_available(void)
+{
+    for (int t = 0; t < threads_count; ++t)
+    {
+        deque_t* deque = &workers[t].deque;
+        if (atomic_load(&deque->bottom) - atomic_load(&deque->top) > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// xorshift PRNG, for choosing steal victims
+static unsigned int next_rand(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+name_node_t* dequeue(worker_t* worker)
+{
+    name_node_t* node;
+
+    while (1)
+    {
+        node = deque_take(&worker->deque);
+        if (node != NULL)
+        {
+            holding_dir++;
+            return node;
+        }
+
+        // Own deque is empty, so tries stealing, starting from a random victim each round
+        for (int round = 0; round < STEAL_ROUNDS; ++round)
+        {
+            int first = next_rand(&worker->rand_state) % threads_count;
+            for (int i = 0; i < threads_count; ++i)
+            {
+                int victim = (first + i) % threads_count;
+                if (victim == worker->id)
+                {
+                    continue;
+                }
+                do
+                {
+                    node = deque_steal(&workers[victim].deque);
+                } while (node == STEAL_ABORT);
+                if (node != NULL)
+                {
+                    holding_dir++;
+                    return node;
+                }
+            }
+            if (atomic_load(&pending_count) == 0)
+            {
+                pthread_exit(NULL);
+            }
+            sched_yield();
+        }
+
+        // Nothing to steal: sleeps until a push or the end of the search
+        pthread_mutex_lock(&idleLock);
+        atomic_fetch_add(&sleeping_count, 1);
+        while (atomic_load(&pending_count) > 0 && !work_available())
+        {
+            pthread_cond_wait(&fWorkAvailable, &idleLock);
+        }
+        atomic_fetch_sub(&sleeping_count, 1);
+        pthread_mutex_unlock(&idleLock);
+        if (atomic_load(&pending_count) == 0)
+        {
+            pthread_exit(NULL);
+        }
+    }
+}
+
+void dir_done(void)
+{
+    holding_dir--;
+    if (atomic_fetch_sub(&pending_count, 1) == 1)
+    {
+        // Was the last directory (nothing is queued, nobody is searching): wakes all the sleepers to exit
+        pthread_mutex_lock(&idleLock);
+        pthread_cond_broadcast(&fWorkAvailable);
+        pthread_mutex_unlock(&idleLock);
+    }
+}
+
+//=================== NAME-NODES FUNCTIONS ====================
+
+// Drops a reference on the chunk, freeing it if it was the last
+static void chunk_put(arena_chunk_t* chunk)
+{
+    if (atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_acq_rel) == 1)
+    {
+        free(chunk);
+    }
+}
+
+name_node_t* node_new(worker_t* worker, name_node_t* parent, const char* name, size_t len)
+{
+    // Nodes are 8-bytes aligned within the chunk
+    size_t size = (offsetof(name_node_t, name) + len + 1 + 7) & ~(size_t) 7;
+    arena_chunk_t* chunk = worker->chunk;
+
+    if (len > USHRT_MAX || offsetof(arena_chunk_t, data) + size > ARENA_CHUNK_SIZE)
+    {
+        return NULL;
+    }
+    if (NULL == chunk || chunk->used + size > ARENA_CHUNK_SIZE)
+    {
+        // Aligned to its size, so a node finds its chunk by masking its own address
+        arena_chunk_t* new_chunk = (arena_chunk_t*) aligned_alloc(ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE);
+        if (NULL == new_chunk)
+        {
+            return NULL;
+        }
+        // The thread's own reference, dropped once it moves on to another chunk
+        atomic_init(&new_chunk->live, 1);
+        new_chunk->used = offsetof(arena_chunk_t, data);
+        if (NULL != chunk)
+        {
+            chunk_put(chunk);
+        }
+        worker->chunk = chunk = new_chunk;
+    }
+
+    name_node_t* node = (name_node_t*) ((char*) chunk + chunk->used);
+    chunk->used += size;
+    atomic_fetch_add_explicit(&chunk->live, 1, memory_order_relaxed);
+
+    node->parent = parent;
+    if (NULL != parent)
+    {
+        atomic_fetch_add_explicit(&parent->refs, 1, memory_order_relaxed);
+    }
+    atomic_init(&node->refs, 1);
+    node->len = len;
+    node->dir_id = 0;
+    node->old_id = INDEX_NONE;
+    memcpy(node->name, name, len);
+    node->name[len] = '\0';
+    return node;
+}
+
+void node_put(name_node_t* node)
+{
+    // Freeing a node drops its reference on its parent, which may free the parent as well, and so on
+    while (NULL != node && atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) == 1)
+    {
+        name_node_t* parent = node->parent;
+        chunk_put((arena_chunk_t*) ((uintptr_t) node & ~(uintptr_t) (ARENA_CHUNK_SIZE - 1)));
+        node = parent;
+    }
+}
+
+long node_path(name_node_t* node, char* buf)
+{
+    long len = -1;
+
+    // Total length: the names, each (but the root) preceded by a '/'
+    for (name_node_t* curr = node; NULL != curr; curr = curr->parent)
+    {
+        len += curr->len + 1;
+    }
+    if (len >= PATH_MAX)
+    {
+        return -1;
+    }
+    // Fills the names from the end backwards
+    buf[len] = '\0';
+    long end = len;
+    for (name_node_t* curr = node; NULL != curr; curr = curr->parent)
+    {
+        end -= curr->len;
+        memcpy(buf + end, curr->name, curr->len);
+        if (end > 0)
+        {
+            buf[--end] = '/';
+        }
+    }
+    return len;
+}
+
+//=================== DEQUE FUNCTIONS ====================
+
+static deque_array_t* deque_array_alloc(long size)
+{
+    deque_array_t* array = (deque_array_t*) malloc(sizeof(*array) + size * sizeof(array->buf[0]));
+    if (NULL != array)
+    {
+        array->size = size;
+        array->retired = NULL;
+    }
+    return array;
+}
+
+int deque_init(deque_t* deque)
+{
+    deque_array_t* array = deque_array_alloc(DEQUE_INIT_SIZE);
+    if (NULL == array)
+    {
+        return ENOMEM;
+    }
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, array);
+    return SUCCESS;
+}
+
+int deque_push(deque_t* deque, name_node_t* node)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    deque_array_t* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+    if (bottom - top > array->size - 1)
+    {
+        // Full: copies the elements into an array twice the size. The old one is retired, not freed
+        deque_array_t* new_array = deque_array_alloc(array->size * 2);
+        if (NULL == new_array)
+        {
+            return ENOMEM;
+        }
+        for (long i = top; i < bottom; ++i)
+        {
+            atomic_store_explicit(&new_array->buf[i & (new_array->size - 1)],
+                                  atomic_load_explicit(&array->buf[i & (array->size - 1)], memory_order_relaxed),
+                                  memory_order_relaxed);
+        }
+        new_array->retired = array;
+        atomic_store_explicit(&deque->array, new_array, memory_order_release);
+        array = new_array;
+    }
+    atomic_store_explicit(&array->buf[bottom & (array->size - 1)], node, memory_order_relaxed);
+    // Publishes the element along with the new 'bottom', which makes it visible to stealers
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return SUCCESS;
+}
+
+name_node_t* deque_take(deque_t* deque)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    deque_array_t* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    long top;
+    name_node_t* node = NULL;
+
+    // Reserves the bottom element, then checks (after a full fence) whether stealers got to it
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top <= bottom)
+    {
+        node = atomic_load_explicit(&array->buf[bottom & (array->size - 1)], memory_order_relaxed);
+        if (top == bottom)
+        {
+            // Last element: races with stealers for it
+            if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                         memory_order_seq_cst, memory_order_relaxed))
+            {
+                node = NULL;
+            }
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    }
+    else
+    {
+        // Empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return node;
+}
+
+name_node_t* deque_steal(deque_t* deque)
+{
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    name_node_t* node = NULL;
+
+    if (top < bottom)
+    {
+        deque_array_t* array = atomic_load_explicit(&deque->array, memory_order_acquire);
+        node = atomic_load_explicit(&array->buf[top & (array->size - 1)], memory_order_relaxed);
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+        {
+            // Lost to another stealer / the owner
+            return STEAL_ABORT;
+        }
+    }
+    return node;
+}
+
+void deque_destroy(deque_t* deque)
+{
+    deque_array_t* array = atomic_load(&deque->array);
+    while (NULL != array)
+    {
+        deque_array_t* retired = array->retired;
+        free(array);
+        array = retired;
+    }
+}
+
+//=================== IO-URING FUNCTIONS ====================
+
+int uring_init(uring_t* ring, unsigned int depth)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->fd < 0)
+    {
+        return errno;
+    }
+
+    // Maps the SQ ring, the CQ ring (in the same mapping, on kernels that support it) and the SQEs
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_len = ring->cq_len = (ring->sq_len > ring->cq_len) ? ring->sq_len : ring->cq_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        ring->sq_ptr = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char* sq = (char*) ring->sq_ptr;
+    char* cq = (char*) ring->cq_ptr;
+    ring->sq_head = (_Atomic unsigned int*) (sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned int*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*) (sq + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned int*) (cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned int*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return SUCCESS;
+
+fail:
+    {
+        int err = errno;
+        uring_destroy(ring);
+        return err;
+    }
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring)
+{
+    // Only this thread moves the tail, the kernel consumes everything on each submission
+    unsigned int tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed) + ring->to_submit;
+    unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->to_submit++;
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t* ring, unsigned int wait_nr)
+{
+    unsigned int tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned int to_submit = ring->to_submit;
+    long ret_val;
+
+    // Publishes the filled SQEs to the kernel
+    atomic_store_explicit(ring->sq_tail, tail + to_submit, memory_order_release);
+    ring->to_submit = 0;
+    do
+    {
+        ret_val = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret_val > 0)
+        {
+            to_submit -= ret_val;
+        }
+    } while ((ret_val < 0 && errno == EINTR) || (ret_val > 0 && to_submit > 0));
+    return ret_val < 0 ? errno : SUCCESS;
+}
+
+int uring_reap(uring_t* ring, struct io_uring_cqe* cqe)
+{
+    unsigned int head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+
+    if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire))
+    {
+        return 0;
+    }
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    // Hands the CQE back to the kernel
+    atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+    return 1;
+}
+
+void uring_destroy(uring_t* ring)
+{
+    if (NULL != ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (NULL != ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (NULL != ring->sq_ptr)
+    {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->fd > 0)
+    {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+}
+
+int uring_supported(void)
+{
+    size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe;
+    uring_t ring;
+    int supported = 0;
+
+    // io_uring may be missing, or disabled (e.g. by the 'io_uring_disabled' sysctl or a seccomp filter)
+    if (uring_init(&ring, 2) != SUCCESS)
+    {
+        return 0;
+    }
+    probe = (struct io_uring_probe*) calloc(1, probe_len);
+    if (NULL != probe &&
+        syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        probe->last_op >= IORING_OP_STATX &&
+        (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED))
+    {
+        supported = 1;
+    }
+    free(probe);
+    uring_destroy(&ring);
+    return supported;
+}
+
+//=================== INDEX FUNCTIONS ====================
+
+// Entry of the directory being read, whose name is at 'name_offset' in the thread's 'scratch_names'
+typedef struct scratch_entry_st
+{
+    uint32_t name_offset;
+    unsigned short len;
+    unsigned char type;
+} scratch_entry_t;
+
+// Directory indexed by a thread. Its entries lie at 'dir.entries_offset' in the thread's 'index_entries'
+typedef struct index_built_st
+{
+    uint32_t id;
+    index_dir_t dir;
+} index_built_t;
+
+// Directory being indexed
+typedef struct index_ctx_st
+{
+    worker_t* worker;
+    name_node_t* node;
+    char* path;
+    int dir_fd; // -1 until opened (an unchanged directory is only opened if it has subdirectories)
+    index_dir_t dir;
+    // Name of the last entry encoded, which the next one is front-coded against
+    char prev[UINT8_MAX + 1];
+    size_t prev_len;
+} index_ctx_t;
+
+/*
+ * Encodes an entry of the directory being indexed. A searchable subdirectory is given an id and enqueued, along
+ * with its id in the stored index ('old_child', or INDEX_NONE), so it's only read if it changed since.
+ */
+static void index_add_entry(index_ctx_t* ctx, const char* name, size_t len, int is_dir, uint32_t old_child)
+{
+    int type = INDEX_FILE;
+    uint32_t child = INDEX_NONE;
+    int ret_val;
+
+    if (is_dir)
+    {
+        if (ctx->dir_fd < 0)
+        {
+            ctx->dir_fd = open(ctx->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+            error_handler_search_thread(ctx->dir_fd < 0 ? -1 : SUCCESS, "open()");
+        }
+        // Checked again even if the directory didn't change, as a chmod of a subdirectory doesn't change it
+        type = INDEX_DENIED;
+        if (is_searchable(ctx->dir_fd, (char*) name) == SUCCESS)
+        {
+            name_node_t* new_node = node_new(ctx->worker, ctx->node, name, len);
+            error_handler_search_thread(new_node == NULL, "node_new() failed");
+            new_node->dir_id = child = atomic_fetch_add(&index_dirs_count, 1);
+            new_node->old_id = old_child;
+            ret_val = enqueue(ctx->worker, new_node);
+            error_handler_search_thread(ret_val, "enqueue()");
+            type = INDEX_DIR;
+        }
+    }
+    ret_val = index_encode(&ctx->worker->index_entries, ctx->prev, ctx->prev_len, name, len, type, child);
+    error_handler_search_thread(ret_val, "index_encode()");
+    memcpy(ctx->prev, name, len);
+    ctx->prev_len = len;
+    ctx->dir.entries_count++;
+}
+
+// Orders scratch entries by name (as strcmp), 'names' is their thread's 'scratch_names'
+static int scratch_entry_cmp(const void* a, const void* b, void* names)
+{
+    return strcmp((char*) names + ((const scratch_entry_t*) a)->name_offset,
+                  (char*) names + ((const scratch_entry_t*) b)->name_offset);
+}
+
+/*
+ * Reads the entries of the (open) directory 'dir_fd' into 'names' and 'entries' (scratch_entry_t), sorted by name,
+ * for front-coding (and so they can be merged with indexed entries, which are sorted as well).
+ * Returns SUCCESS or some ERRNO
+ */
+static int read_sorted_entries(int dir_fd, index_buf_t* names, index_buf_t* entries)
+{
+    char dirents[DIRENTS_BUF_SIZE];
+    long nread;
+
+    names->len = 0;
+    entries->len = 0;
+    while((nread = syscall(SYS_getdents64, dir_fd, dirents, sizeof(dirents))) > 0)
+    {
+        for (long offset = 0; offset < nread; offset += ((struct linux_dirent64*) (dirents + offset))->d_reclen)
+        {
+            struct linux_dirent64* entry = (struct linux_dirent64*) (dirents + offset);
+            if(strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0)
+            {
+                continue;
+            }
+            scratch_entry_t scratch = { names->len, strlen(entry->d_name), entry->d_type };
+            if (scratch.type == DT_UNKNOWN)
+            {
+                struct stat sb;
+                if (fstatat(dir_fd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    return errno;
+                }
+                scratch.type = S_ISDIR(sb.st_mode) ? DT_DIR : DT_REG;
+            }
+            if (index_buf_put(names, entry->d_name, scratch.len + 1) != SUCCESS ||
+                index_buf_put(entries, &scratch, sizeof(scratch)) != SUCCESS)
+            {
+                return ENOMEM;
+            }
+        }
+    }
+    if (nread < 0)
+    {
+        return errno;
+    }
+    qsort_r(entries->data, entries->len / sizeof(scratch_entry_t), sizeof(scratch_entry_t), scratch_entry_cmp,
+            names->data);
+    return SUCCESS;
+}
+
+/*
+ * Reads the entries of the directory being indexed, and encodes them sorted by name.
+ * 'old_cursor' is at the start of the directory's entries in the stored index, if it's there (NULL otherwise)
+ */
+static void index_read_dir(index_ctx_t* ctx, index_cursor_t* old_cursor)
+{
+    worker_t* worker = ctx->worker;
+    int ret_val;
+
+    ctx->dir_fd = open(ctx->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    error_handler_search_thread(ctx->dir_fd < 0 ? -1 : SUCCESS, "open()");
+    worker->reread_count++;
+    ret_val = read_sorted_entries(ctx->dir_fd, &worker->scratch_names, &worker->scratch_entries);
+    error_handler_search_thread(ret_val, "reading directory");
+
+    scratch_entry_t* entries = (scratch_entry_t*) worker->scratch_entries.data;
+    size_t count = worker->scratch_entries.len / sizeof(*entries);
+    int old_ret = (NULL != old_cursor) ? index_cursor_next(old_cursor) : 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char* name = worker->scratch_names.data + entries[i].name_offset;
+        // A subdirectory which was indexed under the same name keeps its stored id
+        while (old_ret > 0 && strcmp(old_cursor->name, name) < 0)
+        {
+            old_ret = index_cursor_next(old_cursor);
+        }
+        error_handler_search_thread(old_ret < 0 ? EINVAL : SUCCESS, "stored index");
+        uint32_t old_child = (old_ret > 0 && strcmp(old_cursor->name, name) == 0) ? old_cursor->child : INDEX_NONE;
+        index_add_entry(ctx, name, entries[i].len, entries[i].type == DT_DIR, old_child);
+    }
+}
+
+/*
+ * Indexes a dequeued directory, whose path is 'path': copies its entries from the stored index if it didn't change
+ * since, or reads them otherwise. Then records the directory.
+ */
+static void index_dir(worker_t* worker, name_node_t* node, char* path)
+{
+    index_ctx_t ctx;
+    index_cursor_t old_cursor;
+    struct stat sb;
+    int ret_val;
+
+    ret_val = stat(path, &sb);
+    error_handler_search_thread(ret_val, "stat()");
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.worker = worker;
+    ctx.node = node;
+    ctx.path = path;
+    ctx.dir_fd = -1;
+    ctx.dir.mtime_ns = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+    ctx.dir.ctime_ns = sb.st_ctim.tv_sec * 1000000000LL + sb.st_ctim.tv_nsec;
+    ctx.dir.entries_offset = worker->index_entries.len;
+
+    const index_dir_t* old = NULL;
+    if (INDEX_NONE != node->old_id)
+    {
+        old = &stored_index.dirs[node->old_id];
+        index_cursor_init(&stored_index, node->old_id, &old_cursor);
+    }
+    // Creating, removing or renaming an entry updates the directory's mtime. Its ctime is compared as well,
+    // as tools restoring trees (tar, rsync) set mtimes back, but can't do so with ctimes
+    if (NULL != old && old->mtime_ns == ctx.dir.mtime_ns && old->ctime_ns == ctx.dir.ctime_ns)
+    {
+        while ((ret_val = index_cursor_next(&old_cursor)) > 0)
+        {
+            index_add_entry(&ctx, old_cursor.name, old_cursor.name_len, old_cursor.type != INDEX_FILE,
+                            old_cursor.child);
+        }
+        error_handler_search_thread(ret_val < 0 ? EINVAL : SUCCESS, "stored index");
+    }
+    else
+    {
+        index_read_dir(&ctx, (NULL != old) ? &old_cursor : NULL);
+    }
+    if (ctx.dir_fd >= 0)
+    {
+        close(ctx.dir_fd);
+    }
+
+    ctx.dir.entries_len = worker->index_entries.len - ctx.dir.entries_offset;
+    index_built_t built = { node->dir_id, ctx.dir };
+    ret_val = index_buf_put(&worker->index_dirs, &built, sizeof(built));
+    error_handler_search_thread(ret_val, "index_buf_put()");
+}
+
+_Noreturn void index_queue(worker_t* worker)
+{
+    char path[PATH_MAX];
+
+    while (1)
+    {
+        name_node_t* node = dequeue(worker);
+        error_handler_search_thread(NULL == node, "Got NULL pointer from dequeue()");
+        error_handler_search_thread(node_path(node, path) < 0 ? ENAMETOOLONG : SUCCESS, "path length");
+        index_dir(worker, node, path);
+        node_put(node);
+        dir_done();
+    }
+}
+
+// Records the error a query stops at
+static void query_fail(query_t* query, int err, char* msg)
+{
+    query->error = err;
+    query->error_msg = msg;
+}
+
+long query_dir(query_t* query, uint32_t dir_id, char* path, size_t path_len)
+{
+    index_cursor_t cursor;
+    long found = 0;
+    int ret_val;
+
+    if (mode == MODE_DAEMON)
+    {
+        index_cursor_set(&cursor, live_dirs[dir_id].entries.data, live_dirs[dir_id].entries.len, live_count);
+    }
+    else
+    {
+        index_cursor_init(&stored_index, dir_id, &cursor);
+    }
+    while ((ret_val = index_cursor_next(&cursor)) > 0)
+    {
+        if (cursor.type == INDEX_FILE)
+        {
+            if (matcher_match(query->matcher, cursor.name))
+            {
+                fprintf(query->out, "%.*s/%s%c", (int) path_len, path, cursor.name, query->terminator);
+                found++;
+            }
+        }
+        else if (cursor.type == INDEX_DENIED)
+        {
+            fprintf(query->terminator == '\n' ? query->out : query->err, "Directory %.*s/%s: Permission denied.\n",
+                    (int) path_len, path, cursor.name);
+        }
+        else
+        {
+            // Subdirectories of an index file get their ids after their parent does, so even a corrupt one can't loop
+            if (mode != MODE_DAEMON && cursor.child <= dir_id)
+            {
+                query_fail(query, EINVAL, "index");
+                return found;
+            }
+            if (path_len + 1 + cursor.name_len >= PATH_MAX)
+            {
+                query_fail(query, ENAMETOOLONG, "path length");
+                return found;
+            }
+            path[path_len] = '/';
+            memcpy(path + path_len + 1, cursor.name, cursor.name_len);
+            found += query_dir(query, cursor.child, path, path_len + 1 + cursor.name_len);
+            if (query->error != SUCCESS)
+            {
+                return found;
+            }
+        }
+    }
+    if (ret_val < 0)
+    {
+        query_fail(query, EINVAL, "index");
+    }
+    return found;
+}
+
+//=================== DAEMON FUNCTIONS ====================
+/*
+ * * Live Index Explained: *
+ * The daemon indexes the tree once (as -b does), then keeps the index in memory a directory at a time: each
+ * directory has its own encoded entries (as in an index file) and an inotify watch. An event of a directory (an entry
+ * created, deleted or moved in / out, or a subdirectory's permissions changed) marks it dirty, and dirty directories
+ * are read again: subdirectories found under the same name keep their ids (and entries, which didn't change),
+ * new ones are indexed from scratch, and those gone are dropped with their subtrees. So the tree is never walked
+ * again, and a query only walks the in-memory index.
+ * When the kernel's event queue overflows, every directory is stat()-ed, and those which changed are marked dirty.
+ */
+
+// Events which change a directory's entries (IN_ATTRIB only when a subdirectory's permissions may have changed)
+#define LIVE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB)
+// Max bytes of a query's request
+#define REQUEST_MAX (64 * 1024)
+
+// A daemon's reply is a sequence of frames, each a header followed by 'len' bytes to print to stdout (FRAME_OUT) or
+// stderr (FRAME_ERR). The last one is FRAME_EXIT, without bytes: its 'len' is the exit status
+#define FRAME_EXIT 0
+#define FRAME_OUT 1
+#define FRAME_ERR 2
+
+typedef struct frame_st
+{
+    uint32_t type;
+    uint32_t len;
+} frame_t;
+
+// A reply's stream (fopencookie), whose writes are sent as frames of 'type'
+typedef struct frame_stream_st
+{
+    int fd;
+    uint32_t type;
+} frame_stream_t;
+
+int inotify_fd = -1;
+// Live directory of each inotify watch descriptor (or INDEX_NONE), 'wd_dirs_size' in all
+uint32_t* wd_dirs = NULL;
+int wd_dirs_size = 0;
+// Capacity of 'live_dirs', its free slots, and the directories queued for being read again (uint32_t ids)
+uint32_t live_capacity = 0;
+index_buf_t live_free;
+index_buf_t live_dirty;
+// Entries of the directory being read again (see read_sorted_entries), and the ids of their subdirectories
+index_buf_t live_names;
+index_buf_t live_entries;
+index_buf_t live_children;
+// 1 once the inotify watches ran out (which is only reported once)
+int watches_exhausted = 0;
+// Set by SIGINT / SIGTERM
+volatile sig_atomic_t daemon_stop = 0;
+
+// Takes a free slot (or a new one) for the directory whose path is 'path' (of 'len' bytes), returns its id
+static uint32_t live_alloc(const char* path, size_t len)
+{
+    uint32_t id;
+
+    if (live_free.len > 0)
+    {
+        live_free.len -= sizeof(id);
+        memcpy(&id, live_free.data + live_free.len, sizeof(id));
+    }
+    else
+    {
+        if (live_count == live_capacity)
+        {
+            live_capacity = (live_capacity > 0) ? live_capacity * 2 : 64;
+            live_dirs = (live_dir_t*) realloc(live_dirs, live_capacity * sizeof(*live_dirs));
+            error_handler_main(NULL == live_dirs, "realloc failed");
+        }
+        id = live_count++;
+    }
+    live_dir_t* dir = &live_dirs[id];
+    memset(dir, 0, sizeof(*dir));
+    dir->path = strndup(path, len);
+    error_handler_main(NULL == dir->path, "strndup failed");
+    dir->wd = -1;
+    return id;
+}
+
+// Watches the directory's entries. Without a watch, it's only refreshed after an overflow
+static void live_watch(uint32_t id)
+{
+    int wd = inotify_add_watch(inotify_fd, live_dirs[id].path, LIVE_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+
+    if (wd < 0)
+    {
+        if (errno == ENOSPC && !watches_exhausted)
+        {
+            watches_exhausted = 1;
+            fprintf(stderr, "Out of inotify watches (see /proc/sys/fs/inotify/max_user_watches), "
+                            "some directories won't be kept current\n");
+        }
+        // Otherwise the directory is already gone, and its parent's events will drop it
+        return;
+    }
+    if (wd >= wd_dirs_size)
+    {
+        int size = (wd + 1 > 2 * wd_dirs_size) ? wd + 1 : 2 * wd_dirs_size;
+        wd_dirs = (uint32_t*) realloc(wd_dirs, size * sizeof(*wd_dirs));
+        error_handler_main(NULL == wd_dirs, "realloc failed");
+        for (int i = wd_dirs_size; i < size; ++i)
+        {
+            wd_dirs[i] = INDEX_NONE;
+        }
+        wd_dirs_size = size;
+    }
+    wd_dirs[wd] = id;
+    live_dirs[id].wd = wd;
+}
+
+// Queues the directory for being read again
+static void live_mark(uint32_t id)
+{
+    if (!live_dirs[id].dirty)
+    {
+        live_dirs[id].dirty = 1;
+        error_handler_main(index_buf_put(&live_dirty, &id, sizeof(id)), "index_buf_put()");
+    }
+}
+
+// Drops a directory with its whole subtree: their watches, entries and slots
+static void live_drop(uint32_t id)
+{
+    index_buf_t stack = { 0 };
+    index_cursor_t cursor;
+
+    error_handler_main(index_buf_put(&stack, &id, sizeof(id)), "index_buf_put()");
+    while (stack.len > 0)
+    {
+        stack.len -= sizeof(id);
+        memcpy(&id, stack.data + stack.len, sizeof(id));
+        live_dir_t* dir = &live_dirs[id];
+        index_cursor_set(&cursor, dir->entries.data, dir->entries.len, live_count);
+        while (index_cursor_next(&cursor) > 0)
+        {
+            if (cursor.type == INDEX_DIR)
+            {
+                error_handler_main(index_buf_put(&stack, &cursor.child, sizeof(cursor.child)), "index_buf_put()");
+            }
+        }
+        if (dir->wd >= 0)
+        {
+            // Fails if the directory is already gone, as the kernel has removed its watch then
+            inotify_rm_watch(inotify_fd, dir->wd);
+            wd_dirs[dir->wd] = INDEX_NONE;
+        }
+        index_buf_free(&dir->entries);
+        free(dir->path);
+        dir->path = NULL;
+        dir->dirty = 0;
+        error_handler_main(index_buf_put(&live_free, &id, sizeof(id)), "index_buf_put()");
+    }
+    index_buf_free(&stack);
+}
+
+/*
+ * Reads the directory's entries again. Subdirectories found under the same name keep their ids, new ones get new ids
+ * (and are queued for being read), and those gone are dropped
+ */
+static void live_read(uint32_t id)
+{
+    struct stat sb;
+    index_cursor_t old_cursor;
+    index_buf_t encoded = { 0 };
+
+    int dir_fd = open(live_dirs[id].path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0 || fstat(dir_fd, &sb) != SUCCESS || read_sorted_entries(dir_fd, &live_names, &live_entries))
+    {
+        // Gone, or no longer searchable: its parent's events take care of it
+        if (dir_fd >= 0)
+        {
+            close(dir_fd);
+        }
+        return;
+    }
+    scratch_entry_t* entries = (scratch_entry_t*) live_entries.data;
+    size_t count = live_entries.len / sizeof(*entries);
+
+    // First pass: settles the entries' types, and which subdirectories are kept. The others are dropped before any
+    // new one is watched, as a directory moved within the tree keeps its inode (and so its watch descriptor)
+    live_children.len = 0;
+    index_cursor_set(&old_cursor, live_dirs[id].entries.data, live_dirs[id].entries.len, live_count);
+    int old_ret = index_cursor_next(&old_cursor);
+    for (size_t i = 0; i < count; ++i)
+    {
+        char* name = live_names.data + entries[i].name_offset;
+        int type = INDEX_FILE;
+        uint32_t child = INDEX_NONE;
+        if (entries[i].type == DT_DIR)
+        {
+            type = (is_searchable(dir_fd, name) == SUCCESS) ? INDEX_DIR : INDEX_DENIED;
+        }
+        int cmp = 0;
+        while (old_ret > 0 && (cmp = strcmp(old_cursor.name, name)) <= 0)
+        {
+            if (cmp == 0 && old_cursor.type == INDEX_DIR && type == INDEX_DIR)
+            {
+                child = old_cursor.child;
+            }
+            else if (old_cursor.type == INDEX_DIR)
+            {
+                live_drop(old_cursor.child);
+            }
+            old_ret = index_cursor_next(&old_cursor);
+        }
+        entries[i].type = type;
+        error_handler_main(index_buf_put(&live_children, &child, sizeof(child)), "index_buf_put()");
+    }
+    for (; old_ret > 0; old_ret = index_cursor_next(&old_cursor))
+    {
+        if (old_cursor.type == INDEX_DIR)
+        {
+            live_drop(old_cursor.child);
+        }
+    }
+
+    // Second pass: encodes the entries, giving the new subdirectories ids
+    uint32_t* children = (uint32_t*) live_children.data;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char* name = live_names.data + entries[i].name_offset;
+        char* prev = (i > 0) ? live_names.data + entries[i - 1].name_offset : NULL;
+        if (entries[i].type == INDEX_DIR && children[i] == INDEX_NONE)
+        {
+            char path[PATH_MAX];
+            int len = snprintf(path, sizeof(path), "%s/%s", live_dirs[id].path, name);
+            if (len < (int) sizeof(path))
+            {
+                // Watched before it's read, so no change of its entries is missed
+                children[i] = live_alloc(path, len);
+                live_watch(children[i]);
+                live_mark(children[i]);
+            }
+            else
+            { // can't be searched by path, as searching the tree would fail to
+                entries[i].type = INDEX_DENIED;
+            }
+        }
+        error_handler_main(index_encode(&encoded, prev, (i > 0) ? entries[i - 1].len : 0, name, entries[i].len,
+                                        entries[i].type, children[i]), "index_encode()");
+    }
+    close(dir_fd);
+
+    live_dir_t* dir = &live_dirs[id];
+    index_buf_free(&dir->entries);
+    dir->entries = encoded;
+    dir->entries_count = count;
+    dir->mtime_ns = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+    dir->ctime_ns = sb.st_ctim.tv_sec * 1000000000LL + sb.st_ctim.tv_nsec;
+}
+
+// Reads the queued directories again (including the new subdirectories found meanwhile)
+static void live_update(void)
+{
+    uint32_t id;
+
+    for (size_t i = 0; i < live_dirty.len / sizeof(id); ++i)
+    {
+        memcpy(&id, live_dirty.data + i * sizeof(id), sizeof(id));
+        if (NULL != live_dirs[id].path && live_dirs[id].dirty)
+        {
+            live_dirs[id].dirty = 0;
+            live_read(id);
+        }
+    }
+    live_dirty.len = 0;
+}
+
+// Queues every directory whose mtime / ctime changed since it was read (i.e. whose events may have been missed)
+static void live_check_all(void)
+{
+    struct stat sb;
+
+    for (uint32_t id = 0; id < live_count; ++id)
+    {
+        // A directory gone changed its parent's mtime
+        if (NULL != live_dirs[id].path && stat(live_dirs[id].path, &sb) == SUCCESS &&
+            (live_dirs[id].mtime_ns != sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec ||
+             live_dirs[id].ctime_ns != sb.st_ctim.tv_sec * 1000000000LL + sb.st_ctim.tv_nsec))
+        {
+            live_mark(id);
+        }
+    }
+}
+
+// Reads all the pending inotify events, and queues the directories they're about
+static void live_events(void)
+{
+    _Alignas(struct inotify_event) char events[64 * 1024];
+    ssize_t len;
+
+    while ((len = read(inotify_fd, events, sizeof(events))) > 0)
+    {
+        struct inotify_event* event;
+        for (char* pos = events; pos < events + len; pos += sizeof(*event) + event->len)
+        {
+            event = (struct inotify_event*) pos;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                live_check_all();
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= wd_dirs_size || INDEX_NONE == wd_dirs[event->wd])
+            {
+                continue;
+            }
+            uint32_t id = wd_dirs[event->wd];
+            if (event->mask & IN_IGNORED)
+            { // the watch was removed, along with its directory
+                live_dirs[id].wd = -1;
+                wd_dirs[event->wd] = INDEX_NONE;
+                continue;
+            }
+            // A file's attributes (or the directory's own) don't change its entries
+            if ((event->mask & IN_ATTRIB) && !(event->len > 0 && (event->mask & IN_ISDIR)))
+            {
+                continue;
+            }
+            live_mark(id);
+        }
+    }
+}
+
+// Sends all 'len' bytes (a closed peer fails with EPIPE, rather than raising SIGPIPE). Returns SUCCESS or some ERRNO
+static int send_all(int fd, const void* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret_val = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret_val < 0 && errno != EINTR)
+        {
+            return errno;
+        }
+        if (ret_val > 0)
+        {
+            data = (const char*) data + ret_val;
+            len -= ret_val;
+        }
+    }
+    return SUCCESS;
+}
+
+// Receives exactly 'len' bytes. Returns SUCCESS, ECONNRESET if the peer closed before, or some ERRNO
+static int recv_all(int fd, void* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret_val = recv(fd, data, len, 0);
+        if (ret_val == 0)
+        {
+            return ECONNRESET;
+        }
+        if (ret_val < 0 && errno != EINTR)
+        {
+            return errno;
+        }
+        if (ret_val > 0)
+        {
+            data = (char*) data + ret_val;
+            len -= ret_val;
+        }
+    }
+    return SUCCESS;
+}
+
+// fopencookie() write function of a reply's stream: sends the stream's buffer as a frame
+static ssize_t frame_write(void* cookie, const char* buf, size_t size)
+{
+    frame_stream_t* stream = (frame_stream_t*) cookie;
+    frame_t frame = { stream->type, size };
+
+    if (send_all(stream->fd, &frame, sizeof(frame)) != SUCCESS || send_all(stream->fd, buf, size) != SUCCESS)
+    {
+        return -1;
+    }
+    return size;
+}
+
+/*
+ * Answers a client's query. The request holds the client's matching options, each a '\0'-terminated string:
+ * "0", "i", or 't' / 'g' / 'r' followed by the pattern (the term is sent as a 't' option).
+ * The reply is what searching the tree (with these options) would print, in frames
+ */
+static void daemon_serve(int client_fd, const char* root)
+{
+    char request[REQUEST_MAX];
+    size_t len = 0;
+    ssize_t ret;
+    // A stalled client must not hang the daemon
+    struct timeval timeout = { 5, 0 };
+
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while (len < sizeof(request) && (ret = recv(client_fd, request + len, sizeof(request) - len, 0)) > 0)
+    {
+        len += ret;
+    }
+    frame_stream_t out_stream = { client_fd, FRAME_OUT };
+    frame_stream_t err_stream = { client_fd, FRAME_ERR };
+    cookie_io_functions_t io = { NULL, frame_write, NULL, NULL };
+    FILE* out = fopencookie(&out_stream, "w", io);
+    FILE* err = fopencookie(&err_stream, "w", io);
+    if (NULL == out || NULL == err)
+    {
+        if (NULL != out)
+        {
+            fclose(out);
+        }
+        close(client_fd);
+        return;
+    }
+    setvbuf(out, NULL, _IOFBF, OUT_BUF_SIZE);
+
+    // Parses the request into its own matcher
+    matcher_t request_matcher;
+    int flags = 0;
+    char terminator = '\n';
+    char err_msg[128] = "request";
+    int ret_val = (len == 0 || len == sizeof(request) || request[len - 1] != '\0') ? EINVAL : SUCCESS;
+    matcher_init(&request_matcher);
+    for (char* field = request; ret_val == SUCCESS && field < request + len; field += strlen(field) + 1)
+    {
+        if (strcmp(field, "0") == 0)
+        {
+            terminator = '\0';
+        }
+        else if (strcmp(field, "i") == 0)
+        {
+            flags |= MATCH_CASEFOLD;
+        }
+        else if (field[0] == 't' || field[0] == 'g' || field[0] == 'r')
+        {
+            ret_val = matcher_add(&request_matcher,
+                                  (field[0] == 't') ? MATCH_LITERAL : (field[0] == 'g') ? MATCH_GLOB : MATCH_REGEX,
+                                  field + 1);
+        }
+        else
+        {
+            ret_val = EINVAL;
+        }
+    }
+    if (ret_val == SUCCESS)
+    {
+        ret_val = matcher_compile(&request_matcher, flags, err_msg, sizeof(err_msg));
+    }
+
+    uint32_t status = SUCCESS;
+    if (ret_val != SUCCESS)
+    {
+        fprintf(err, "ERROR in: %s : %s\n", err_msg, strerror(ret_val));
+        status = MAIN_THREAD_ERR_EXIT_CODE;
+    }
+    else
+    {
+        // Answers after the changes reported so far
+        live_events();
+        live_update();
+        query_t query = { &request_matcher, out, err, terminator, SUCCESS, NULL };
+        char path[PATH_MAX];
+        size_t root_len = strlen(root);
+        memcpy(path, root, root_len);
+        long found = query_dir(&query, 0, path, root_len);
+        if (query.error != SUCCESS)
+        {
+            // Reported to the client, as -q would report it, while the daemon goes on serving
+            fprintf(err, "ERROR in: %s : %s\n", query.error_msg, strerror(query.error));
+            status = MAIN_THREAD_ERR_EXIT_CODE;
+        }
+        else
+        {
+            fprintf(terminator == '\n' ? out : err, "Done searching, found %ld files\n", found);
+        }
+    }
+    fclose(out);
+    fclose(err);
+    frame_t frame = { FRAME_EXIT, status };
+    send_all(client_fd, &frame, sizeof(frame));
+    matcher_destroy(&request_matcher);
+    close(client_fd);
+}
+
+static void daemon_signal_handler(int signum)
+{
+    (void) signum;
+    daemon_stop = 1;
+}
+
+_Noreturn void daemon_run(const char* socket_path, const char* root)
+{
+    struct sockaddr_un addr;
+    index_cursor_t cursor;
+    int ret_val;
+
+    // --- Live index, out of the directories the threads indexed ---
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    error_handler_main(inotify_fd < 0 ? -1 : SUCCESS, "inotify_init1()");
+    live_count = live_capacity = atomic_load(&index_dirs_count);
+    live_dirs = (live_dir_t*) calloc(live_capacity, sizeof(*live_dirs));
+    error_handler_main(NULL == live_dirs, "calloc failed");
+    for (int t = 0; t < threads_count; ++t)
+    {
+        index_built_t* built = (index_built_t*) workers[t].index_dirs.data;
+        size_t built_count = workers[t].index_dirs.len / sizeof(*built);
+        for (size_t i = 0; i < built_count; ++i)
+        {
+            live_dir_t* dir = &live_dirs[built[i].id];
+            ret_val = index_buf_put(&dir->entries, workers[t].index_entries.data + built[i].dir.entries_offset,
+                                    built[i].dir.entries_len);
+            error_handler_main(ret_val, "index_buf_put()");
+            dir->entries_count = built[i].dir.entries_count;
+            dir->mtime_ns = built[i].dir.mtime_ns;
+            dir->ctime_ns = built[i].dir.ctime_ns;
+            dir->wd = -1;
+        }
+    }
+    // Paths, from the root down: a directory's id is greater than its parent's
+    live_dirs[0].path = strdup(root);
+    error_handler_main(NULL == live_dirs[0].path, "strdup failed");
+    for (uint32_t id = 0; id < live_count; ++id)
+    {
+        index_cursor_set(&cursor, live_dirs[id].entries.data, live_dirs[id].entries.len, live_count);
+        while (index_cursor_next(&cursor) > 0)
+        {
+            if (cursor.type == INDEX_DIR)
+            {
+                ret_val = asprintf(&live_dirs[cursor.child].path, "%s/%s", live_dirs[id].path, cursor.name);
+                error_handler_main(ret_val < 0 ? ENOMEM : SUCCESS, "asprintf()");
+            }
+        }
+        live_watch(id);
+    }
+    // Changes made while the tree was indexed (before it was watched)
+    live_check_all();
+    live_update();
+
+    // --- Socket ---
+    error_handler_main(strlen(socket_path) >= sizeof(addr.sun_path) ? ENAMETOOLONG : SUCCESS, "socket path");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    error_handler_main(listen_fd < 0 ? -1 : SUCCESS, "socket()");
+    // A socket left by a daemon that's gone is replaced, but not that of a running daemon
+    if (connect(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) == SUCCESS)
+    {
+        error_handler_main(EADDRINUSE, "daemon socket");
+    }
+    struct stat sb;
+    if (lstat(socket_path, &sb) == SUCCESS && S_ISSOCK(sb.st_mode))
+    {
+        unlink(socket_path);
+    }
+    close(listen_fd);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    error_handler_main(listen_fd < 0 ? -1 : SUCCESS, "socket()");
+    // Only the daemon's user may connect, as the index reveals the whole tree
+    mode_t old_mask = umask(077);
+    ret_val = bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+    umask(old_mask);
+    error_handler_main(ret_val, "bind()");
+    ret_val = listen(listen_fd, 64);
+    error_handler_main(ret_val, "listen()");
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    // Without SA_RESTART, so poll() returns on the signal
+    action.sa_handler = daemon_signal_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Serving an index of %s (%u directories) on %s\n", root, live_count, socket_path);
+    fflush(stdout);
+
+    // --- Event loop ---
+    struct pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { listen_fd, POLLIN, 0 } };
+    while (!daemon_stop)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            error_handler_main(errno == EINTR ? SUCCESS : -1, "poll()");
+            continue;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            live_events();
+            live_update();
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client_fd >= 0)
+            {
+                daemon_serve(client_fd, root);
+            }
+        }
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    exit(SUCCESS);
+}
+
+_Noreturn void daemon_query(const char* socket_path, index_buf_t* request)
+{
+    struct sockaddr_un addr;
+    frame_t frame;
+    char buf[OUT_BUF_SIZE];
+    int ret_val;
+
+    error_handler_main(strlen(socket_path) >= sizeof(addr.sun_path) ? ENAMETOOLONG : SUCCESS, "socket path");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    error_handler_main(fd < 0 ? -1 : SUCCESS, "socket()");
+    ret_val = connect(fd, (struct sockaddr*) &addr, sizeof(addr));
+    error_handler_main(ret_val, "connect()");
+    ret_val = send_all(fd, request->data, request->len);
+    error_handler_main(ret_val, "send()");
+    // The daemon reads the request up to its end
+    shutdown(fd, SHUT_WR);
+
+    while (1)
+    {
+        ret_val = recv_all(fd, &frame, sizeof(frame));
+        error_handler_main(ret_val, "daemon reply");
+        if (frame.type == FRAME_EXIT)
+        {
+            exit(frame.len);
+        }
+        error_handler_main(frame.type != FRAME_OUT && frame.type != FRAME_ERR ? EPROTO : SUCCESS, "daemon reply");
+        int out_fd = (frame.type == FRAME_OUT) ? STDOUT_FILENO : STDERR_FILENO;
+        while (frame.len > 0)
+        {
+            size_t chunk = (frame.len < sizeof(buf)) ? frame.len : sizeof(buf);
+            ret_val = recv_all(fd, buf, chunk);
+            error_handler_main(ret_val, "daemon reply");
+            ret_val = index_write_all(out_fd, buf, chunk);
+            error_handler_main(ret_val, "write()");
+            frame.len -= chunk;
+        }
+    }
+}
+
+//=================== PREDICATE FUNCTIONS ====================
+
+int pred_parse(int field, const char* arg)
+{
+    if (field == PRED_TYPE)
+    {
+        static const char letters[] = "fdlpscb";
+        static const unsigned char dt_types[] = { DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK };
+        // The first -type replaces the default types, further ones narrow them down (all predicates must hold)
+        static int typed = 0;
+        unsigned int types = 0;
+        for (const char* c = arg;; c += 2)
+        {
+            const char* letter = strchr(letters, *c);
+            if (*c == '\0' || NULL == letter)
+            {
+                return EINVAL;
+            }
+            types |= 1u << dt_types[letter - letters];
+            if (c[1] == '\0')
+            {
+                break;
+            }
+            if (c[1] != ',')
+            {
+                return EINVAL;
+            }
+        }
+        pred_types = (typed ? pred_types : ~0u) & types;
+        typed = 1;
+        return SUCCESS;
+    }
+
+    if (preds_count == PREDS_MAX)
+    {
+        return E2BIG;
+    }
+    pred_t* pred = &preds[preds_count];
+    pred->field = field;
+    pred->unit = 1;
+    if (field == PRED_NEWER)
+    {
+        // As find does (without -L), a symlink's own time
+        struct stat sb;
+        if (lstat(arg, &sb) != 0)
+        {
+            return errno;
+        }
+        pred->cmp = 1;
+        pred->value = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+        preds_mask |= STATX_MTIME;
+        preds_count++;
+        return SUCCESS;
+    }
+
+    pred->cmp = (*arg == '+') ? 1 : (*arg == '-') ? -1 : 0;
+    arg += (pred->cmp != 0);
+    if (*arg < '0' || *arg > '9')
+    {
+        return EINVAL;
+    }
+    char* end;
+    errno = 0;
+    pred->value = strtoll(arg, &end, 10);
+    if (errno != 0)
+    {
+        return EINVAL;
+    }
+    if (field == PRED_SIZE)
+    {
+        static const char units[] = "cwbkMG";
+        static const uint64_t unit_bytes[] = { 1, 2, 512, 1024, 1024 * 1024, 1024 * 1024 * 1024 };
+        const char* unit = (*end != '\0') ? strchr(units, *end) : NULL;
+        pred->unit = (NULL != unit) ? unit_bytes[unit - units] : 512;
+        end += (NULL != unit);
+    }
+    if (*end != '\0')
+    {
+        return EINVAL;
+    }
+    preds_mask |= (field == PRED_SIZE) ? STATX_SIZE : (field == PRED_MTIME) ? STATX_MTIME : STATX_UID;
+    preds_count++;
+    return SUCCESS;
+}
+
+int preds_match(int dir_fd, const char* name, unsigned char type, const struct statx* stx)
+{
+    struct statx own_stx;
+
+    if (!(pred_types & (1u << type)))
+    {
+        return 0;
+    }
+    if (preds_count == 0)
+    {
+        return 1;
+    }
+    if (NULL == stx)
+    {
+        // Only the fields the predicates need, which spares the filesystem gathering the others
+        int ret_val = statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, preds_mask, &own_stx);
+        error_handler_search_thread(ret_val, "statx()");
+        stx = &own_stx;
+    }
+
+    for (int i = 0; i < preds_count; ++i)
+    {
+        const pred_t* pred = &preds[i];
+        int64_t field;
+        if (pred->field == PRED_SIZE)
+        {
+            field = (stx->stx_size + pred->unit - 1) / pred->unit;
+        }
+        else if (pred->field == PRED_MTIME)
+        {
+            int64_t age = preds_now - stx->stx_mtime.tv_sec;
+            field = (age >= 0) ? age / 86400 : -((-age + 86399) / 86400);
+        }
+        else if (pred->field == PRED_UID)
+        {
+            field = stx->stx_uid;
+        }
+        else
+        {
+            field = stx->stx_mtime.tv_sec * 1000000000LL + stx->stx_mtime.tv_nsec;
+        }
+        if ((field > pred->value) - (field < pred->value) != pred->cmp)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//=================== CONTENT FUNCTIONS ====================
+
+/*
+ * Reports a file that couldn't be read (-s / -D), as denied directories are reported.
+ * The file is '<dir_path>/<name>', or 'dir_path' itself when 'name' is NULL
+ */
+static void file_error(worker_t* worker, const char* dir_path, const char* name, int err)
+{
+    char msg[PATH_MAX + NAME_MAX + 128];
+    int len = snprintf(msg, sizeof(msg), "File %s%s%s: %s.\n", dir_path, (NULL != name) ? "/" : "",
+                       (NULL != name) ? name : "", strerror(err));
+    if (out_terminator == '\n')
+    {
+        out_write(worker, msg, (len < (int) sizeof(msg)) ? len : (int) sizeof(msg) - 1);
+    }
+    else
+    {
+        fputs(msg, stderr);
+    }
+}
+
+/*
+ * Prints the lines of 'data' ('len' bytes of whole lines of the file '<dir_path>/<name>', the first being line
+ * '*line_no') holding any content pattern, each once, as '<path>:<line number>:<line>' ('<path>\0<line number>:<line>'
+ * with -0). Returns their count. Lines are only counted up to the occurrences found, with memchr(), so the scan itself
+ * never looks at single bytes unless there are several patterns. Unless it's the file's 'last' data, the remaining
+ * lines are counted too, and '*line_no' is set to the number of the line that follows
+ */
+static long grep_buffer(worker_t* worker, const char* dir_path, const char* name, const char* data, size_t len,
+                        long* line_no, int last)
+{
+    char prefix[PATH_MAX + NAME_MAX + 32];
+    long lines = 0;
+    size_t line_start = 0; // of line '*line_no'
+    size_t pos = 0;
+    const char* nl;
+
+    while (pos < len)
+    {
+        long hit = matcher_find(&content_matcher, data + pos, len - pos);
+        if (hit < 0)
+        {
+            break;
+        }
+        size_t at = pos + hit;
+        while (NULL != (nl = (const char*) memchr(data + line_start, '\n', at - line_start)))
+        {
+            (*line_no)++;
+            line_start = nl - data + 1;
+        }
+        const char* end = (const char*) memchr(data + at, '\n', len - at);
+        size_t line_end = (NULL != end) ? (size_t) (end - data) : len;
+        int prefix_len = snprintf(prefix, sizeof(prefix), "%s/%s%c%ld:", dir_path, name,
+                                  out_terminator == '\n' ? ':' : '\0', *line_no);
+        out_record(worker, prefix, prefix_len, data + line_start, line_end - line_start);
+        lines++;
+        // The rest of the line needn't be scanned
+        (*line_no)++;
+        line_start = line_end + 1;
+        pos = line_start;
+    }
+    while (!last && line_start < len && NULL != (nl = (const char*) memchr(data + line_start, '\n', len - line_start)))
+    {
+        (*line_no)++;
+        line_start = nl - data + 1;
+    }
+    return lines;
+}
+
+long grep_file(worker_t* worker, int dir_fd, const char* dir_path, const char* name)
+{
+    struct stat sb;
+    long lines = 0;
+    long line_no = 1;
+
+    // Neither follows symlinks (as the search doesn't) nor blocks opening a FIFO, which isn't scanned anyway
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno != ELOOP && errno != ENXIO)
+        {
+            file_error(worker, dir_path, name, errno);
+        }
+        return 0;
+    }
+    error_handler_search_thread(fstat(fd, &sb), "fstat()");
+    if (!S_ISREG(sb.st_mode) || sb.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    if ((size_t) sb.st_size > worker->content_cap)
+    {
+        // Read once, front to back: a doubled readahead window for the file
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    /*
+     * Read with pread() (rather than mapped, so a file truncated meanwhile just ends early), a buffer at a time:
+     * a single read for files that fit, windows of whole lines for bigger ones. A window's last, unfinished line
+     * is carried over to the front of the next one, and the buffer grows for lines longer than it.
+     */
+    char* buf = worker->content_buf;
+    size_t carry = 0;
+    off_t offset = 0;
+    int eof = 0;
+    while (!eof)
+    {
+        if (carry == worker->content_cap)
+        {
+            buf = (char*) realloc(worker->content_buf, 2 * worker->content_cap);
+            error_handler_search_thread(NULL == buf ? ENOMEM : SUCCESS, "'content_buf' realloc failed");
+            worker->content_buf = buf;
+            worker->content_cap *= 2;
+        }
+        ssize_t ret_val = pread(fd, buf + carry, worker->content_cap - carry, offset);
+        if (ret_val < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret_val < 0)
+        {
+            file_error(worker, dir_path, name, errno);
+            break;
+        }
+        if (offset == 0 && NULL != memchr(buf, '\0', ((size_t) ret_val < CONTENT_BINARY_PROBE) ? ret_val
+                                                                                             : CONTENT_BINARY_PROBE))
+        { // binary
+            break;
+        }
+        offset += ret_val;
+        // Its size (as found) is the end, unless pread() says otherwise first (the file shrank since)
+        eof = (ret_val == 0 || offset >= sb.st_size);
+        size_t filled = carry + ret_val;
+        size_t complete = filled;
+        if (!eof)
+        {
+            const char* last_nl = (const char*) memrchr(buf, '\n', filled);
+            complete = (NULL != last_nl) ? (size_t) (last_nl - buf) + 1 : 0;
+        }
+        lines += grep_buffer(worker, dir_path, name, buf, complete, &line_no, eof);
+        carry = filled - complete;
+        memmove(buf, buf + complete, carry);
+    }
+    close(fd);
+    return lines;
+}
+
+//=================== DEDUPE FUNCTIONS ====================
+/*
+ * * Dedupe Explained: *
+ * Files can only be duplicates of files of the same size, which the search gets along with their type (or with a
+ * single statx()), so most files are ruled out without being opened. The others are hashed in two phases, each
+ * spread over the threads, and regrouped after each: first their first and last DUPE_PARTIAL bytes (two reads,
+ * which tell apart most files of the same size), then, for those still alike, all of their contents (XXH64, see
+ * pfind_hash.h). Files sharing an inode (dev, ino) are hardlinks of the same contents: only the first is read, and
+ * they're reported along with their duplicates, but don't count as reclaimable.
+ */
 
-// Search term received as argument
-char* search_term;
+void dedupe_add(worker_t* worker, const char* dir_path, const char* name, const struct statx* stx)
+{
+    dupe_file_t file;
 
-// Amount of searching threads created
-int threads_count;
+    memset(&file, 0, sizeof(file));
+    file.size = stx->stx_size;
+    file.dev = ((uint64_t) stx->stx_dev_major << 32) | stx->stx_dev_minor;
+    file.ino = stx->stx_ino;
+    file.path_offset = worker->dupe_paths.len;
+    int err = index_buf_put(&worker->dupe_paths, dir_path, strlen(dir_path)) ||
+              index_buf_put(&worker->dupe_paths, "/", 1) ||
+              index_buf_put(&worker->dupe_paths, name, strlen(name) + 1) ||
+              index_buf_put(&worker->dupes, &file, sizeof(file));
+    error_handler_search_thread(err ? ENOMEM : SUCCESS, "index_buf_put()");
+}
 
-// Amount of threads that are currently active (= didn't exit for an error / finished)
-int active_count = 0;
-// Amount of threads that are currently waiting (i.e. waiting for dequeue)
-int waiting_count = 0;
-// Amount of files matching the search term found on the run
-int found_count = 0;
-// All 'waiting_count' and 'active_count' and 'found_count' should be handled when 'qLock' acquired (!)
+static inline int cmp_u64(uint64_t a, uint64_t b)
+{
+    return (a > b) - (a < b);
+}
 
-// 1 IFF some searching-thread has encountered an error while running
-int thread_encountered_err_flag = 0;
+// Orders files by size and hashes (i.e. in groups of possible duplicates), then by inode (hardlinks together)
+static int dupe_cmp(const void* a, const void* b)
+{
+    const dupe_file_t* x = (const dupe_file_t*) a;
+    const dupe_file_t* y = (const dupe_file_t*) b;
+    int cmp = cmp_u64(x->size, y->size);
+    cmp = cmp ? cmp : cmp_u64(x->partial, y->partial);
+    cmp = cmp ? cmp : cmp_u64(x->full, y->full);
+    cmp = cmp ? cmp : cmp_u64(x->dev, y->dev);
+    return cmp ? cmp : cmp_u64(x->ino, y->ino);
+}
 
-// Struct that represents a queue element (=node)
-typedef struct node_st
+static inline int dupe_same_group(const dupe_file_t* x, const dupe_file_t* y)
 {
-    char* path;
-    struct node_st* prev;
-} node_t;
+    return x->size == y->size && x->partial == y->partial && x->full == y->full;
+}
 
-// Head and Tail of our queue. [head is NULL] IFF [tail is NULL] IFF [queue is empty]
-node_t* head = NULL;
-node_t* tail = NULL;
+static inline int dupe_same_inode(const dupe_file_t* x, const dupe_file_t* y)
+{
+    return x->dev == y->dev && x->ino == y->ino;
+}
 
-//=========== Functions Declarations =======================
-/*
- * --- Search Queue ---
- * Function to be run by the search-threads.
- * Dequeues a path from the queue as long as the queue is not completely exhausted.
- * Compares each file to the 'search_term' and counts the matches.
- */
-_Noreturn void* search_queue(void*);
 /*
- *  --- ENQUEUE ---
- * Gets a string 'path', and creates a node with its
- * Pushes the new node to the end of the queue.
- * returns some ERRNO on errors, otherwise SUCCESS
- * * Memory pointed by 'path'  argument was allocated by caller, and will be freed only when dequeued
+ * Keeps only the files which may still have duplicates: those of groups (of files alike so far) of at least 2 inodes,
+ * that didn't fail. The first file of each inode is marked 'todo', i.e. read for all of the inode's files
  */
-int enqueue(char*);
+static void dedupe_mark(void)
+{
+    size_t kept = 0;
 
-/*
- * --- DEQUEUE ---
- * Dequeues node from the queue when possible, and returns its value ('path')
- * if queue is empty and no threads is expected to enqueue, it kills all threads.
- * Freeing the returned pointer is *caller* responsibility
- */
-char* dequeue();
-/*
- * return SUCCESS IFF given dir-path is searchable
- */
-int is_searchable(char*);
-/*
- * --- Error Handling ---
- * @param err_cond: should be some defined err_no, or just a boolean condition that
- *                  hold IFF error has occurred.
- * @return: if (err_cond is non-zero) prints 'msg' to stderr with its strerror
- *          performs exit, with exit code 1
- */
-void error_handler_main(int, char*);
+    for (size_t i = 0; i < dupe_count; ++i)
+    {
+        if (!dupe_files[i].failed)
+        {
+            dupe_files[kept++] = dupe_files[i];
+        }
+    }
+    dupe_count = kept;
+    qsort(dupe_files, dupe_count, sizeof(*dupe_files), dupe_cmp);
+
+    kept = 0;
+    for (size_t start = 0, end; start < dupe_count; start = end)
+    {
+        size_t inodes = 0;
+        for (end = start; end < dupe_count && dupe_same_group(&dupe_files[start], &dupe_files[end]); ++end)
+        {
+            inodes += (end == start || !dupe_same_inode(&dupe_files[end - 1], &dupe_files[end]));
+        }
+        if (inodes < 2)
+        {
+            continue;
+        }
+        for (size_t i = start; i < end; ++i)
+        {
+            dupe_files[i].todo = (i == start || !dupe_same_inode(&dupe_files[i - 1], &dupe_files[i]));
+            dupe_files[kept++] = dupe_files[i];
+        }
+    }
+    dupe_count = kept;
+}
 
 /*
- * Same as 'error_handler', but performs *thread* exit instead
+ * Reads 'len' bytes of the file 'fd' at 'offset' into 'buf', and hashes them into 'state'.
+ * Returns SUCCESS or some ERRNO (ENODATA if the file ended before, i.e. it shrank since it was found)
  */
-void error_handler_search_thread(int, char*);
-
-//============ Threads Search and Enqueueing Main Function =======================
-_Noreturn void* search_queue(void* arg)
+static int dupe_read(int fd, char* buf, size_t len, uint64_t offset, hash_state_t* state)
 {
-    int ret_val;
+    size_t got = 0;
 
-    // Waits for all threads to be created:
-    pthread_mutex_lock(&qLock);
-    active_count++;
-    pthread_cond_signal(&fThreadWasCreated);
-    pthread_cond_wait(&fAllThreadsCreated, &qLock);
-    pthread_mutex_unlock(&qLock);
-
-    while(1)
+    while (got < len)
     {
-        char* curr_path = dequeue();
-        error_handler_search_thread(NULL == curr_path, "Got NULL pointer from dequeue()");
-        // Creates a pointer to the directory entries stream
-        DIR* dirp = opendir(curr_path);
-        // error in opendir() shouldn't happen, as far as permissions
-        error_handler_search_thread(NULL == dirp, "opendir()");
-        struct dirent* entry;
+        ssize_t ret_val = pread(fd, buf + got, len - got, offset + got);
+        if (ret_val < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret_val <= 0)
+        {
+            return (ret_val < 0) ? errno : ENODATA;
+        }
+        got += ret_val;
+    }
+    hash_update(state, buf, len);
+    return SUCCESS;
+}
+
+// Hashes the file for the current phase, returns SUCCESS or some ERRNO
+static int dupe_hash(worker_t* worker, dupe_file_t* file)
+{
+    hash_state_t state;
+    int err = SUCCESS;
 
-        // Iterates on each entry of the current directory
-        while(NULL != (entry = readdir(dirp)))
+    int fd = open(file->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+    hash_init(&state, 0);
+    if (dupe_phase == DUPE_PHASE_PARTIAL)
+    {
+        // Both ends: files of a format tend to share their first bytes (headers), and often their last ones
+        int whole = (file->size <= 2 * DUPE_PARTIAL);
+        err = dupe_read(fd, worker->content_buf, whole ? file->size : DUPE_PARTIAL, 0, &state);
+        if (!err && !whole)
         {
-            char* entry_name = entry->d_name;
+            err = dupe_read(fd, worker->content_buf, DUPE_PARTIAL, file->size - DUPE_PARTIAL, &state);
+        }
+        file->partial = hash_digest(&state);
+        // A small file was hashed whole already
+        file->full = whole ? file->partial : 0;
+    }
+    else
+    {
+        // Read once, front to back
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        for (uint64_t offset = 0; offset < file->size && !err; offset += CONTENT_PREAD_MAX)
+        {
+            uint64_t len = file->size - offset;
+            err = dupe_read(fd, worker->content_buf, (len < CONTENT_PREAD_MAX) ? len : CONTENT_PREAD_MAX, offset,
+                            &state);
+        }
+        file->full = hash_digest(&state);
+    }
+    close(fd);
+    return err;
+}
 
-            // CASE IGNORE : current entry is "." / ".." / symlink, so skips it
-            if(strcmp(".", entry_name) == 0 || strcmp("..", entry_name) == 0)
+// Hashing thread: hashes the files marked 'todo', claiming DUPE_BATCH files at a time, until all were claimed
+static void* dedupe_queue(void* arg)
+{
+    worker_t* worker = (worker_t*) arg;
+
+    while (1)
+    {
+        size_t first = atomic_fetch_add(&dupe_next, DUPE_BATCH);
+        if (first >= dupe_count)
+        {
+            return NULL;
+        }
+        for (size_t i = first; i < first + DUPE_BATCH && i < dupe_count; ++i)
+        {
+            dupe_file_t* file = &dupe_files[i];
+            // Small files were hashed whole by the partial phase
+            if (!file->todo || (dupe_phase == DUPE_PHASE_FULL && file->size <= 2 * DUPE_PARTIAL))
             {
                 continue;
             }
-
-            // prepares to check it's DIR and it's executable and readable by owner
-            struct stat sb;
-            char* new_path = (char*) malloc(PATH_MAX * sizeof(*new_path));
-            error_handler_search_thread(new_path == NULL, "malloc failed");
-            strcpy(new_path, curr_path);
-            strcat(new_path, "/");
-            strcat(new_path, entry_name);
-            ret_val = lstat(new_path, &sb);
-            error_handler_search_thread(ret_val, "lstat()");
-
-            // CASE ENQUEUE : entry is a directory
-            if (S_ISDIR(sb.st_mode))
+            int err = dupe_hash(worker, file);
+            if (err)
             {
-                // checks if new_path is searchable directory
-                if (is_searchable(new_path) == SUCCESS)
-                {
-                    ret_val = enqueue(new_path);
-                    error_handler_search_thread(ret_val, "enqueue()");
-                }
-                else
-                { // not searchable
-                    printf("Directory %s: Permission denied.\n", new_path);
-                    free(new_path);
-                }
+                file->failed = 1;
+                file_error(worker, file->path, NULL, err);
             }
+        }
+    }
+}
 
-            // CASE SEARCH: entry is a file of any other type
-            else
-            {
-                free(new_path);
-                char* ret_pointer = strstr(entry_name, search_term);
-                if (NULL != ret_pointer)
-                {
-                    printf("%s/%s\n", curr_path, entry_name);
-                    pthread_mutex_lock(&qLock);
-                    found_count++;
-                    pthread_mutex_unlock(&qLock);
-                }
-            }
+// Runs a hashing phase over the threads, then gives each file the hashes of the file read for its inode
+static void dedupe_hash_all(pthread_t* threads, int phase)
+{
+    int ret_val;
 
+    dupe_phase = phase;
+    atomic_store(&dupe_next, 0);
+    for (int t = 0; t < threads_count; ++t)
+    {
+        ret_val = pthread_create(&threads[t], NULL, dedupe_queue, &workers[t]);
+        error_handler_main(ret_val, "pthread_create()");
+    }
+    for (int t = 0; t < threads_count; ++t)
+    {
+        ret_val = pthread_join(threads[t], NULL);
+        error_handler_main(ret_val, "pthread_join()");
+        ret_val = out_flush(&workers[t]);
+        error_handler_main(ret_val, "write()");
+    }
+    for (size_t i = 1; i < dupe_count; ++i)
+    {
+        dupe_file_t* file = &dupe_files[i];
+        if (!file->todo && dupe_same_inode(&dupe_files[i - 1], file))
+        {
+            file->partial = dupe_files[i - 1].partial;
+            file->full = dupe_files[i - 1].full;
+            file->failed = dupe_files[i - 1].failed;
         }
-        free(curr_path);
-        closedir(dirp);
     }
-
 }
 
-//=================== QUEUE FUNCTIONS ====================
-
-int enqueue(char* path)
+void dedupe_run(pthread_t* threads)
 {
-    node_t* new_node = (node_t*) malloc(sizeof(*new_node));
-    if (NULL == new_node)
+    int ret_val;
+
+    // Whatever the search printed comes first
+    for (int t = 0; t < threads_count; ++t)
     {
-        return ENOMEM;
+        ret_val = out_flush(&workers[t]);
+        error_handler_main(ret_val, "write()");
     }
-    new_node->path = path;
-    new_node->prev = NULL;
-    pthread_mutex_lock(&qLock);
-    if (head == NULL)
-    {
-        // Queue is empty, adds node as new head & tail
-        head = new_node;
 
+    // Gathers the candidates of all the threads
+    for (int t = 0; t < threads_count; ++t)
+    {
+        dupe_count += workers[t].dupes.len / sizeof(dupe_file_t);
     }
-    else
+    dupe_files = (dupe_file_t*) malloc((dupe_count + 1) * sizeof(*dupe_files));
+    error_handler_main(NULL == dupe_files, "malloc failed");
+    size_t candidates = 0;
+    for (int t = 0; t < threads_count; ++t)
     {
-        // Queue is not empty, so performs regular enqueuing
-        tail->prev = new_node;
+        dupe_file_t* dupes = (dupe_file_t*) workers[t].dupes.data;
+        for (size_t i = 0; i < workers[t].dupes.len / sizeof(*dupes); ++i)
+        {
+            dupe_files[candidates] = dupes[i];
+            dupe_files[candidates++].path = workers[t].dupe_paths.data + dupes[i].path_offset;
+        }
     }
-    tail = new_node;
 
-    pthread_cond_broadcast(&qNotEmpty);
-    // Why broadcast and not signal? : In order to prevent a lost-wakeup (as seen in lect. 10)
-    pthread_mutex_unlock(&qLock);
+    // Groups by size, then by the hashes of each phase
+    dedupe_mark();
+    dedupe_hash_all(threads, DUPE_PHASE_PARTIAL);
+    dedupe_mark();
+    dedupe_hash_all(threads, DUPE_PHASE_FULL);
+    dedupe_mark();
 
-    return SUCCESS;
+    // --- Report -----------
+    // With -0, stdout only holds paths: each set's paths, and an empty one ending the set
+    FILE* msgs = (out_terminator == '\n') ? stdout : stderr;
+    size_t sets = 0;
+    uint64_t reclaimable = 0;
+    for (size_t start = 0, end; start < dupe_count; start = end)
+    {
+        size_t inodes = 0;
+        for (end = start; end < dupe_count && dupe_same_group(&dupe_files[start], &dupe_files[end]); ++end)
+        {
+            inodes += dupe_files[end].todo;
+        }
+        fprintf(msgs, "Duplicates: %zu copies of %llu bytes\n", inodes, (unsigned long long) dupe_files[start].size);
+        for (size_t i = start; i < end; ++i)
+        {
+            if (out_terminator == '\n')
+            {
+                printf("%s%s\n", dupe_files[i].path, dupe_files[i].todo ? "" : " (hardlink)");
+            }
+            else
+            {
+                fwrite(dupe_files[i].path, 1, strlen(dupe_files[i].path) + 1, stdout);
+            }
+        }
+        fputc(out_terminator, stdout);
+        sets++;
+        reclaimable += (inodes - 1) * dupe_files[start].size;
+    }
+    fprintf(msgs, "Done deduping %zu files, found %zu duplicate sets, %llu reclaimable bytes\n", candidates, sets,
+            (unsigned long long) reclaimable);
+    free(dupe_files);
 }
 
-char* dequeue()
+//=================== OUTPUT FUNCTIONS ====================
+
+// Writes all 'len' bytes to stdout, with 'outLock' held. Returns SUCCESS or some ERRNO
+static int out_write_locked(const char* data, size_t len)
 {
-    pthread_mutex_lock(&qLock);
-    waiting_count++;
-    while (NULL == head)
-    {
-        // the queue is empty AND all the threads are waiting
-        if (waiting_count == active_count)
-        {
-            // Prepares the thread for an exit
-            active_count--;
-            waiting_count--;
-            pthread_mutex_unlock(&qLock);
-            // Will trigger all the waiting-threads to exit themselves
-            pthread_cond_broadcast(&qNotEmpty);
-            pthread_exit(NULL);
+    size_t written = 0;
+
+    while (written < len)
+    {
+        ssize_t ret_val = write(STDOUT_FILENO, data + written, len - written);
+        if (ret_val < 0 && errno != EINTR)
+        {
+            return errno;
         }
-        pthread_cond_wait(&qNotEmpty, &qLock);
+        written += (ret_val > 0) ? ret_val : 0;
+    }
+    return SUCCESS;
+}
+
+int out_flush(worker_t* worker)
+{
+    pthread_mutex_lock(&outLock);
+    int err = out_write_locked(worker->out_buf, worker->out_len);
+    pthread_mutex_unlock(&outLock);
+    worker->out_len = 0;
+    return err;
+}
+
+void out_write(worker_t* worker, const char* data, size_t len)
+{
+    if (worker->out_len + len > OUT_BUF_SIZE)
+    {
+        error_handler_search_thread(out_flush(worker), "write()");
     }
-    waiting_count--;
+    memcpy(worker->out_buf + worker->out_len, data, len);
+    worker->out_len += len;
+}
 
-    char* path_dequeued = head->path;
-    if (tail == head)
-    { // Queue has one node, and head & tail points at its
-        tail = NULL;
+void out_path(worker_t* worker, const char* dir_path, const char* name)
+{
+    size_t dir_len = strlen(dir_path);
+    size_t name_len = strlen(name);
 
+    if (worker->out_len + dir_len + name_len + 2 > OUT_BUF_SIZE)
+    {
+        error_handler_search_thread(out_flush(worker), "write()");
     }
-    node_t* deleted_node = head;
-    head = head->prev;
-    pthread_mutex_unlock(&qLock);
+    char* out = worker->out_buf + worker->out_len;
+    memcpy(out, dir_path, dir_len);
+    out[dir_len] = '/';
+    memcpy(out + dir_len + 1, name, name_len);
+    out[dir_len + 1 + name_len] = out_terminator;
+    worker->out_len += dir_len + name_len + 2;
+}
+
+void out_record(worker_t* worker, const char* prefix, size_t prefix_len, const char* data, size_t len)
+{
+    size_t record_len = prefix_len + len + 1;
 
-    free(deleted_node);
-    // path_dequeued's memory will be freed by caller, as documented
-    return path_dequeued;
+    if (record_len <= OUT_BUF_SIZE)
+    {
+        if (worker->out_len + record_len > OUT_BUF_SIZE)
+        {
+            error_handler_search_thread(out_flush(worker), "write()");
+        }
+        char* out = worker->out_buf + worker->out_len;
+        memcpy(out, prefix, prefix_len);
+        memcpy(out + prefix_len, data, len);
+        out[prefix_len + len] = '\n';
+        worker->out_len += record_len;
+        return;
+    }
+    // Longer than the buffer (e.g. a huge line): written right away, after the buffer, all under the same lock
+    pthread_mutex_lock(&outLock);
+    int err = out_write_locked(worker->out_buf, worker->out_len);
+    err = err ? err : out_write_locked(prefix, prefix_len);
+    err = err ? err : out_write_locked(data, len);
+    err = err ? err : out_write_locked("\n", 1);
+    pthread_mutex_unlock(&outLock);
+    worker->out_len = 0;
+    error_handler_search_thread(err, "write()");
 }
 
 // ================ HELPERS ================================
-int is_searchable(char* dir_path)
+int is_searchable(int dir_fd, char* dir_path)
 {
-    if ((access(dir_path, R_OK) == 0) && (access(dir_path, X_OK) == 0))
+    // A single lookup for both permissions, relative to the parent directory
+    if (faccessat(dir_fd, dir_path, R_OK | X_OK, 0) == 0)
     {
         return SUCCESS;
     }
@@ -277,6 +2878,11 @@ void error_handler_search_thread(int err_cond, char* msg)
         }
 
         fprintf(stderr, "ERROR in: %s : %s\n", msg, strerror(err_cond));
+        while (holding_dir > 0)
+        {
+            // The rest of the directories is skipped, but the search must still find its end
+            dir_done();
+        }
         pthread_mutex_lock(&qLock);
         // current thread has encountered error, so it marks the flag
         thread_encountered_err_flag = 1;
@@ -294,42 +2900,263 @@ int main(int argc, char* argv[])
     int ret_val;
 
     // --- Process args -----------------------------------------
-    error_handler_main(argc != 4, "arguments count");
+    // Usage: pfind [-e auto|sync|uring] [-0] [-i] [-t term] [-g glob] [-r regex] [-s text | -D] [predicates]
+    //              <root> <term> <threads>
+    //        pfind -b <index> <root> <threads>
+    //        pfind [-0] [-i] [-t term] [-g glob] [-r regex] -q <index> <term>
+    //        pfind -d <socket> <root> <threads>
+    //        pfind [-0] [-i] [-t term] [-g glob] [-r regex] -c <socket> <term>
+    // A file matches if its name contains <term> or any -t term, or matches any -g glob / -r regex
+    // (-t, -g and -r may be repeated). -i makes all of them case-insensitive.
+    // -0 ends the printed paths with '\0' instead of '\n', and prints everything else to stderr.
+    // -D reports the duplicates among the matching files (regular, not empty) instead, in sets.
+    // -s scans the matching files for the text (may be repeated) instead, printing their lines holding any
+    // as <path>:<line number>:<line> (<path>\0<line number>:<line> with -0). Binary files are skipped.
+    // Predicates, as find's (all must hold too): -type <c>[,<c>...] (f, d, l, p, s, c, b; without it, anything but
+    // directories; with d, <root> itself may match too), -size [+-]N[cwbkMG], -mtime [+-]N, -uid [+-]N, -newer <file>.
+    // They may be repeated.
+    // -b builds an index of the tree into the file <index>, or refreshes it if it already indexes <root>.
+    // -q searches the index instead of the tree (printing what searching the tree when it was indexed would)
+    // -d runs a daemon keeping an index of the tree current (with inotify), which -c queries through <socket>
+    int opt;
+    int match_flags = 0;
+    char* index_path = NULL;
+    char* socket_path = NULL;
+    // The matching options, as a daemon's request (see daemon_serve)
+    index_buf_t request = { 0 };
+    // The predicates are long options with a single '-', as find's (single-letter options are still parsed as such)
+    static const struct option pred_options[] = {
+        { "size", required_argument, NULL, OPT_PRED + PRED_SIZE },
+        { "mtime", required_argument, NULL, OPT_PRED + PRED_MTIME },
+        { "uid", required_argument, NULL, OPT_PRED + PRED_UID },
+        { "newer", required_argument, NULL, OPT_PRED + PRED_NEWER },
+        { "type", required_argument, NULL, OPT_PRED + PRED_TYPE },
+        { NULL, 0, NULL, 0 },
+    };
+    int has_preds = 0;
+    preds_now = time(NULL);
+    matcher_init(&matcher);
+    matcher_init(&content_matcher);
+    while ((opt = getopt_long_only(argc, argv, "0b:q:d:c:e:it:g:r:s:D", pred_options, NULL)) != -1)
+    {
+        if (opt == 'b' || opt == 'q')
+        {
+            mode = (opt == 'b') ? MODE_BUILD : MODE_QUERY;
+            index_path = optarg;
+        }
+        else if (opt == 'd' || opt == 'c')
+        {
+            mode = (opt == 'd') ? MODE_DAEMON : MODE_CLIENT;
+            socket_path = optarg;
+        }
+        else if (opt == '0' || opt == 'i')
+        {
+            out_terminator = (opt == '0') ? '\0' : out_terminator;
+            match_flags |= (opt == 'i') ? MATCH_CASEFOLD : 0;
+            ret_val = index_buf_put(&request, (opt == '0') ? "0" : "i", 2);
+            error_handler_main(ret_val, "index_buf_put()");
+        }
+        else if (opt == 't' || opt == 'g' || opt == 'r')
+        {
+            ret_val = matcher_add(&matcher, (opt == 't') ? MATCH_LITERAL : (opt == 'g') ? MATCH_GLOB : MATCH_REGEX,
+                                  optarg);
+            error_handler_main(ret_val, "adding pattern");
+            char kind = opt;
+            ret_val = index_buf_put(&request, &kind, 1) || index_buf_put(&request, optarg, strlen(optarg) + 1);
+            error_handler_main(ret_val ? ENOMEM : SUCCESS, "index_buf_put()");
+        }
+        else if (opt >= OPT_PRED)
+        {
+            ret_val = pred_parse(opt - OPT_PRED, optarg);
+            error_handler_main(ret_val, "predicate");
+            has_preds = 1;
+        }
+        else if (opt == 'D')
+        {
+            dedupe = 1;
+        }
+        else if (opt == 's')
+        {
+            ret_val = matcher_add(&content_matcher, MATCH_LITERAL, optarg);
+            error_handler_main(ret_val, "adding content pattern");
+            content_search = 1;
+        }
+        else if (opt == 'e' && strcmp(optarg, "auto") == 0)
+        {
+            engine = ENGINE_AUTO;
+        }
+        else if (opt == 'e' && strcmp(optarg, "sync") == 0)
+        {
+            engine = ENGINE_SYNC;
+        }
+        else if (opt == 'e' && strcmp(optarg, "uring") == 0)
+        {
+            engine = ENGINE_URING;
+        }
+        else
+        {
+            error_handler_main(EINVAL, "options");
+        }
+    }
+    // Building an index (-b / -d) takes no term, querying one (-q / -c) takes no root nor threads
+    int has_root = (mode == MODE_SEARCH || mode == MODE_BUILD || mode == MODE_DAEMON);
+    int has_term = (mode != MODE_BUILD && mode != MODE_DAEMON);
+    error_handler_main(argc - optind != 2 * has_root + has_term, "arguments count");
+    // Contents and metadata are only looked at while searching the tree
+    error_handler_main(content_search && mode != MODE_SEARCH ? EINVAL : SUCCESS, "-s");
+    error_handler_main(has_preds && mode != MODE_SEARCH ? EINVAL : SUCCESS, "predicates");
+    error_handler_main(dedupe && (mode != MODE_SEARCH || content_search) ? EINVAL : SUCCESS, "-D");
+    // -D: candidates are grouped by size, and their inodes tell hardlinks
+    preds_mask |= dedupe ? STATX_SIZE | STATX_INO : 0;
+    char* root_arg = has_root ? argv[optind] : NULL;
+    char* term_arg = has_term ? argv[argc - 1 - has_root] : NULL;
+    char* threads_arg = has_root ? argv[argc - 1] : NULL;
+    if (mode == MODE_CLIENT)
+    {
+        // The daemon matches, so patterns are only checked there
+        ret_val = index_buf_put(&request, "t", 1) || index_buf_put(&request, term_arg, strlen(term_arg) + 1);
+        error_handler_main(ret_val ? ENOMEM : SUCCESS, "index_buf_put()");
+        daemon_query(socket_path, &request);
+    }
+    index_buf_free(&request);
+    if (NULL != term_arg)
+    {
+        ret_val = matcher_add(&matcher, MATCH_LITERAL, term_arg);
+        error_handler_main(ret_val, "adding pattern");
+        // Patterns are compiled once, then shared (read-only) by all the threads
+        char regex_err[128];
+        ret_val = matcher_compile(&matcher, match_flags, regex_err, sizeof(regex_err));
+        error_handler_main(ret_val, ret_val == EINVAL ? regex_err : "compiling patterns");
+        ret_val = content_search ? matcher_compile(&content_matcher, match_flags, regex_err, sizeof(regex_err)) : 0;
+        error_handler_main(ret_val, "compiling content patterns");
+    }
+
+    if (mode == MODE_QUERY)
+    {
+        ret_val = index_open(index_path, &stored_index);
+        error_handler_main(ret_val, "index_open()");
+        char path[PATH_MAX];
+        size_t root_len = stored_index.header->root_len;
+        error_handler_main(root_len >= PATH_MAX ? ENAMETOOLONG : SUCCESS, "path length");
+        memcpy(path, stored_index.root, root_len);
+        query_t query = { &matcher, stdout, stderr, out_terminator, SUCCESS, NULL };
+        found_count = query_dir(&query, 0, path, root_len);
+        error_handler_main(query.error, query.error_msg);
+        index_close(&stored_index);
+        matcher_destroy(&matcher);
+        fprintf(out_terminator == '\n' ? stdout : stderr, "Done searching, found %ld files\n", found_count);
+        exit(SUCCESS);
+    }
+
     char* search_path = (char*) malloc(PATH_MAX * sizeof(*search_path));
     error_handler_main(search_path == NULL, "'search_path' malloc failed");
-    strcpy(search_path,argv[1]);
-    search_term = argv[2];
-    threads_count = atoi(argv[3]);
+    strcpy(search_path, root_arg);
+    threads_count = atoi(threads_arg);
     error_handler_main(threads_count <= 0, "argument thread-count");
 
+    uint32_t root_old_id = INDEX_NONE;
+    if (mode == MODE_BUILD)
+    {
+        // Refreshes the stored index if it's an index of the same root. A file that isn't an index is kept
+        ret_val = index_open(index_path, &stored_index);
+        error_handler_main(ret_val == ENOENT ? SUCCESS : ret_val, "index_open()");
+        if (ret_val == SUCCESS && stored_index.header->root_len == strlen(root_arg) &&
+            memcmp(stored_index.root, root_arg, stored_index.header->root_len) == 0)
+        {
+            root_old_id = 0;
+        }
+    }
+    if (mode == MODE_BUILD || mode == MODE_DAEMON)
+    {
+        // Indexing stats every directory anyway, and reads only those which changed, so it has little to batch
+        engine = ENGINE_SYNC;
+    }
+
+    // Falls back to the sync engine where io_uring is missing / disabled, unless io_uring was requested
+    if (engine != ENGINE_SYNC)
+    {
+        int uring_ok = uring_supported();
+        error_handler_main(engine == ENGINE_URING && !uring_ok ? ENOSYS : SUCCESS, "io_uring");
+        engine = uring_ok ? ENGINE_URING : ENGINE_SYNC;
+    }
+
 
     // --- Alloc Threads -----------------------------------------------
     threads = (pthread_t*) malloc(threads_count * sizeof(*threads));
     error_handler_main(NULL == threads, "malloc failed");
+    workers = (worker_t*) aligned_alloc(CACHE_LINE, threads_count * sizeof(*workers));
+    error_handler_main(NULL == workers, "aligned_alloc failed");
+    for (int t = 0; t < threads_count; ++t)
+    {
+        memset(&workers[t], 0, sizeof(workers[t]));
+        ret_val = deque_init(&workers[t].deque);
+        error_handler_main(ret_val, "deque_init()");
+        workers[t].chunk = NULL;
+        workers[t].id = t;
+        workers[t].rand_state = 2654435761U * (t + 1);
+        workers[t].out_buf = (char*) malloc(OUT_BUF_SIZE);
+        error_handler_main(NULL == workers[t].out_buf, "'out_buf' malloc failed");
+        workers[t].out_len = 0;
+        workers[t].found_count = 0;
+        workers[t].content_buf = (content_search || dedupe) ? (char*) malloc(CONTENT_PREAD_MAX) : NULL;
+        error_handler_main((content_search || dedupe) && NULL == workers[t].content_buf, "'content_buf' malloc failed");
+        workers[t].content_cap = CONTENT_PREAD_MAX;
+    }
 
     // --- Initialize Mutex Lock & Conditions---------------------------
     ret_val = pthread_mutex_init(&qLock, NULL);
     error_handler_main(ret_val, "pthread_mutex_init()");
-    ret_val = pthread_cond_init(&qNotEmpty, NULL);
-    error_handler_main(ret_val, "pthread_cond_init() - qNotEmpty");
+    ret_val = pthread_mutex_init(&outLock, NULL);
+    error_handler_main(ret_val, "pthread_mutex_init() - outLock");
+    ret_val = pthread_mutex_init(&idleLock, NULL);
+    error_handler_main(ret_val, "pthread_mutex_init() - idleLock");
+    ret_val = pthread_cond_init(&fWorkAvailable, NULL);
+    error_handler_main(ret_val, "pthread_cond_init() - fWorkAvailable");
     ret_val = pthread_cond_init(&fThreadWasCreated, NULL);
     error_handler_main(ret_val, "pthread_cond_init() - fThreadWasCreated");
     ret_val = pthread_cond_init(&fAllThreadsCreated, NULL);
     error_handler_main(ret_val, "pthread_cond_init() - fAllThreadsCreated");
 
     // --- Create Queue ---------------------------
-    // Creates queue if the path is searchable (otherwise queue remains empty)
+    // Pushes the root to the first thread's deque if the path is searchable (the others will steal from it)
     struct stat sb;
     ret_val = lstat(search_path, &sb);
     error_handler_main(ret_val, "lstat()");
-    if (is_searchable(search_path) == SUCCESS)
+    if (is_searchable(AT_FDCWD, search_path) == SUCCESS)
     {
-        ret_val = enqueue(search_path);
+        name_node_t* root = node_new(&workers[0], NULL, search_path, strlen(search_path));
+        error_handler_main(NULL == root ? ENOMEM : SUCCESS, "Allocating initial node");
+        root->old_id = root_old_id;
+        ret_val = enqueue(&workers[0], root);
         error_handler_main(ret_val, "Enqueuing initial path");
+        // -type d: the root is a match too, as in find, tested by its last component (e.g. 'big' of '/tmp/big/')
+        if ((pred_types & (1u << DT_DIR)) && S_ISDIR(sb.st_mode) && !content_search && !dedupe)
+        {
+            size_t root_len = strlen(search_path);
+            char root_name[PATH_MAX];
+            while (root_len > 1 && search_path[root_len - 1] == '/')
+            {
+                root_len--;
+            }
+            const char* name_start = memrchr(search_path, '/', root_len - 1);
+            name_start = (NULL != name_start) ? name_start + 1 : search_path;
+            memcpy(root_name, name_start, root_len - (name_start - search_path));
+            root_name[root_len - (name_start - search_path)] = '\0';
+            struct statx root_stx;
+            ret_val = preds_count ? statx(AT_FDCWD, search_path, AT_SYMLINK_NOFOLLOW, preds_mask, &root_stx) : 0;
+            error_handler_main(ret_val, "statx()");
+            if (matcher_match(&matcher, root_name) && preds_match(AT_FDCWD, search_path, DT_DIR, &root_stx))
+            {
+                out_write(&workers[0], search_path, strlen(search_path));
+                out_write(&workers[0], &out_terminator, 1);
+                workers[0].found_count++;
+            }
+        }
+        free(search_path);
     }
     else
     { // given dir is not searchable
-        printf("Directory %s: Permission denied.\n", search_path);
+        fprintf(out_terminator == '\n' ? stdout : stderr, "Directory %s: Permission denied.\n", search_path);
         // Due to ambiguity in the instructions, I chose to consider this case as an error
         exit(MAIN_THREAD_ERR_EXIT_CODE);
     }
@@ -337,7 +3164,7 @@ int main(int argc, char* argv[])
     // --- Launch threads ------------------------------
     for (long t = 0; t < threads_count; ++t)
     {
-        ret_val = pthread_create(&threads[t], NULL, search_queue, NULL);
+        ret_val = pthread_create(&threads[t], NULL, search_queue, &workers[t]);
         error_handler_main(ret_val, "pthread_create()");
     }
     pthread_mutex_lock(&qLock);
@@ -358,11 +3185,85 @@ int main(int argc, char* argv[])
         error_handler_main(ret_val, "pthread_join()");
     }
 
+    // --- Write the index ------------------------------
+    if (mode == MODE_BUILD && !thread_encountered_err_flag)
+    {
+        // Gathers the directories indexed by all the threads, by id
+        uint32_t dirs_count = atomic_load(&index_dirs_count);
+        index_dir_t* dirs = (index_dir_t*) malloc(dirs_count * sizeof(*dirs));
+        const char** entries = (const char**) malloc(dirs_count * sizeof(*entries));
+        error_handler_main(NULL == dirs || NULL == entries, "malloc failed");
+        long reread_count = 0;
+        for (int t = 0; t < threads_count; ++t)
+        {
+            index_built_t* built = (index_built_t*) workers[t].index_dirs.data;
+            size_t built_count = workers[t].index_dirs.len / sizeof(*built);
+            for (size_t i = 0; i < built_count; ++i)
+            {
+                dirs[built[i].id] = built[i].dir;
+                entries[built[i].id] = workers[t].index_entries.data + built[i].dir.entries_offset;
+            }
+            reread_count += workers[t].reread_count;
+        }
+        ret_val = index_write(index_path, root_arg, dirs, dirs_count, entries);
+        error_handler_main(ret_val, "index_write()");
+        uint64_t entries_count = 0;
+        for (uint32_t i = 0; i < dirs_count; ++i)
+        {
+            entries_count += dirs[i].entries_count;
+        }
+        printf("Indexed %u directories, %lu entries (%ld directories read, the others unchanged)\n", dirs_count,
+               (unsigned long) entries_count, reread_count);
+        free(dirs);
+        free(entries);
+    }
+
+    if (dedupe)
+    {
+        dedupe_run(threads);
+    }
+
+    if (mode == MODE_DAEMON)
+    {
+        error_handler_main(thread_encountered_err_flag ? ECANCELED : SUCCESS, "indexing");
+        daemon_run(socket_path, root_arg);
+    }
+
     // ---  Epilogue -----------------------------------
+    for (int t = 0; t < threads_count; ++t)
+    {
+        // Whatever output the thread hasn't written yet, and its matches
+        ret_val = out_flush(&workers[t]);
+        error_handler_main(ret_val, "write()");
+        free(workers[t].out_buf);
+        free(workers[t].content_buf);
+        found_count += workers[t].found_count;
+        index_buf_free(&workers[t].index_entries);
+        index_buf_free(&workers[t].index_dirs);
+        index_buf_free(&workers[t].scratch_names);
+        index_buf_free(&workers[t].scratch_entries);
+        index_buf_free(&workers[t].dupes);
+        index_buf_free(&workers[t].dupe_paths);
+        deque_destroy(&workers[t].deque);
+        if (NULL != workers[t].chunk)
+        {
+            // Every node was freed by now, so the thread's own reference was the chunk's last
+            chunk_put(workers[t].chunk);
+        }
+    }
+    free(workers);
     free(threads);
     pthread_mutex_destroy(&qLock);
+    pthread_mutex_destroy(&outLock);
+    pthread_mutex_destroy(&idleLock);
+    matcher_destroy(&matcher);
+    matcher_destroy(&content_matcher);
+    index_close(&stored_index);
 
-    printf("Done searching, found %d files\n", found_count);
+    if (mode == MODE_SEARCH && !dedupe)
+    {
+        fprintf(out_terminator == '\n' ? stdout : stderr, "Done searching, found %ld files\n", found_count);
+    }
 
     if(thread_encountered_err_flag)
     {
@@ -0,0 +1,106 @@
+#!/bin/bash
+#
+# --- PFIND BENCHMARK ---
+# Usage: ./pfind_bench.sh threads|engines <pfind-binary> [tree-dir] [max-threads] [runs]
+#   threads - runs the search with 1, 2, 4, ... up to max-threads (defaults to 2 * nproc) threads,
+#             and reports the best wall time of 'runs' (defaults to 5) runs and the speedup over 1 thread.
+#   engines - same, for each of pfind's engines (-e sync, -e uring).
+# Without a tree-dir, searches a synthetic tree (fanout 16, depth 4: ~70K directories and ~280K files),
+# generated once under $TMPDIR.
+# The tree is searched once before measuring, so all runs find it in the page / dentry caches. With COLD=1 (as root),
+# caches are dropped before every run instead, which is where batching requests (-e uring) pays off.
+
+set -e
+
+usage()
+{
+    echo "Usage: $0 threads|engines <pfind-binary> [tree-dir] [max-threads] [runs]" >&2
+    exit 1
+}
+
+# Options passed to pfind (before its arguments)
+pfind_opts=()
+
+# Current monotonic-ish time in nanoseconds
+now_ns()
+{
+    date +%s%N
+}
+
+# gen_tree <dir> <fanout> <depth>: 'fanout' subdirectories per directory, each with 4 files.
+# Built level by level, with a few mkdir / touch processes per level (via xargs)
+gen_tree()
+{
+    local dir=$1 fanout=$2 depth=$3
+    local level="$dir/levels"
+    mkdir -p "$dir"
+    echo "$dir" > "$level.0"
+    for ((d = 1; d <= depth; d++)); do
+        while read -r parent; do
+            for ((i = 1; i <= fanout; i++)); do
+                echo "$parent/d$i"
+            done
+        done < "$level.$((d - 1))" > "$level.$d"
+        xargs mkdir -p < "$level.$d"
+    done
+    for ((d = 0; d <= depth; d++)); do
+        sed "s|\$|/a.txt|; p; s|a.txt\$|b.c|; p; s|b.c\$|needle_$d|; p; s|needle_$d\$|README|" "$level.$d" | xargs touch
+    done
+    rm -f "$level".*
+}
+
+bench_threads()
+{
+    local pfind=$1 tree=$2 max_threads=$3 runs=$4
+    local base_ns=0
+
+    "$pfind" "${pfind_opts[@]}" "$tree" needle 1 > /dev/null
+    printf "%8s %14s %10s\n" "threads" "best ms" "speedup"
+    for ((threads = 1; threads <= max_threads; threads *= 2)); do
+        local best_ns=0
+        for ((run = 0; run < runs; run++)); do
+            if [ "${COLD:-0}" = 1 ]; then
+                sync
+                echo 3 > /proc/sys/vm/drop_caches
+            fi
+            local start=$(now_ns)
+            "$pfind" "${pfind_opts[@]}" "$tree" needle "$threads" > /dev/null
+            local elapsed=$(($(now_ns) - start))
+            if [ "$best_ns" -eq 0 ] || [ "$elapsed" -lt "$best_ns" ]; then
+                best_ns=$elapsed
+            fi
+        done
+        if [ "$threads" -eq 1 ]; then
+            base_ns=$best_ns
+        fi
+        awk -v t="$threads" -v ns="$best_ns" -v base="$base_ns" \
+            'BEGIN { printf "%8d %14.1f %10.2f\n", t, ns / 1e6, base / ns }'
+    done
+}
+
+[ $# -ge 2 ] || usage
+mode=$1
+pfind=$2
+tree=${3:-}
+max_threads=${4:-$((2 * $(nproc)))}
+runs=${5:-5}
+
+if [ -z "$tree" ]; then
+    tree="${TMPDIR:-/tmp}/pfind_bench_tree"
+    if [ ! -d "$tree" ]; then
+        echo "-- generating $tree --"
+        gen_tree "$tree" 16 4
+    fi
+fi
+
+case "$mode" in
+    threads) bench_threads "$pfind" "$tree" "$max_threads" "$runs" ;;
+    engines)
+        for engine in sync uring; do
+            echo "-- engine: $engine --"
+            pfind_opts=(-e "$engine")
+            bench_threads "$pfind" "$tree" "$max_threads" "$runs"
+        done
+        ;;
+    *) usage ;;
+esac
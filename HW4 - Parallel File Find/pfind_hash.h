@@ -0,0 +1,163 @@
+#ifndef PFIND_HASH_H
+#define PFIND_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * --- CONTENT HASH ---
+ * XXH64 (xxHash, 64 bits), computed incrementally: hash_init(), hash_update() with the data in any number of pieces,
+ * then hash_digest(). It consumes 32 bytes per step, as 4 independent lanes of 8 bytes (multiply / rotate), so it
+ * runs at memory speed, far faster than reading the files it's used on (pfind -D).
+ * Words are read in native byte order, which is XXH64's own on little-endian machines: hashes are only compared
+ * within a run.
+ */
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+#define HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME_5 0x27D4EB2F165667C5ULL
+
+typedef struct hash_state_st
+{
+    uint64_t lanes[4];
+    uint64_t seed;
+    uint64_t total_len;
+    // Input not consumed yet (less than a step)
+    unsigned char pending[32];
+    size_t pending_len;
+} hash_state_t;
+
+//================== HELPERS ===========================
+static inline uint64_t hash_rotl(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t hash_read64(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash_read32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * HASH_PRIME_2;
+    acc = hash_rotl(acc, 31);
+    return acc * HASH_PRIME_1;
+}
+
+static inline uint64_t hash_merge_round(uint64_t acc, uint64_t lane)
+{
+    acc ^= hash_round(0, lane);
+    return acc * HASH_PRIME_1 + HASH_PRIME_4;
+}
+
+// Consumes a 32-bytes step
+static inline void hash_step(hash_state_t* state, const unsigned char* p)
+{
+    state->lanes[0] = hash_round(state->lanes[0], hash_read64(p));
+    state->lanes[1] = hash_round(state->lanes[1], hash_read64(p + 8));
+    state->lanes[2] = hash_round(state->lanes[2], hash_read64(p + 16));
+    state->lanes[3] = hash_round(state->lanes[3], hash_read64(p + 24));
+}
+
+//================== HASHING ===========================
+static void hash_init(hash_state_t* state, uint64_t seed)
+{
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->lanes[0] = seed + HASH_PRIME_1 + HASH_PRIME_2;
+    state->lanes[1] = seed + HASH_PRIME_2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - HASH_PRIME_1;
+}
+
+static void hash_update(hash_state_t* state, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*) data;
+
+    state->total_len += len;
+    if (state->pending_len + len < sizeof(state->pending))
+    {
+        memcpy(state->pending + state->pending_len, p, len);
+        state->pending_len += len;
+        return;
+    }
+    if (state->pending_len > 0)
+    {
+        size_t fill = sizeof(state->pending) - state->pending_len;
+        memcpy(state->pending + state->pending_len, p, fill);
+        hash_step(state, state->pending);
+        p += fill;
+        len -= fill;
+        state->pending_len = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32)
+    {
+        hash_step(state, p);
+    }
+    memcpy(state->pending, p, len);
+    state->pending_len = len;
+}
+
+static uint64_t hash_digest(const hash_state_t* state)
+{
+    const unsigned char* p = state->pending;
+    size_t len = state->pending_len;
+    uint64_t h;
+
+    if (state->total_len >= 32)
+    {
+        const uint64_t* lanes = state->lanes;
+        h = hash_rotl(lanes[0], 1) + hash_rotl(lanes[1], 7) + hash_rotl(lanes[2], 12) + hash_rotl(lanes[3], 18);
+        for (int i = 0; i < 4; ++i)
+        {
+            h = hash_merge_round(h, lanes[i]);
+        }
+    }
+    else
+    {
+        h = state->seed + HASH_PRIME_5;
+    }
+    h += state->total_len;
+
+    // The pending tail: 8, then 4, then single bytes at a time
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        h ^= hash_round(0, hash_read64(p));
+        h = hash_rotl(h, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+    }
+    if (len >= 4)
+    {
+        h ^= (uint64_t) hash_read32(p) * HASH_PRIME_1;
+        h = hash_rotl(h, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; ++p, --len)
+    {
+        h ^= *p * HASH_PRIME_5;
+        h = hash_rotl(h, 11) * HASH_PRIME_1;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= HASH_PRIME_2;
+    h ^= h >> 29;
+    h *= HASH_PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+#endif
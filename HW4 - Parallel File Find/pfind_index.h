@@ -0,0 +1,372 @@
+#ifndef PFIND_INDEX_H
+#define PFIND_INDEX_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * --- FILENAME INDEX ---
+ * On-disk snapshot of a directory tree (built by pfind -b), which queries (pfind -q) search instead of the tree.
+ * The file is mmap()-ed as is (native byte order):
+ *     index_header_t
+ *     the root's path ('root_len' bytes, no '\0')
+ *     index_dir_t[dirs_count], at 'dirs_offset' (8-bytes aligned), indexed by directory id. The root's id is 0,
+ *     and every directory's id is greater than its parent's
+ *     the directories' entries, at 'entries_offset', each directory's entries back to back
+ *
+ * * Front-Coding Explained: *
+ * A directory's entries are sorted by name, and each stores only what its name doesn't share with the previous
+ * entry's name (of the same directory):
+ *     type (1 byte) | shared prefix length (1 byte) | suffix length (1 byte) | suffix | child (4 bytes, INDEX_DIR only)
+ * Names within a directory tend to share long prefixes ("IMG_2041.jpg", "IMG_2042.jpg", ...), so the table is a
+ * fraction of the names' size, and decoding a directory is a single sequential pass (index_cursor_next).
+ * Every directory records its mtime and ctime, so a refresh only re-reads directories which changed since.
+ */
+
+#define INDEX_MAGIC "PFINDX01"
+// Id of no directory (e.g. of a directory which isn't in an index yet)
+#define INDEX_NONE UINT32_MAX
+
+// Entry types
+#define INDEX_FILE 0 // anything but a directory (symlinks included)
+#define INDEX_DIR 1 // a searchable directory, indexed as 'child'
+#define INDEX_DENIED 2 // a directory without read / search permission (for whoever built the index)
+
+typedef struct index_header_st
+{
+    char magic[8];
+    uint32_t root_len;
+    uint32_t dirs_count;
+    uint64_t entries_count;
+    uint64_t dirs_offset;
+    uint64_t entries_offset;
+    uint64_t file_size;
+} index_header_t;
+
+typedef struct index_dir_st
+{
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t entries_offset; // of its first entry, relative to the header's 'entries_offset'
+    uint32_t entries_len; // bytes
+    uint32_t entries_count;
+} index_dir_t;
+
+// A mapped index
+typedef struct index_st
+{
+    void* base;
+    size_t size;
+    const index_header_t* header;
+    const char* root;
+    const index_dir_t* dirs;
+    const unsigned char* entries;
+} index_t;
+
+// Decodes a directory's entries one by one
+typedef struct index_cursor_st
+{
+    const unsigned char* pos;
+    const unsigned char* end;
+    uint32_t dirs_count;
+    int type;
+    uint32_t child;
+    unsigned int name_len;
+    char name[UINT8_MAX + 1];
+} index_cursor_t;
+
+// Growable buffer, which the entries are encoded into
+typedef struct index_buf_st
+{
+    char* data;
+    size_t len;
+    size_t cap;
+} index_buf_t;
+
+//================== ENCODING ===========================
+// Appends 'len' bytes to the buffer, returns 0 or ENOMEM
+static int index_buf_put(index_buf_t* buf, const void* data, size_t len)
+{
+    if (buf->len + len > buf->cap)
+    {
+        size_t cap = (buf->cap > 0) ? buf->cap : 4096;
+        while (cap < buf->len + len)
+        {
+            cap *= 2;
+        }
+        char* new_data = (char*) realloc(buf->data, cap);
+        if (NULL == new_data)
+        {
+            return ENOMEM;
+        }
+        buf->data = new_data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static void index_buf_free(index_buf_t* buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/*
+ * Appends an entry, following the entry named 'prev' (of 'prev_len' bytes, 0 for the directory's first entry).
+ * Returns 0 or some ERRNO
+ */
+static int index_encode(index_buf_t* buf, const char* prev, size_t prev_len, const char* name, size_t len, int type,
+                        uint32_t child)
+{
+    unsigned char head[3];
+    size_t shared = 0;
+
+    if (len > UINT8_MAX)
+    {
+        return ENAMETOOLONG;
+    }
+    while (shared < prev_len && shared < len && prev[shared] == name[shared])
+    {
+        shared++;
+    }
+    head[0] = type;
+    head[1] = shared;
+    head[2] = len - shared;
+    if (index_buf_put(buf, head, sizeof(head)) != 0 || index_buf_put(buf, name + shared, len - shared) != 0 ||
+        (type == INDEX_DIR && index_buf_put(buf, &child, sizeof(child)) != 0))
+    {
+        return ENOMEM;
+    }
+    return 0;
+}
+
+//================== DECODING ===========================
+// Starts decoding the encoded entries at 'entries' ('len' bytes), of an index of 'dirs_count' directories
+static void index_cursor_set(index_cursor_t* cursor, const void* entries, size_t len, uint32_t dirs_count)
+{
+    cursor->pos = (const unsigned char*) entries;
+    cursor->end = cursor->pos + len;
+    cursor->dirs_count = dirs_count;
+    cursor->name_len = 0;
+}
+
+static void index_cursor_init(const index_t* index, uint32_t dir_id, index_cursor_t* cursor)
+{
+    const index_dir_t* dir = &index->dirs[dir_id];
+    index_cursor_set(cursor, index->entries + dir->entries_offset, dir->entries_len, index->header->dirs_count);
+}
+
+/*
+ * Decodes the next entry into the cursor ('name' is NUL-terminated).
+ * Returns 1 for an entry, 0 past the last one, or -1 if the entries are corrupt
+ */
+static int index_cursor_next(index_cursor_t* cursor)
+{
+    if (cursor->pos == cursor->end)
+    {
+        return 0;
+    }
+    if (cursor->end - cursor->pos < 3)
+    {
+        return -1;
+    }
+    unsigned int type = cursor->pos[0];
+    unsigned int shared = cursor->pos[1];
+    unsigned int suffix = cursor->pos[2];
+    cursor->pos += 3;
+    if (type > INDEX_DENIED || shared > cursor->name_len || shared + suffix > UINT8_MAX ||
+        (size_t) (cursor->end - cursor->pos) < suffix + (type == INDEX_DIR ? sizeof(uint32_t) : 0))
+    {
+        return -1;
+    }
+    memcpy(cursor->name + shared, cursor->pos, suffix);
+    cursor->pos += suffix;
+    cursor->name_len = shared + suffix;
+    cursor->name[cursor->name_len] = '\0';
+    cursor->type = type;
+    cursor->child = INDEX_NONE;
+    if (type == INDEX_DIR)
+    {
+        memcpy(&cursor->child, cursor->pos, sizeof(cursor->child));
+        cursor->pos += sizeof(cursor->child);
+        if (cursor->child == 0 || cursor->child >= cursor->dirs_count)
+        {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+//================== INDEX FILES ===========================
+/*
+ * Maps the index file at 'path' and checks its layout.
+ * Returns 0 or some ERRNO (EINVAL for a file which isn't a valid index). index_close() it either way
+ */
+static int index_open(const char* path, index_t* index)
+{
+    struct stat sb;
+    int err = 0;
+
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+    if (fstat(fd, &sb) != 0)
+    {
+        err = errno;
+        close(fd);
+        return err;
+    }
+    if ((size_t) sb.st_size < sizeof(index_header_t))
+    {
+        close(fd);
+        return EINVAL;
+    }
+    index->size = sb.st_size;
+    index->base = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    err = errno;
+    close(fd);
+    if (MAP_FAILED == index->base)
+    {
+        index->base = NULL;
+        return err;
+    }
+
+    const index_header_t* header = (const index_header_t*) index->base;
+    index->header = header;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 || header->file_size != index->size ||
+        header->dirs_count == 0 || header->dirs_offset % 8 != 0 || header->dirs_offset > index->size ||
+        header->dirs_offset < sizeof(*header) + header->root_len ||
+        header->entries_offset != header->dirs_offset + (uint64_t) header->dirs_count * sizeof(index_dir_t) ||
+        header->entries_offset > index->size)
+    {
+        return EINVAL;
+    }
+    index->root = (const char*) index->base + sizeof(*header);
+    index->dirs = (const index_dir_t*) ((const char*) index->base + header->dirs_offset);
+    index->entries = (const unsigned char*) index->base + header->entries_offset;
+    // Every directory's entries must lie within the file (their contents are checked while decoding)
+    for (uint32_t i = 0; i < header->dirs_count; ++i)
+    {
+        if (index->dirs[i].entries_offset + index->dirs[i].entries_len > index->size - header->entries_offset)
+        {
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+static void index_close(index_t* index)
+{
+    if (NULL != index->base)
+    {
+        munmap(index->base, index->size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+// Writes all 'len' bytes, returns 0 or some ERRNO
+static int index_write_all(int fd, const void* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret_val = write(fd, data, len);
+        if (ret_val < 0 && errno != EINTR)
+        {
+            return errno;
+        }
+        if (ret_val > 0)
+        {
+            data = (const char*) data + ret_val;
+            len -= ret_val;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes an index of the given directories ('dirs_count', their 'entries_offset' is set here), each with its
+ * 'entries[i]' of 'dirs[i].entries_len' bytes. The file is written aside and then renamed over 'path', so a
+ * mapping of the previous index stays valid (and readers never see a partial index).
+ * Returns 0 or some ERRNO
+ */
+static int index_write(const char* path, const char* root, index_dir_t* dirs, uint32_t dirs_count,
+                       const char* const* entries)
+{
+    index_header_t header;
+    char tmp_path[PATH_MAX];
+    char pad[8] = { 0 };
+    int err;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.root_len = strlen(root);
+    header.dirs_count = dirs_count;
+    header.dirs_offset = (sizeof(header) + header.root_len + 7) & ~(uint64_t) 7;
+    header.entries_offset = header.dirs_offset + (uint64_t) dirs_count * sizeof(index_dir_t);
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < dirs_count; ++i)
+    {
+        dirs[i].entries_offset = offset;
+        offset += dirs[i].entries_len;
+        header.entries_count += dirs[i].entries_count;
+    }
+    header.file_size = header.entries_offset + offset;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int) sizeof(tmp_path))
+    {
+        return ENAMETOOLONG;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return errno;
+    }
+    err = index_write_all(fd, &header, sizeof(header));
+    err = err ? err : index_write_all(fd, root, header.root_len);
+    err = err ? err : index_write_all(fd, pad, header.dirs_offset - sizeof(header) - header.root_len);
+    err = err ? err : index_write_all(fd, dirs, (size_t) dirs_count * sizeof(index_dir_t));
+    // Consecutive directories' entries usually lie back to back in memory (those of a thread), so they're
+    // written in runs, each with a single write()
+    for (uint32_t i = 0; i < dirs_count && !err;)
+    {
+        const char* run = entries[i];
+        size_t run_len = 0;
+        while (i < dirs_count && entries[i] == run + run_len)
+        {
+            run_len += dirs[i++].entries_len;
+        }
+        err = index_write_all(fd, run, run_len);
+    }
+    if (!err && fsync(fd) != 0)
+    {
+        err = errno;
+    }
+    if (close(fd) != 0 && !err)
+    {
+        err = errno;
+    }
+    if (!err && rename(tmp_path, path) != 0)
+    {
+        err = errno;
+    }
+    if (err)
+    {
+        unlink(tmp_path);
+    }
+    return err;
+}
+
+#endif
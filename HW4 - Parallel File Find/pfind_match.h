@@ -0,0 +1,642 @@
+#ifndef PFIND_MATCH_H
+#define PFIND_MATCH_H
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * --- NAME MATCHING ENGINE ---
+ * Matches file names against a set of patterns, a name matches if any of the patterns does:
+ *     MATCH_LITERAL - the pattern is a substring of the name
+ *     MATCH_GLOB    - the whole name matches the shell pattern (fnmatch)
+ *     MATCH_REGEX   - the name matches the POSIX extended regex (anchor it with ^ / $ to match the whole name)
+ * Patterns are added, then compiled once (matcher_compile), after which matcher_match() may be called
+ * by any number of threads concurrently.
+ *
+ * * Compiled-Matcher Explained: *
+ * All literals are compiled into one Aho-Corasick automaton, resolved into a DFA: a name is scanned once, a byte
+ * at a time with a single table lookup per byte, however many literals there are. Bytes that appear in no
+ * literal share one column of the table (byte classes), which keeps the table small enough for the L1 cache.
+ * Globs and regexes are checked by fnmatch / regexec, which are much slower, so each is prefiltered by a literal
+ * it requires (its longest run of plain characters, e.g. "report" for "*report*.pdf"): that literal is added to
+ * the automaton, and the pattern itself is only checked for names where the automaton found it.
+ * Case folding (MATCH_CASEFOLD) folds the literals once at compile time, and folds names while scanning
+ * (within the byte-class table).
+ * A single literal without case folding skips the automaton altogether for strstr(), which is vectorized by libc
+ * (and, unlike memmem(), doesn't need the name's length up front).
+ * A matcher of literals only can also search a buffer (e.g. a file's contents, '\0's included) for the first
+ * occurrence of any of them (matcher_find): with memmem() for a single literal, the automaton otherwise. While the
+ * automaton is in its root state, it skips to the next byte some key starts with, with memchr() (per such byte), so
+ * it only steps through the bytes that may be part of an occurrence.
+ */
+
+#define MATCH_LITERAL 0
+#define MATCH_GLOB 1
+#define MATCH_REGEX 2
+
+// Flags of matcher_compile()
+#define MATCH_CASEFOLD 1
+
+// Bound on patterns per matcher
+#define MATCH_MAX_PATTERNS 1024
+// Bound on the distinct first bytes of the keys, for matcher_find() to skip to them with memchr()
+#define MATCH_SKIP_BYTES 8
+
+typedef struct match_pattern_st
+{
+    int kind;
+    char* text;
+    // The literal the automaton looks for (a copy of 'text' for literals, a required factor otherwise).
+    // NULL if the pattern has no such factor, so it's checked against every name
+    char* key;
+    regex_t regex;
+} match_pattern_t;
+
+// Entry of a state's outputs list: the pattern whose key ends at the state
+typedef struct match_output_st
+{
+    int pattern;
+    int next; // next entry of the same state, or -1
+} match_output_t;
+
+typedef struct matcher_st
+{
+    match_pattern_t* patterns;
+    int patterns_count;
+    int flags;
+    // 1 IFF some literal is empty, i.e. every name matches
+    int match_all;
+    // Single literal, without case folding: matched with strstr()
+    int single_literal;
+    // The bytes keys start with (both cases, with case folding), if there are at most MATCH_SKIP_BYTES of them
+    unsigned char skip_bytes[MATCH_SKIP_BYTES];
+    int skip_count;
+
+    // The automaton: next_state = delta[state * classes_count + byte_class[byte]], state 0 is the root
+    uint8_t byte_class[256];
+    int classes_count;
+    int states_count;
+    int32_t* delta;
+    // First state (the state itself, or one of its fail-ancestors) whose outputs should be reported
+    // when the automaton reaches the state, or -1 if none
+    int32_t* report;
+    // Head of each state's own outputs list (index into 'outputs'), or -1
+    int32_t* out_first;
+    // Next fail-ancestor with outputs, or -1
+    int32_t* dict_link;
+    match_output_t* outputs;
+    int outputs_count;
+
+    // Patterns without a key (checked against every name)
+    int* unkeyed;
+    int unkeyed_count;
+} matcher_t;
+
+//================== HELPERS ===========================
+static inline unsigned char match_fold(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Longest run of plain characters of a glob (those outside brackets, after no '\\'), as a new string, or NULL
+static char* glob_factor(const char* glob)
+{
+    const char* best = NULL;
+    size_t best_len = 0;
+    const char* run = glob;
+    const char* p = glob;
+
+    while (1)
+    {
+        if (*p == '\0' || *p == '*' || *p == '?' || *p == '[' || *p == '\\')
+        {
+            if ((size_t) (p - run) > best_len)
+            {
+                best = run;
+                best_len = p - run;
+            }
+            if (*p == '\0')
+            {
+                break;
+            }
+            if (*p == '[')
+            {
+                // Skips the bracket expression ("[]...]" and "[!]...]" include the ']')
+                p++;
+                if (*p == '!' || *p == '^')
+                {
+                    p++;
+                }
+                if (*p == ']')
+                {
+                    p++;
+                }
+                while (*p != '\0' && *p != ']')
+                {
+                    p++;
+                }
+                if (*p == '\0')
+                {
+                    break;
+                }
+            }
+            else if (*p == '\\' && p[1] != '\0')
+            {
+                // An escaped character is plain, but starts a new run (the '\\' isn't part of the name)
+                p++;
+            }
+            run = p + 1;
+        }
+        p++;
+    }
+    return (best_len > 0) ? strndup(best, best_len) : NULL;
+}
+
+/*
+ * Longest run of plain characters of an extended regex, which every match must contain, as a new string, or NULL.
+ * Only runs outside groups count (a group may be optional), and patterns with alternation ('|') have none.
+ * A character followed by a quantifier is optional / repeated, so it ends the run (without being part of it).
+ */
+static char* regex_factor(const char* regex)
+{
+    const char* best = NULL;
+    size_t best_len = 0;
+    const char* run = regex;
+    const char* p = regex;
+    int depth = 0;
+
+    if (strchr(regex, '|') != NULL)
+    {
+        return NULL;
+    }
+    while (1)
+    {
+        int special = (*p == '\0' || strchr(".[]()^$*+?{}\\", *p) != NULL);
+        int quantified = (!special && p[1] != '\0' && strchr("*+?{", p[1]) != NULL);
+        if (special || quantified || depth > 0)
+        {
+            if (depth == 0 && (size_t) (p - run) > best_len)
+            {
+                best = run;
+                best_len = p - run;
+            }
+            if (*p == '\0')
+            {
+                break;
+            }
+            if (*p == '[')
+            {
+                p++;
+                if (*p == '^')
+                {
+                    p++;
+                }
+                if (*p == ']')
+                {
+                    p++;
+                }
+                while (*p != '\0' && *p != ']')
+                {
+                    p++;
+                }
+                if (*p == '\0')
+                {
+                    break;
+                }
+            }
+            else if (*p == '\\' && p[1] != '\0')
+            {
+                p++;
+            }
+            else if (*p == '(')
+            {
+                depth++;
+            }
+            else if (*p == ')' && depth > 0)
+            {
+                depth--;
+            }
+            run = p + 1;
+        }
+        p++;
+    }
+    return (best_len > 0) ? strndup(best, best_len) : NULL;
+}
+
+//================== MATCHER FUNCTIONS ===========================
+static void matcher_init(matcher_t* matcher)
+{
+    memset(matcher, 0, sizeof(*matcher));
+}
+
+/*
+ * Adds a pattern of the given kind (MATCH_LITERAL / MATCH_GLOB / MATCH_REGEX), before matcher_compile().
+ * Returns 0 or some ERRNO
+ */
+static int matcher_add(matcher_t* matcher, int kind, const char* text)
+{
+    if (matcher->patterns_count == MATCH_MAX_PATTERNS || kind < MATCH_LITERAL || kind > MATCH_REGEX)
+    {
+        return EINVAL;
+    }
+    match_pattern_t* patterns = (match_pattern_t*) realloc(matcher->patterns,
+                                                           (matcher->patterns_count + 1) * sizeof(*patterns));
+    if (NULL == patterns)
+    {
+        return ENOMEM;
+    }
+    matcher->patterns = patterns;
+    match_pattern_t* pattern = &patterns[matcher->patterns_count];
+    memset(pattern, 0, sizeof(*pattern));
+    pattern->kind = kind;
+    pattern->text = strdup(text);
+    if (NULL == pattern->text)
+    {
+        return ENOMEM;
+    }
+    matcher->patterns_count++;
+    return 0;
+}
+
+/*
+ * Builds the automaton out of the patterns' keys. Returns 0 or some ERRNO (EINVAL for an invalid regex,
+ * in which case 'err_buf' describes it)
+ */
+static int matcher_compile(matcher_t* matcher, int flags, char* err_buf, size_t err_len)
+{
+    int casefold = flags & MATCH_CASEFOLD;
+    size_t total_len = 0;
+    int ret_val;
+
+    matcher->flags = flags;
+    matcher->unkeyed = (int*) calloc(matcher->patterns_count + 1, sizeof(int));
+    if (NULL == matcher->unkeyed)
+    {
+        return ENOMEM;
+    }
+
+    // --- Keys, and the patterns' own compilation -----------
+    for (int i = 0; i < matcher->patterns_count; ++i)
+    {
+        match_pattern_t* pattern = &matcher->patterns[i];
+        if (pattern->kind == MATCH_LITERAL)
+        {
+            pattern->key = strdup(pattern->text);
+            if (NULL == pattern->key)
+            {
+                return ENOMEM;
+            }
+            if (pattern->key[0] == '\0')
+            {
+                matcher->match_all = 1;
+            }
+        }
+        else if (pattern->kind == MATCH_GLOB)
+        {
+            pattern->key = glob_factor(pattern->text);
+        }
+        else
+        {
+            ret_val = regcomp(&pattern->regex, pattern->text, REG_EXTENDED | REG_NOSUB | (casefold ? REG_ICASE : 0));
+            if (ret_val != 0)
+            {
+                regerror(ret_val, &pattern->regex, err_buf, err_len);
+                // Not compiled, so matcher_destroy() must not free it
+                pattern->kind = MATCH_LITERAL;
+                return EINVAL;
+            }
+            pattern->key = regex_factor(pattern->text);
+        }
+
+        if (NULL == pattern->key)
+        {
+            matcher->unkeyed[matcher->unkeyed_count++] = i;
+            continue;
+        }
+        if (casefold)
+        {
+            for (char* c = pattern->key; *c != '\0'; ++c)
+            {
+                *c = match_fold(*c);
+            }
+        }
+        total_len += strlen(pattern->key);
+    }
+
+    if (matcher->patterns_count == 1 && !casefold && matcher->patterns[0].kind == MATCH_LITERAL)
+    {
+        matcher->single_literal = 1;
+    }
+
+    // --- Byte classes: a class per byte appearing in some key, class 0 for all the others -----------
+    matcher->classes_count = 1;
+    for (int i = 0; i < matcher->patterns_count; ++i)
+    {
+        for (const unsigned char* c = (unsigned char*) matcher->patterns[i].key; NULL != c && *c != '\0'; ++c)
+        {
+            if (matcher->byte_class[*c] == 0)
+            {
+                matcher->byte_class[*c] = matcher->classes_count++;
+            }
+        }
+    }
+    if (casefold)
+    {
+        // Upper-case bytes of the names share their lower-case counterparts' class
+        for (int b = 'A'; b <= 'Z'; ++b)
+        {
+            matcher->byte_class[b] = matcher->byte_class[match_fold(b)];
+        }
+    }
+
+    // --- First bytes of the keys -----------
+    for (int i = 0; i < matcher->patterns_count && matcher->skip_count >= 0; ++i)
+    {
+        const unsigned char* key = (unsigned char*) matcher->patterns[i].key;
+        for (int folded = 0; NULL != key && *key != '\0' && folded <= casefold; ++folded)
+        {
+            unsigned char first = (folded && *key >= 'a' && *key <= 'z') ? *key - 'a' + 'A' : *key;
+            if (NULL != memchr(matcher->skip_bytes, first, matcher->skip_count))
+            {
+                continue;
+            }
+            if (matcher->skip_count == MATCH_SKIP_BYTES)
+            { // too many to skip to one by one
+                matcher->skip_count = -1;
+                break;
+            }
+            matcher->skip_bytes[matcher->skip_count++] = first;
+        }
+    }
+    matcher->skip_count = (matcher->skip_count > 0) ? matcher->skip_count : 0;
+
+    // --- Trie of the keys (at most one state per key byte, plus the root) -----------
+    int max_states = total_len + 1;
+    int classes = matcher->classes_count;
+    matcher->delta = (int32_t*) malloc((size_t) max_states * classes * sizeof(int32_t));
+    matcher->report = (int32_t*) malloc(max_states * sizeof(int32_t));
+    matcher->out_first = (int32_t*) malloc(max_states * sizeof(int32_t));
+    matcher->dict_link = (int32_t*) malloc(max_states * sizeof(int32_t));
+    matcher->outputs = (match_output_t*) malloc((matcher->patterns_count + 1) * sizeof(match_output_t));
+    int32_t* fail = (int32_t*) malloc(max_states * sizeof(int32_t));
+    int32_t* bfs = (int32_t*) malloc(max_states * sizeof(int32_t));
+    if (NULL == matcher->delta || NULL == matcher->report || NULL == matcher->out_first ||
+        NULL == matcher->dict_link || NULL == matcher->outputs || NULL == fail || NULL == bfs)
+    {
+        free(fail);
+        free(bfs);
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < (size_t) max_states * classes; ++i)
+    {
+        matcher->delta[i] = -1;
+    }
+    matcher->states_count = 1;
+    matcher->out_first[0] = -1;
+    for (int i = 0; i < matcher->patterns_count; ++i)
+    {
+        const unsigned char* c = (unsigned char*) matcher->patterns[i].key;
+        if (NULL == c || *c == '\0')
+        {
+            continue;
+        }
+        int state = 0;
+        for (; *c != '\0'; ++c)
+        {
+            int32_t* next = &matcher->delta[state * classes + matcher->byte_class[*c]];
+            if (*next < 0)
+            {
+                *next = matcher->states_count++;
+                matcher->out_first[*next] = -1;
+            }
+            state = *next;
+        }
+        match_output_t* output = &matcher->outputs[matcher->outputs_count];
+        output->pattern = i;
+        output->next = matcher->out_first[state];
+        matcher->out_first[state] = matcher->outputs_count++;
+    }
+
+    // --- Fail links (BFS), resolving the trie into a DFA on the way -----------
+    int bfs_head = 0;
+    int bfs_tail = 0;
+    fail[0] = 0;
+    matcher->dict_link[0] = -1;
+    for (int c = 0; c < classes; ++c)
+    {
+        int32_t* next = &matcher->delta[c];
+        if (*next < 0)
+        {
+            *next = 0;
+        }
+        else
+        {
+            fail[*next] = 0;
+            bfs[bfs_tail++] = *next;
+        }
+    }
+    while (bfs_head < bfs_tail)
+    {
+        int state = bfs[bfs_head++];
+        int fail_state = fail[state];
+        matcher->dict_link[state] = (matcher->out_first[fail_state] >= 0) ? fail_state : matcher->dict_link[fail_state];
+        for (int c = 0; c < classes; ++c)
+        {
+            int32_t* next = &matcher->delta[state * classes + c];
+            if (*next < 0)
+            {
+                // No such edge: goes where the longest proper suffix would
+                *next = matcher->delta[fail_state * classes + c];
+            }
+            else
+            {
+                fail[*next] = matcher->delta[fail_state * classes + c];
+                bfs[bfs_tail++] = *next;
+            }
+        }
+    }
+    for (int state = 0; state < matcher->states_count; ++state)
+    {
+        matcher->report[state] = (matcher->out_first[state] >= 0) ? state : matcher->dict_link[state];
+    }
+    free(fail);
+    free(bfs);
+    return 0;
+}
+
+// Checks a (glob / regex) pattern against the whole name
+static inline int pattern_check(const matcher_t* matcher, const match_pattern_t* pattern, const char* name)
+{
+    if (pattern->kind == MATCH_LITERAL)
+    {
+        return 1;
+    }
+    if (pattern->kind == MATCH_GLOB)
+    {
+        return fnmatch(pattern->text, name, (matcher->flags & MATCH_CASEFOLD) ? FNM_CASEFOLD : 0) == 0;
+    }
+    return regexec(&pattern->regex, name, 0, NULL, 0) == 0;
+}
+
+// Returns 1 IFF the (NUL-terminated) name matches some pattern
+static int matcher_match(const matcher_t* matcher, const char* name)
+{
+    if (matcher->match_all)
+    {
+        return 1;
+    }
+    if (matcher->single_literal)
+    {
+        return strstr(name, matcher->patterns[0].key) != NULL;
+    }
+
+    // Patterns whose key was found, but didn't match: skipped if their key is found again
+    uint64_t checked[MATCH_MAX_PATTERNS / 64];
+    int any_checked = 0;
+    const int32_t* delta = matcher->delta;
+    const uint8_t* byte_class = matcher->byte_class;
+    int classes = matcher->classes_count;
+    int32_t state = 0;
+
+    for (const unsigned char* c = (const unsigned char*) name; *c != '\0'; ++c)
+    {
+        state = delta[state * classes + byte_class[*c]];
+        if (matcher->report[state] < 0)
+        {
+            continue;
+        }
+        // Some keys end here: all the outputs of the state and its dictionary-suffixes
+        for (int32_t s = matcher->report[state]; s >= 0; s = matcher->dict_link[s])
+        {
+            for (int32_t o = matcher->out_first[s]; o >= 0; o = matcher->outputs[o].next)
+            {
+                int p = matcher->outputs[o].pattern;
+                const match_pattern_t* pattern = &matcher->patterns[p];
+                if (pattern->kind == MATCH_LITERAL)
+                {
+                    return 1;
+                }
+                if (!any_checked)
+                {
+                    memset(checked, 0, sizeof(checked));
+                    any_checked = 1;
+                }
+                if (!(checked[p / 64] & (1ULL << (p % 64))))
+                {
+                    if (pattern_check(matcher, pattern, name))
+                    {
+                        return 1;
+                    }
+                    checked[p / 64] |= 1ULL << (p % 64);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < matcher->unkeyed_count; ++i)
+    {
+        if (pattern_check(matcher, &matcher->patterns[matcher->unkeyed[i]], name))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Finds the first occurrence of any literal in 'data' ('len' bytes), for a matcher of literals only.
+ * Returns the offset of the occurrence's last byte (0 for an empty literal), or -1 if there's none
+ */
+static long matcher_find(const matcher_t* matcher, const char* data, size_t len)
+{
+    if (matcher->match_all)
+    {
+        return (len > 0) ? 0 : -1;
+    }
+    if (matcher->single_literal)
+    {
+        const char* key = matcher->patterns[0].key;
+        size_t key_len = strlen(key);
+        const char* hit = (const char*) memmem(data, len, key, key_len);
+        return (NULL != hit) ? hit - data + (long) key_len - 1 : -1;
+    }
+
+    const int32_t* delta = matcher->delta;
+    const uint8_t* byte_class = matcher->byte_class;
+    const int32_t* report = matcher->report;
+    int classes = matcher->classes_count;
+    int32_t state = 0;
+    if (matcher->skip_count == 0)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            state = delta[state * classes + byte_class[(unsigned char) data[i]]];
+            if (report[state] >= 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Offset of the next occurrence of each skip byte (at or after 'i'), 'len' if none, -1 until looked for
+    long next[MATCH_SKIP_BYTES];
+    for (int k = 0; k < matcher->skip_count; ++k)
+    {
+        next[k] = -1;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (state == 0)
+        {
+            size_t first = len;
+            for (int k = 0; k < matcher->skip_count; ++k)
+            {
+                if (next[k] < (long) i)
+                {
+                    const char* hit = (const char*) memchr(data + i, matcher->skip_bytes[k], len - i);
+                    next[k] = (NULL != hit) ? hit - data : (long) len;
+                }
+                first = ((size_t) next[k] < first) ? (size_t) next[k] : first;
+            }
+            if (first == len)
+            {
+                return -1;
+            }
+            i = first;
+        }
+        state = delta[state * classes + byte_class[(unsigned char) data[i]]];
+        if (report[state] >= 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void matcher_destroy(matcher_t* matcher)
+{
+    for (int i = 0; i < matcher->patterns_count; ++i)
+    {
+        if (matcher->patterns[i].kind == MATCH_REGEX)
+        {
+            regfree(&matcher->patterns[i].regex);
+        }
+        free(matcher->patterns[i].text);
+        free(matcher->patterns[i].key);
+    }
+    free(matcher->patterns);
+    free(matcher->delta);
+    free(matcher->report);
+    free(matcher->out_first);
+    free(matcher->dict_link);
+    free(matcher->outputs);
+    free(matcher->unkeyed);
+    memset(matcher, 0, sizeof(*matcher));
+}
+
+#endif
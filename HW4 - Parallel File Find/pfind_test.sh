@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# --- PFIND TESTS ---
+# Usage: ./pfind_test.sh <pfind-binary>
+# Runs each test case on a small tree generated under $TMPDIR, and reports it as PASS / FAIL (exits with 1 if any
+# failed). Cases that need root (to run pfind with other credentials) are reported as SKIP otherwise.
+
+set -u
+
+usage()
+{
+    echo "Usage: $0 <pfind-binary>" >&2
+    exit 1
+}
+
+failed=0
+
+report()
+{
+    local name=$1 result=$2
+    echo "$result: $name"
+    if [ "$result" = FAIL ]; then
+        failed=1
+    fi
+}
+
+# A directory that fails to open amid a batch: only it is skipped, its siblings are all still searched.
+# The directory passes pfind's access check, which uses the real uid (root), but opening it uses the effective one
+# (nobody), so the open fails as a race (e.g. a permission change) would make it
+test_open_failure()
+{
+    local pfind=$1 engine=$2
+    local name="open failure amid a batch (-e $engine)"
+    local tree="$work/open_failure"
+
+    mkdir -p "$tree"
+    # Needs root, and the engine (io_uring may be missing / disabled)
+    if [ "$(id -u)" -ne 0 ] || ! "$pfind" -e "$engine" "$tree" match_ 1 > /dev/null 2>&1; then
+        report "$name" SKIP
+        return
+    fi
+    chmod 755 "$work" "$tree"
+    # More directories than a batch (URING_DIR_BATCH), each holding a single match
+    for ((i = 1; i <= 40; i++)); do
+        mkdir -p "$tree/d$i"
+        touch "$tree/d$i/match_$i"
+    done
+    chmod 700 "$tree/d7"
+
+    local out
+    out=$(setpriv --ruid=0 --euid=65534 --egid=65534 --clear-groups "$pfind" -e "$engine" "$tree" match_ 2 2>/dev/null)
+    local status=$?
+    local expected actual
+    expected=$(for ((i = 1; i <= 40; i++)); do [ "$i" -ne 7 ] && echo "$tree/d$i/match_$i"; done | sort)
+    actual=$(grep -v '^Done searching' <<< "$out" | sort)
+    # The failed directory is an error (exit code 1), the others are all listed
+    if [ "$status" -eq 1 ] && [ "$expected" = "$actual" ]; then
+        report "$name" PASS
+    else
+        report "$name" FAIL
+    fi
+    rm -rf "$tree"
+}
+
+[ $# -eq 1 ] || usage
+pfind=$(realpath "$1")
+work=$(mktemp -d "${TMPDIR:-/tmp}/pfind_test.XXXXXX")
+trap 'rm -rf "$work"' EXIT
+
+for engine in sync uring; do
+    test_open_failure "$pfind" "$engine"
+done
+
+exit $failed